@@ -18,6 +18,7 @@ GNU General Public License for more details.
 #include "globaldata.h" // for access to many global vars
 #include "application.h" // for MsgSleep()
 #include "window.h" // For MsgBox()
+#include "profiler.h" // For AllocProfiler::Enable(), etc.
 #include "TextIO.h"
 
 // General note:
@@ -139,6 +140,8 @@ ResultType ParseCmdLineArgs(LPTSTR &script_filespec)
 		}
 		else if (!_tcsicmp(param, _T("/validate")))
 			g_script.mValidateThenExit = true;
+		else if (!_tcsicmp(param, _T("/LazyParse"))) // Ignored in combination with /validate.
+			g_script.mLazyParse = true;
 		// DEPRECATED: /iLib
 		else if (!_tcsicmp(param, _T("/iLib"))) // v1.0.47: Build an include-file so that ahk2exe can include library functions called by the script.
 		{
@@ -154,8 +157,16 @@ ResultType ParseCmdLineArgs(LPTSTR &script_filespec)
 			// Default codepage for the script file, NOT the default for commands used by it.
 			g_DefaultScriptCodepage = ATOU(param + 3);
 		}
+		else if (!_tcsnicmp(param, _T("/ProfileAlloc"), 13) && (param[13] == '\0' || param[13] == '='))
+			AllocProfiler::Enable(param[13] == '=' ? param + 14 : NULL);
+		else if (!_tcsnicmp(param, _T("/Benchmark"), 10) && (param[10] == '\0' || param[10] == '='))
+			BenchmarkRunner::Enable(param[10] == '=' ? param + 11 : NULL);
 #endif
 #ifdef CONFIG_DEBUGGER
+		else if (!_tcsicmp(param, _T("/ProfileCalls")))
+			CallProfiler::Enable();
+		else if (!_tcsnicmp(param, _T("/ProfileSample"), 14) && (param[14] == '\0' || param[14] == '='))
+			SampleProfiler::Enable(param[14] == '=' ? param + 15 : NULL);
 		// Allow a debug session to be initiated by command-line.
 		else if (!_tcsnicmp(param, _T("/Debug"), 6) && (param[6] == '\0' || param[6] == '='))
 		{
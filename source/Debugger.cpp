@@ -19,6 +19,7 @@ freely, without restriction.
 #include "script_object.h"
 #include "script_com.h"
 #include "TextIO.h"
+#include "profiler.h" // For CallProfiler.
 //#include "Debugger.h" // included by globaldata.h
 
 #ifdef CONFIG_DEBUGGER
@@ -39,6 +40,15 @@ LPCTSTR g_AutoExecuteThreadDesc = _T("Auto-execute"); // This is used to reduce
 // The first breakpoint uses sMaxId + 1. Don't change this without also changing breakpoint_remove.
 int Breakpoint::sMaxId = 0;
 
+Breakpoint::~Breakpoint()
+{
+	free(expression);
+	free(condition_name);
+	free(log_message);
+	if (condition_value.symbol == SYM_STRING)
+		free(condition_value.marker);
+}
+
 
 Debugger::CommandDef Debugger::sCommands[] =
 {
@@ -156,7 +166,8 @@ int Debugger::PreExecLine(Line *aLine)
 	
 	// Check for a breakpoint on the current line:
 	Breakpoint *bp = aLine->mBreakpoint;
-	if (bp && bp->state == BS_Enabled)
+	if (bp && bp->state == BS_Enabled && !mEvaluatingBreakpoint
+		&& (!bp->IsConditional() || BreakpointHit(*bp)))
 	{
 		if (bp->temporary)
 		{
@@ -194,6 +205,28 @@ int Debugger::PreExecLine(Line *aLine)
 }
 
 
+// BreakpointHit: aBreakpoint's line is about to execute.  Returns true if the script should break.
+bool Debugger::BreakpointHit(Breakpoint &aBreakpoint)
+{
+	if (aBreakpoint.condition_op && !EvaluateCondition(aBreakpoint))
+		return false;
+	++aBreakpoint.hit_count;
+	switch (aBreakpoint.hit_condition)
+	{
+	case HC_GreaterOrEqual: if (aBreakpoint.hit_count < aBreakpoint.hit_value) return false; break;
+	case HC_Equal: if (aBreakpoint.hit_count != aBreakpoint.hit_value) return false; break;
+	case HC_Multiple: if (aBreakpoint.hit_count % aBreakpoint.hit_value) return false; break;
+	}
+	if (aBreakpoint.log_message)
+	{
+		// Logpoints never break, so the client doesn't need to resume the script.
+		WriteLogMessage(aBreakpoint);
+		return false;
+	}
+	return true;
+}
+
+
 bool Debugger::PreThrow(ExprTokenType *aException)
 {
 	if (!mBreakOnException)
@@ -221,6 +254,15 @@ bool Debugger::HasPendingCommand()
 }
 
 
+bool Debugger::HasBufferedCommand(size_t aOffset)
+// Returns true if mCommandBuf contains a complete command beginning at or after aOffset,
+// meaning that it can be processed without waiting for more data.
+{
+	return aOffset < mCommandBuf.mDataUsed
+		&& memchr(mCommandBuf.mData + aOffset, '\0', mCommandBuf.mDataUsed - aOffset);
+}
+
+
 int Debugger::EnterBreakState(LPCSTR aReason)
 {
 	if (mInternalState != DIS_Break)
@@ -285,6 +327,10 @@ int Debugger::ProcessCommands(LPCSTR aBreakReason)
 	{
 		int command_length;
 
+		// Send any responses which were deferred below before waiting for more data.
+		if (!HasBufferedCommand() && (err = FlushResponses()))
+			break; // Already called FatalError().
+
 		if (err = ReceiveCommand(&command_length))
 			break; // Already called FatalError().
 
@@ -308,6 +354,10 @@ int Debugger::ProcessCommands(LPCSTR aBreakReason)
 			err = ParseArgs(args, argv, arg_count, transaction_id);
 		}
 		
+		// If the client has already sent another command, defer sending this command's response
+		// so that the responses to a series of pipelined commands are sent together.
+		mDeferResponses = HasBufferedCommand(command_length + 1);
+
 		if (!err)
 		{
 			for (int i = 0; ; ++i)
@@ -354,6 +404,7 @@ int Debugger::ProcessCommands(LPCSTR aBreakReason)
 			if (err = SendErrorResponse(command, transaction_id, err))
 				break; // Already called FatalError().
 		}
+		mDeferResponses = false;
 		
 		// Remove this command and its args from the buffer.
 		// (There may be additional commands following it.)
@@ -362,9 +413,15 @@ int Debugger::ProcessCommands(LPCSTR aBreakReason)
 
 		// If a command is received asynchronously, the debugger does not
 		// enter a break state.  In that case, we need to return after each
-		// command to avoid blocking in recv().
+		// command to avoid blocking in recv(), unless the next command has
+		// already been received.
 		if (mInternalState != DIS_Break)
 		{
+			if (HasBufferedCommand())
+				continue;
+			// Send any deferred responses before the message pump has a chance to re-enter.
+			if (err = FlushResponses())
+				break; // Already called FatalError().
 			// As ExitBreakState() can cause re-entry into ReceiveCommand() via the message pump,
 			// it is safe to call only now that the command has been removed from the buffer.
 			if (mInternalState != DIS_Starting) // i.e. it hasn't already been called by Disconnect().
@@ -372,6 +429,7 @@ int Debugger::ProcessCommands(LPCSTR aBreakReason)
 			break;
 		}
 	}
+	mDeferResponses = false;
 	ASSERT(mInternalState != DIS_Break);
 	// Register for message-based notification of data arrival.  If a command
 	// is received asynchronously, control will be passed back to the debugger
@@ -650,9 +708,11 @@ DEBUGGER_COMMAND(Debugger::breakpoint_set)
 {
 	char arg, *value;
 	
-	char *type = NULL, state = BS_Enabled, *filename = NULL;
+	char *type = NULL, state = BS_Enabled, *filename = NULL, *expression = NULL;
 	LineNumberType lineno = 0;
 	bool temporary = false;
+	char hit_condition = HC_None;
+	int hit_value = 0;
 
 	for (int i = 0; i < aArgCount; ++i)
 	{
@@ -690,19 +750,42 @@ DEBUGGER_COMMAND(Debugger::breakpoint_set)
 				break;
 			return DEBUGGER_E_INVALID_OPTIONS;
 
-		case 'm': // function
 		case 'h': // hit_value
+			hit_value = atoi(value);
+			break;
+
 		case 'o': // hit_condition = >= | == | %
-		case '-': // expression for conditional breakpoints
-			// These aren't used/supported.
+			if (!(hit_condition = ParseHitCondition(value)))
+				return DEBUGGER_E_INVALID_OPTIONS;
+			break;
+
+		case '-': // expression for conditional breakpoints, or message for logpoints
+			expression = value;
+			Base64Decode(expression, expression);
+			break;
+
+		case 'm': // function
+			// Not supported.
 		default:
 			return DEBUGGER_E_INVALID_OPTIONS;
 		}
 	}
 
+	if (hit_value && !hit_condition)
+		hit_condition = HC_GreaterOrEqual; // Default per the spec.
+	if (hit_condition && hit_value < 1)
+		return DEBUGGER_E_INVALID_OPTIONS;
+
 	// Breakpoint type is required according to the spec, but allowing it to be omitted
 	// and defaulting to "line" is more convenient for debugging the debugger via console.
-	if (type && strcmp(type, "line")) // i.e. type was specified and is not "line".
+	// "conditional" is treated as a line breakpoint with a condition.  "log" is an extension
+	// for logpoints, which write the message to stdout instead of breaking.
+	char bp_type = BT_Line;
+	if (type && !strcmp(type, "conditional") && expression)
+		bp_type = BT_Conditional;
+	else if (type && !strcmp(type, "log") && expression)
+		bp_type = BT_Log;
+	else if (type && strcmp(type, "line")) // i.e. type was specified and is not "line".
 	{
 		if (!strcmp(type, "exception") && lineno == 0 && !filename)
 		{
@@ -741,13 +824,24 @@ DEBUGGER_COMMAND(Debugger::breakpoint_set)
 	if (auto line = FindFirstLineForBreakpoint(file_index, lineno))
 	{
 		Breakpoint *bp = line->mBreakpoint;
-		if (!bp)
-		{
+		bool created = !bp;
+		if (created)
 			bp = new Breakpoint();
-			SetBreakpointForLineGroup(line, bp);
+		int err = bp_type == BT_Log ? CompileLogMessage(*bp, expression) : CompileCondition(*bp, expression);
+		if (err)
+		{
+			if (created)
+				delete bp;
+			return err;
 		}
+		if (created)
+			SetBreakpointForLineGroup(line, bp);
+		bp->type = bp_type;
 		bp->state = state;
 		bp->temporary = temporary;
+		bp->hit_condition = hit_condition;
+		bp->hit_value = hit_value;
+		bp->hit_count = 0;
 
 		return mResponseBuf.WriteF(
 			"<response command=\"breakpoint_set\" transaction_id=\"%e\" state=\"%s\" id=\"%i\"/>"
@@ -759,9 +853,296 @@ DEBUGGER_COMMAND(Debugger::breakpoint_set)
 
 int Debugger::WriteBreakpointXml(Breakpoint *aBreakpoint, Line *aLine)
 {
-	return mResponseBuf.WriteF("<breakpoint id=\"%i\" type=\"line\" state=\"%s\" filename=\"%r\" lineno=\"%u\"/>"
-		, aBreakpoint->id, aBreakpoint->state ? "enabled" : "disabled"
-		, Line::sSourceFile[aLine->mFileIndex], aLine->mLineNumber);
+	static const char *sHitConditionName[] = { "", ">=", "==", "%" };
+	mResponseBuf.WriteF("<breakpoint id=\"%i\" type=\"%s\" state=\"%s\" filename=\"%r\" lineno=\"%u\" hit_count=\"%i\""
+		, aBreakpoint->id
+		, aBreakpoint->type == BT_Conditional ? "conditional" : aBreakpoint->type == BT_Log ? "log" : "line"
+		, aBreakpoint->state ? "enabled" : "disabled"
+		, Line::sSourceFile[aLine->mFileIndex], aLine->mLineNumber, aBreakpoint->hit_count);
+	if (aBreakpoint->hit_condition)
+		mResponseBuf.WriteF(" hit_value=\"%i\" hit_condition=\"%e\""
+			, aBreakpoint->hit_value, sHitConditionName[aBreakpoint->hit_condition]);
+	if (!aBreakpoint->expression)
+		return mResponseBuf.Write("/>");
+	mResponseBuf.Write("><expression encoding=\"base64\">");
+	mResponseBuf.WriteEncodeBase64(aBreakpoint->expression, strlen(aBreakpoint->expression));
+	return mResponseBuf.Write("</expression></breakpoint>");
+}
+
+char Debugger::ParseHitCondition(LPCSTR aValue)
+{
+	if (!strcmp(aValue, ">=")) return HC_GreaterOrEqual;
+	if (!strcmp(aValue, "==")) return HC_Equal;
+	if (!strcmp(aValue, "%")) return HC_Multiple;
+	return HC_None;
+}
+
+static char *SkipSpaces(char *aBuf)
+{
+	while (IS_SPACE_OR_TAB(*aBuf))
+		++aBuf;
+	return aBuf;
+}
+
+// CompileCondition: Prepares aBreakpoint to break only when aExpression is true, or to break
+// unconditionally if aExpression is null.  Since code can't be compiled after the script has
+// loaded, the supported subset is "name", "!name" or "name op literal", where name is a property
+// name as accepted by property_get, op is one of = == != !== < <= > >= and literal is a number
+// or a quoted string.  This covers typical conditions without a round-trip to the client.
+int Debugger::CompileCondition(Breakpoint &aBreakpoint, char *aExpression)
+{
+	static const struct { char text[4]; char op; } sOperators[] =
+	{
+		{"!==", BC_NotEqualCase}, {"!=", BC_NotEqual}, {"==", BC_EqualCase}, {"=", BC_Equal},
+		{"<=", BC_LessOrEqual}, {"<", BC_Less}, {">=", BC_GreaterOrEqual}, {">", BC_Greater}
+	};
+	char op = BC_None, *name = nullptr, *name_end = nullptr;
+	ExprTokenType literal;
+	literal.SetValue(0);
+	if (aExpression)
+	{
+		char *cp = SkipSpaces(aExpression);
+		op = BC_True;
+		if (*cp == '!' && cp[1] != '=')
+		{
+			op = BC_False;
+			cp = SkipSpaces(cp + 1);
+		}
+		// Find the end of the name.  A quoted key such as x["a b"] may contain any character.
+		name = cp;
+		for (bool in_quotes = false; *cp; ++cp)
+		{
+			if (*cp == '"')
+				in_quotes = !in_quotes;
+			else if (!in_quotes && strchr(" \t=!<>", *cp))
+				break;
+		}
+		if (cp == name)
+			return DEBUGGER_E_EVAL_FAIL;
+		name_end = cp;
+		cp = SkipSpaces(cp);
+		if (*cp)
+		{
+			if (op == BC_False) // Negation is only supported for a lone name.
+				return DEBUGGER_E_EVAL_FAIL;
+			int i;
+			size_t op_length;
+			for (i = 0; ; ++i)
+			{
+				if (i == _countof(sOperators))
+					return DEBUGGER_E_EVAL_FAIL;
+				op_length = strlen(sOperators[i].text);
+				if (!strncmp(cp, sOperators[i].text, op_length))
+					break;
+			}
+			op = sOperators[i].op;
+			char *literal_start = SkipSpaces(cp + op_length), *literal_end;
+			bool quoted = *literal_start == '"' || *literal_start == '\'';
+			if (quoted)
+			{
+				// Escape sequences aren't supported.
+				literal_end = strchr(literal_start + 1, *literal_start);
+				if (!literal_end || *SkipSpaces(literal_end + 1))
+					return DEBUGGER_E_EVAL_FAIL;
+				++literal_start;
+			}
+			else
+			{
+				literal_end = literal_start + strlen(literal_start);
+				while (literal_end > literal_start && IS_SPACE_OR_TAB(literal_end[-1]))
+					--literal_end;
+			}
+			CStringTCharFromUTF8 literal_t(literal_start, int(literal_end - literal_start));
+			if (quoted)
+			{
+				LPTSTR str = _tcsdup(literal_t);
+				if (!str)
+					return DEBUGGER_E_INTERNAL_ERROR;
+				literal.SetValue(str, literal_t.GetLength());
+			}
+			else switch (IsNumeric(literal_t, TRUE, FALSE, TRUE))
+			{
+			case PURE_INTEGER: literal.SetValue(ATOI64(literal_t)); break;
+			case PURE_FLOAT: literal.SetValue(ATOF(literal_t)); break;
+			default: return DEBUGGER_E_EVAL_FAIL;
+			}
+		}
+	}
+
+	char *expression = nullptr, *name_copy = nullptr;
+	if (name)
+	{
+		expression = _strdup(aExpression);
+		name_copy = (char *)malloc(name_end - name + 1);
+		if (!expression || !name_copy)
+		{
+			free(expression);
+			free(name_copy);
+			if (literal.symbol == SYM_STRING)
+				free(literal.marker);
+			return DEBUGGER_E_INTERNAL_ERROR;
+		}
+		memcpy(name_copy, name, name_end - name);
+		name_copy[name_end - name] = '\0';
+	}
+	free(aBreakpoint.expression);
+	free(aBreakpoint.condition_name);
+	free(aBreakpoint.log_message);
+	if (aBreakpoint.condition_value.symbol == SYM_STRING)
+		free(aBreakpoint.condition_value.marker);
+	aBreakpoint.expression = expression;
+	aBreakpoint.condition_name = name_copy;
+	aBreakpoint.condition_op = op;
+	aBreakpoint.condition_value.CopyValueFrom(literal);
+	aBreakpoint.log_message = nullptr;
+	return DEBUGGER_E_OK;
+}
+
+// CompileLogMessage: Prepares aBreakpoint to write aMessage to stdout instead of breaking.
+// Each {name} is replaced with the value of the named property.  {{ and }} produce literal
+// braces.  The compiled message is a series of segments, each consisting of a type char
+// ('t' for text or 'p' for a property name) and a null-terminated string, followed by '\0'.
+int Debugger::CompileLogMessage(Breakpoint &aBreakpoint, char *aMessage)
+{
+	// The worst case is a series of single chars separated by properties, such as "a{b}c{d}".
+	char *expression = _strdup(aMessage);
+	char *compiled = (char *)malloc(3 * strlen(aMessage) + 1), *dst = compiled;
+	if (!expression || !compiled)
+	{
+		free(expression);
+		free(compiled);
+		return DEBUGGER_E_INTERNAL_ERROR;
+	}
+	for (char *cp = aMessage; *cp; )
+	{
+		if (*cp == '{' && cp[1] != '{')
+		{
+			char *end = strchr(++cp, '}');
+			if (!end || end == cp)
+			{
+				free(expression);
+				free(compiled);
+				return DEBUGGER_E_EVAL_FAIL;
+			}
+			*dst++ = 'p';
+			memcpy(dst, cp, end - cp);
+			dst += end - cp;
+			*dst++ = '\0';
+			cp = end + 1;
+			continue;
+		}
+		*dst++ = 't';
+		while (*cp && !(*cp == '{' && cp[1] != '{'))
+		{
+			if ((*cp == '{' || *cp == '}') && cp[1] == *cp)
+				++cp; // Skip the first of the pair.
+			*dst++ = *cp++;
+		}
+		*dst++ = '\0';
+	}
+	*dst = '\0';
+
+	CompileCondition(aBreakpoint, nullptr); // Clear any previous condition or message.
+	aBreakpoint.expression = expression;
+	aBreakpoint.log_message = compiled;
+	return DEBUGGER_E_OK;
+}
+
+// EvaluateProperty: Retrieves the value of a property in the current context, as for property_get.
+int Debugger::EvaluateProperty(LPCSTR aName, PropertySource &aProp)
+{
+	// Set a flag to prevent any property getter that this calls from evaluating or hitting breakpoints.
+	mEvaluatingBreakpoint = true;
+	int err = ParsePropertyName(aName, 0, FINDVAR_DEFAULT, nullptr, aProp);
+	// PropVarBkp is only used if aDepth > 0, and for other kinds the value has already been set.
+	if (!err && aProp.kind == PropVar)
+		err = GetPropertyValue(*aProp.var, aProp);
+	mEvaluatingBreakpoint = false;
+	return err;
+}
+
+bool Debugger::EvaluateCondition(Breakpoint &aBreakpoint)
+{
+	TCHAR value_buf[_f_retval_buf_size];
+	PropertySource prop(value_buf);
+	if (EvaluateProperty(aBreakpoint.condition_name, prop))
+		return false; // Treat an unknown property as false, so that "x" can be used to mean "x is set and true".
+	ExprTokenType &value = prop.value, &literal = aBreakpoint.condition_value;
+	char op = aBreakpoint.condition_op;
+	switch (op)
+	{
+	case BC_True: return TokenToBOOL(value);
+	case BC_False: return !TokenToBOOL(value);
+	}
+	if (value.symbol == SYM_OBJECT) // An object is never equal to a literal.
+		return op == BC_NotEqual || op == BC_NotEqualCase;
+	// Compare the same way as the corresponding expression operators.  As in an expression, a quoted
+	// literal is always a string, so x == "01" compares as strings even if x contains a number.
+	SymbolType value_type = TokenIsNumeric(value)
+		, literal_type = literal.symbol == SYM_STRING ? PURE_NOT_NUMERIC : literal.symbol;
+	if (value_type && literal_type)
+	{
+		if (value_type == PURE_INTEGER && literal_type == PURE_INTEGER)
+		{
+			__int64 left = TokenToInt64(value), right = TokenToInt64(literal);
+			switch (op)
+			{
+			case BC_Equal: case BC_EqualCase: return left == right;
+			case BC_NotEqual: case BC_NotEqualCase: return left != right;
+			case BC_Less: return left < right;
+			case BC_LessOrEqual: return left <= right;
+			case BC_Greater: return left > right;
+			default: return left >= right;
+			}
+		}
+		double left = TokenToDouble(value), right = TokenToDouble(literal);
+		switch (op)
+		{
+		case BC_Equal: case BC_EqualCase: return left == right;
+		case BC_NotEqual: case BC_NotEqualCase: return left != right;
+		case BC_Less: return left < right;
+		case BC_LessOrEqual: return left <= right;
+		case BC_Greater: return left > right;
+		default: return left >= right;
+		}
+	}
+	TCHAR left_buf[MAX_NUMBER_SIZE], right_buf[MAX_NUMBER_SIZE];
+	LPTSTR left = TokenToString(value, left_buf), right = TokenToString(literal, right_buf);
+	switch (op)
+	{
+	case BC_Equal: return !_tcsicmp(left, right);
+	case BC_EqualCase: return !_tcscmp(left, right);
+	case BC_NotEqual: return _tcsicmp(left, right) != 0;
+	case BC_NotEqualCase: return _tcscmp(left, right) != 0;
+	}
+	return false; // Relational comparison of non-numeric values would be an error.
+}
+
+int Debugger::WriteLogMessage(Breakpoint &aBreakpoint)
+{
+	CStringA message;
+	for (char *cp = aBreakpoint.log_message; *cp; cp += strlen(cp) + 1)
+	{
+		if (*cp++ == 't')
+		{
+			message.Append(cp);
+			continue;
+		}
+		TCHAR value_buf[_f_retval_buf_size], num_buf[MAX_NUMBER_SIZE];
+		PropertySource prop(value_buf);
+		if (EvaluateProperty(cp, prop))
+		{
+			// Leave the reference in the message to indicate that it couldn't be resolved.
+			message.Append('{');
+			message.Append(cp);
+			message.Append('}');
+		}
+		else
+			message.Append(CStringUTF8FromTChar(prop.value.symbol == SYM_OBJECT
+				? prop.value.object->Type() : TokenToString(prop.value, num_buf)));
+	}
+	message.Append('\n');
+	return WriteStreamPacket(CStringTCharFromUTF8(message), "stdout");
 }
 
 int Debugger::WriteExceptionBreakpointXml()
@@ -807,7 +1188,8 @@ DEBUGGER_COMMAND(Debugger::breakpoint_update)
 	
 	int breakpoint_id = 0; // Breakpoint IDs begin at 1.
 	LineNumberType lineno = 0;
-	char state = -1;
+	char state = -1, hit_condition = -1;
+	int hit_value = -1;
 
 	for (int i = 0; i < aArgCount; ++i)
 	{
@@ -833,8 +1215,12 @@ DEBUGGER_COMMAND(Debugger::breakpoint_update)
 			break;
 
 		case 'h': // hit_value
-		case 'o': // hit_condition
-			// These aren't used/supported, but ignored for now.
+			hit_value = atoi(value);
+			break;
+
+		case 'o': // hit_condition = >= | == | %
+			if (!(hit_condition = ParseHitCondition(value)))
+				return DEBUGGER_E_INVALID_OPTIONS;
 			break;
 
 		default:
@@ -865,6 +1251,18 @@ DEBUGGER_COMMAND(Debugger::breakpoint_update)
 				}
 			}
 
+			if (hit_value != -1 || hit_condition != -1)
+			{
+				if (hit_value == -1)
+					hit_value = bp->hit_value;
+				if (hit_condition == -1)
+					hit_condition = bp->hit_condition ? bp->hit_condition : HC_GreaterOrEqual;
+				if (hit_value < 1)
+					return DEBUGGER_E_INVALID_OPTIONS;
+				bp->hit_value = hit_value;
+				bp->hit_condition = hit_condition;
+			}
+
 			if (state != -1)
 				bp->state = state;
 
@@ -1252,16 +1650,25 @@ int Debugger::WriteEnumItems(PropertyInfo &aProp, IObject *aEnumerable)
 
 void Debugger::PropertyWriter::WriteEnumItems(IObject *aEnumerable, int aStart, int aEnd)
 {
-	IObject *enumerator;
-	auto result = GetEnumerator(enumerator, ExprTokenType(aEnumerable), 2, false);
-	if (result != OK)
+	// Array and Map items can be retrieved directly by index, so that each page costs only as much
+	// as the items it contains, rather than requiring the enumerator to be called for every item
+	// which precedes the page.  The enumerator is still created for the main property, if needed.
+	Object *direct_obj;
+	auto direct_get_item = GetDirectEnumerator(aEnumerable, direct_obj);
+	bool write_main_property = !mDepth;
+
+	IObject *enumerator = nullptr;
+	if (write_main_property || !direct_get_item)
 	{
-		mError = DEBUGGER_E_EVAL_FAIL;
-		return;
+		auto result = GetEnumerator(enumerator, ExprTokenType(aEnumerable), 2, false);
+		if (result != OK)
+		{
+			mError = DEBUGGER_E_EVAL_FAIL;
+			return;
+		}
 	}
 
 	DebugCookie cookie;
-	bool write_main_property = !mDepth;
 	if (write_main_property)
 	{
 		if (!mObject)
@@ -1273,9 +1680,12 @@ void Debugger::PropertyWriter::WriteEnumItems(IObject *aEnumerable, int aStart,
 	{
 		auto vkey = new VarRef(), vval = new VarRef();
 		ExprTokenType tparam[] = { vkey, vval }, *param[] = { tparam, tparam + 1 };
-		for (int i = 0; i < aEnd; ++i)
+		for (int i = direct_get_item ? aStart : 0; i < aEnd; ++i)
 		{
-			result = CallEnumerator(enumerator, param, 2, false);
+			UINT index = i;
+			auto result = direct_get_item
+				? (direct_obj->*direct_get_item)(index, vkey, vval, 2)
+				: CallEnumerator(enumerator, param, 2, false);
 			if (result != CONDITION_TRUE)
 				break;
 			if (i >= aStart)
@@ -1293,7 +1703,8 @@ void Debugger::PropertyWriter::WriteEnumItems(IObject *aEnumerable, int aStart,
 	if (write_main_property)
 		EndProperty(cookie);
 
-	enumerator->Release();
+	if (enumerator)
+		enumerator->Release();
 }
 
 int Debugger::WritePropertyXml(PropertyInfo &aProp)
@@ -2166,11 +2577,21 @@ DEBUGGER_COMMAND(Debugger::redirect_stderr)
 int Debugger::WriteStreamPacket(LPCTSTR aText, LPCSTR aType)
 {
 	ASSERT(!mResponseBuf.mFailed);
+	// Send any responses deferred while processing pipelined commands first, so that the client
+	// receives them before the output, and send the packet immediately rather than holding it
+	// back until the end of the batch.
+	int err;
+	if (err = FlushResponses())
+		return err;
 	mResponseBuf.WriteF("<stream type=\"%s\">", aType);
 	CStringUTF8FromTChar packet(aText);
 	mResponseBuf.WriteEncodeBase64(packet, packet.GetLength() + 1); // Includes the null-terminator.
 	mResponseBuf.Write("</stream>");
-	return SendResponse();
+	bool defer_responses = mDeferResponses;
+	mDeferResponses = false;
+	err = SendResponse();
+	mDeferResponses = defer_responses;
+	return err;
 }
 
 bool Debugger::OutputStdErr(LPCTSTR aText)
@@ -2273,6 +2694,7 @@ int Debugger::ReceiveCommand(int *aCommandLength)
 // Debugger::SendResponse
 //
 // Sends a response to a command, using mResponseBuf.mData as the message body.
+// If mDeferResponses is true, the response is queued until FlushResponses() is called.
 //
 int Debugger::SendResponse()
 {
@@ -2289,20 +2711,39 @@ int Debugger::SendResponse()
 	// The XML document tag must always be present to provide XML version and encoding information.
 	buf += sprintf(buf, "%s", DEBUGGER_XML_TAG);
 
-	// Send the response header.
-	if (  SOCKET_ERROR == send(mSocket, response_header, (int)(buf - response_header), 0)
-	   // Messages sent by the debugger engine must always be NULL terminated.
-	   // Failure to write the last byte should be extremely rare, so no attempt
-	   // is made to recover from that condition.
-	   || DEBUGGER_E_OK != mResponseBuf.Write("\0", 1)
-	   // Send the message body.
-	   || SOCKET_ERROR == send(mSocket, mResponseBuf.mData, (int)mResponseBuf.mDataUsed, 0)  )
+	// Messages sent by the debugger engine must always be NULL terminated.
+	// Failure to write the last byte should be extremely rare, so no attempt
+	// is made to recover from that condition.
+	if (DEBUGGER_E_OK != mResponseBuf.Write("\0", 1))
+		return FatalError();
+
+	// Append the header and message body to any previously deferred responses, so that they
+	// can all be sent with a single call.
+	if (  DEBUGGER_E_OK != mSendBuf.Write(response_header, buf - response_header)
+	   || DEBUGGER_E_OK != mSendBuf.Write(mResponseBuf.mData, mResponseBuf.mDataUsed)  )
 	{
-		// Unrecoverable error: disconnect the debugger.
+		mSendBuf.Clear();
 		return FatalError();
 	}
-
 	mResponseBuf.Clear();
+
+	if (mDeferResponses)
+		return DEBUGGER_E_OK;
+	return FlushResponses();
+}
+
+// Debugger::FlushResponses
+//
+// Sends the responses queued by SendResponse(), with a single call.
+//
+int Debugger::FlushResponses()
+{
+	if (!mSendBuf.mDataUsed)
+		return DEBUGGER_E_OK;
+	int result = send(mSocket, mSendBuf.mData, (int)mSendBuf.mDataUsed, 0);
+	mSendBuf.Clear(); // Before FatalError(), so that Disconnect() doesn't try to send it again.
+	if (result == SOCKET_ERROR)
+		return FatalError();
 	return DEBUGGER_E_OK;
 }
 
@@ -2395,6 +2836,9 @@ int Debugger::Disconnect()
 {
 	if (mSocket != INVALID_SOCKET)
 	{
+		// Make a best effort to send any deferred responses, such as the response to "detach".
+		if (mSendBuf.mDataUsed)
+			send(mSocket, mSendBuf.mData, (int)mSendBuf.mDataUsed, 0);
 		shutdown(mSocket, 2);
 		closesocket(mSocket);
 		mSocket = INVALID_SOCKET;
@@ -2403,6 +2847,7 @@ int Debugger::Disconnect()
 	// These are reset in case we re-attach to the debugger client later:
 	mCommandBuf.Clear();
 	mResponseBuf.Clear();
+	mSendBuf.Clear();
 	mStdOutMode = SR_Disabled;
 	mStdErrMode = SR_Disabled;
 	if (mInternalState == DIS_Break)
@@ -2844,6 +3289,8 @@ void DbgStack::Pop()
 	--mTop;
 	if (mTop >= mBottom)
 		g_script.mCurrLine = g_Debugger.mCurrLine = mTop->line;
+	if (CallProfiler::sEnabled)
+		CallProfiler::Leave();
 }
 
 void DbgStack::Push(LPCTSTR aDesc)
@@ -2852,6 +3299,8 @@ void DbgStack::Push(LPCTSTR aDesc)
 	s.line = NULL;
 	s.desc = aDesc;
 	s.type = SE_Thread;
+	if (CallProfiler::sEnabled)
+		CallProfiler::Enter((void *)aDesc, true);
 }
 	
 void DbgStack::Push(NativeFunc *aFunc)
@@ -2860,6 +3309,8 @@ void DbgStack::Push(NativeFunc *aFunc)
 	s.line = NULL;
 	s.func = aFunc;
 	s.type = SE_BIF;
+	if (CallProfiler::sEnabled)
+		CallProfiler::Enter(static_cast<Func *>(aFunc), false);
 }
 
 void DbgStack::Push(UDFCallInfo *aUDF)
@@ -2868,6 +3319,8 @@ void DbgStack::Push(UDFCallInfo *aUDF)
 	s.line = aUDF->func->mJumpToLine;
 	s.udf = aUDF;
 	s.type = SE_UDF;
+	if (CallProfiler::sEnabled)
+		CallProfiler::Enter(static_cast<Func *>(aUDF->func), false);
 }
 
 
@@ -79,8 +79,12 @@ extern CStringA g_DebuggerPort;
 extern LPCTSTR g_AutoExecuteThreadDesc;
 
 
-enum BreakpointTypeType {BT_Line, BT_Call, BT_Return, BT_Exception, BT_Conditional, BT_Watch};
+enum BreakpointTypeType {BT_Line, BT_Call, BT_Return, BT_Exception, BT_Conditional, BT_Watch, BT_Log};
 enum BreakpointStateType {BS_Disabled=0, BS_Enabled};
+enum BreakpointHitConditionType {HC_None=0, HC_GreaterOrEqual, HC_Equal, HC_Multiple};
+enum BreakpointConditionType {BC_None=0, BC_True, BC_False
+	, BC_Equal, BC_EqualCase, BC_NotEqual, BC_NotEqualCase
+	, BC_Less, BC_LessOrEqual, BC_Greater, BC_GreaterOrEqual};
 
 class Breakpoint
 {
@@ -89,12 +93,29 @@ public:
 	char type;
 	char state;
 	bool temporary;
+	char hit_condition; // BreakpointHitConditionType.
+	int hit_value;
+	int hit_count; // Number of times the line was reached while enabled and the condition (if any) was true.
+
+	// The condition or log message is compiled by breakpoint_set and evaluated by PreExecLine,
+	// so that the client is only involved if the script actually breaks.
+	char *expression; // UTF-8 text given by the client, for breakpoint_get.
+	char *condition_name; // Property name in the format accepted by property_get.
+	char condition_op; // BreakpointConditionType.
+	ExprTokenType condition_value; // Literal to compare with, if any.  Any string is owned by the breakpoint.
+	char *log_message; // See Debugger::CompileLogMessage.
 	
-	// Not yet supported: function, hit_count, hit_value, hit_condition, exception
+	// Not yet supported: function, exception
 
 	Breakpoint() : id(AllocateID()), type(BT_Line), state(BS_Enabled), temporary(false)
+		, hit_condition(HC_None), hit_value(0), hit_count(0)
+		, expression(nullptr), condition_name(nullptr), condition_op(BC_None), log_message(nullptr)
 	{
+		condition_value.SetValue(0);
 	}
+	~Breakpoint();
+
+	bool IsConditional() { return condition_op || hit_condition || log_message; }
 
 	static int AllocateID() { return ++sMaxId; }
 
@@ -276,6 +297,7 @@ public:
 		, mMaxPropertyData(1024), mContinuationTransactionId(""), mStdErrMode(SR_Disabled), mStdOutMode(SR_Disabled)
 		, mMaxChildren(20), mMaxDepth(2), mDisabledHooks(0)
 		, mThrownToken(NULL), mBreakOnExceptionID(0), mBreakOnExceptionWasSet(false), mBreakOnExceptionIsTemporary(false), mBreakOnException(false)
+		, mDeferResponses(false), mEvaluatingBreakpoint(false)
 	{
 	}
 
@@ -316,7 +338,10 @@ private:
 	private:
 		int EstimateFileURILength(LPCTSTR aPath);
 		void WriteFileURI(LPCTSTR aPath);
-	} mCommandBuf, mResponseBuf;
+	} mCommandBuf, mResponseBuf
+		, mSendBuf; // Responses (with headers) deferred while processing pipelined commands.
+	bool mDeferResponses;
+	bool mEvaluatingBreakpoint; // Prevents recursion if evaluating a condition calls a property getter.
 
 	enum DebuggerInternalStateType {
 		DIS_None = 0,
@@ -422,8 +447,11 @@ private:
 	// Receive next command from debugger UI:
 	int ReceiveCommand(int *aCommandSize=NULL);
 
+	bool HasBufferedCommand(size_t aOffset = 0);
+
 	// Send XML response to debugger UI:
 	int SendResponse();
+	int FlushResponses();
 	int SendErrorResponse(char *aCommandName, char *aTransactionId, int aError=999, char *aExtraAttributes=NULL);
 	int SendStandardResponse(char *aCommandName, char *aTransactionId);
 	int SendContinuationResponse(LPCSTR aCommand = nullptr, LPCSTR aStatus = "break", LPCSTR aReason = "ok");
@@ -432,6 +460,13 @@ private:
 	void ExitBreakState();
 
 	int WriteBreakpointXml(Breakpoint *aBreakpoint, Line *aLine);
+	static char ParseHitCondition(LPCSTR aValue);
+	int CompileCondition(Breakpoint &aBreakpoint, char *aExpression);
+	int CompileLogMessage(Breakpoint &aBreakpoint, char *aMessage);
+	bool BreakpointHit(Breakpoint &aBreakpoint);
+	int EvaluateProperty(LPCSTR aName, PropertySource &aProp);
+	bool EvaluateCondition(Breakpoint &aBreakpoint);
+	int WriteLogMessage(Breakpoint &aBreakpoint);
 	int WriteExceptionBreakpointXml();
 	Line *FindFirstLineForBreakpoint(int file_index, UINT line_no);
 
@@ -193,7 +193,7 @@ HWND WinGroup::Activate(bool aStartWithMostRecent)
 			MarkAsVisited(active_window);
 		}
 		ws.mAlreadyVisitedCount = sAlreadyVisitedCount;
-		EnumWindows(EnumParentFind, (LPARAM)&ws);
+		WindowSnapshot::Enum(ws, EnumParentFind);
 		if (ws.mFoundParent)
 		{
 			// We found a window to activate, so we're done.
@@ -20,6 +20,7 @@ GNU General Public License for more details.
 #include "window.h" // for several MsgBox and window functions
 #include "util.h" // for strlcpy()
 #include "resources/resource.h"  // For ID_TRAY_OPEN.
+#include "profiler.h" // For SampleProfiler.
 
 
 bool MsgSleep(int aSleepDuration, MessageMode aMode)
@@ -433,6 +434,11 @@ bool MsgSleep(int aSleepDuration, MessageMode aMode)
 		// for further processing.
 		++messages_received;
 
+		// Events from the hook thread are queued rather than posted (see PostHookMessage()).
+		// Substitute the next one so that it is handled exactly as though it had been posted.
+		if (msg.message == AHK_HOOK_EVENTS && msg.hwnd == g_hWnd && !GetHookMessage(msg))
+			continue;
+
 		// For max. flexibility, it seems best to allow the message filter to have the first
 		// crack at looking at the message, before even TRANSLATE_AHK_MSG:
 		if (g_MsgMonitor.Count() && MsgMonitor(msg.hwnd, msg.message, msg.wParam, msg.lParam, &msg, msg_reply))  // Count is checked here to avoid function-call overhead.
@@ -1846,6 +1852,10 @@ void InitNewThread(int aPriority, bool aSkipUninterruptible, bool aIncrementThre
 {
 	if (aIncrementThreadCountAndUpdateTrayIcon)
 	{
+#ifdef CONFIG_DEBUGGER
+		if (SampleProfiler::sEnabled && !g_nThreads)
+			SampleProfiler::ThreadStarted(); // Exclude the time the script was idle from the next sample.
+#endif
 		++g_nThreads; // It is the caller's responsibility to avoid calling us if the thread count is too high.
 		// Once g_array[0] is used by AutoExec section, it's never used by any other thread because:
 		//  1) the auto-execute thread might never finish, in which case it needs to keep consulting the values in g_array[0].
@@ -1858,6 +1868,9 @@ void InitNewThread(int aPriority, bool aSkipUninterruptible, bool aIncrementThre
 	global_struct &g = *::g; // Must be done AFTER the ++g above. Reduces code size and may improve performance.
 	global_clear_state(g);
 	g.Priority = aPriority;
+	// PeekFrequency was reset above and might be changed below, so have ExecUntil() re-arm the peek
+	// timer for the new thread's frequency rather than the one it was last armed for.
+	g_script.mPeekDue = true;
 
 	// If the current quasi-thread is paused, the thread we're about to launch will not be, so the tray icon
 	// needs to be checked unless the caller said it wasn't needed.  In any case, if the tray icon is already
@@ -1911,6 +1924,7 @@ void ResumeUnderlyingThread()
 	--g_nThreads; // Other sections below might rely on this having been done early.
 	--g;
 	// The below relies on the above having restored "g" to be the global_struct of the underlying thread.
+	g_script.mPeekDue = true; // The resumed thread's PeekFrequency might differ from the one the peek timer was armed for.
 
 	// If the thread to be resumed was paused and has not been unpaused above, it will automatically be
 	// resumed in a paused state because when we return from this function, we should be returning to
@@ -1994,7 +2008,10 @@ BOOL IsInterruptible()
 		// interruptibility again, and it resets g->UninterruptibleDuration.
 		g->AllowThreadToBeInterrupted = true; // Avoids issues with 49.7 day limit of 32-bit TickCount, and also helps performance future callers of this function (they can skip most of the checking above).
 		if (!g->ThreadIsCritical)
+		{
 			g->PeekFrequency = DEFAULT_PEEK_FREQUENCY;
+			g_script.mPeekDue = true; // Re-arm the peek timer for the new frequency.
+		}
 	}
 	//else g->AllowThreadToBeInterrupted is already up-to-date.
 	return (BOOL)g->AllowThreadToBeInterrupted;
@@ -32,6 +32,10 @@
 // Generates warnings to help we check whether the codes are ready to handle Unicode or not.
 //#define CONFIG_UNICODE_CHECK
 
+// Counts the temporary string allocations, copies and ownership transfers made by each expression.
+// The counts are included in the /ProfileAlloc report.
+//#define CONFIG_EXPR_ALLOC_STATS
+
 // This is now defined via Config.vcxproj if supported by the current platform toolset.
 //#ifndef _WIN64
 //#define CONFIG_WIN2K
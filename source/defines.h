@@ -874,6 +874,13 @@ struct HotkeyCriterion
 	IObject *Callback;
 	HotkeyCriterion *NextCriterion, *NextExpr;
 
+	// The most recent result of a HOT_IF_ACTIVE/EXIST criterion, cached by the hook thread.
+	// See HotCriterionAllowsFiring() for details.
+	HWND CachedHwnd, CachedForeground;
+	UINT CachedGeneration; // Zero if no result is cached.
+	UCHAR CachedSettings;
+	bool Cacheable;
+
 	ResultType Eval(LPTSTR aHotkeyName); // For HOT_IF_CALLBACK.
 };
 
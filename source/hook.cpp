@@ -78,6 +78,19 @@ static key_type *ksc = NULL;
 #define KVKM_SIZE ((MODLR_MAX + 1)*(VK_ARRAY_COUNT))
 #define KSCM_SIZE ((MODLR_MAX + 1)*(SC_ARRAY_COUNT))
 
+// The above arrays give only the most specific hotkey for each modifier state, so when its variants
+// aren't eligible, or a key-up hotkey must be paired with a key-down hotkey, the hook searches the
+// other hotkeys which use the same suffix key.  To avoid following the mNextHotkey list through
+// each Hotkey object, ChangeHookState() flattens each key's list into a contiguous array with the
+// modifiers that each hotkey requires or excludes already in left/right form.
+struct HotkeyDispatch
+{
+	int *position; // For each hotkey ID, the index of its entry in candidate[], or -1 if not in any list.
+	HotkeyCandidate *candidate;
+	int hotkey_count, candidate_count;
+};
+static HotkeyDispatch *sHotkeyDispatch = NULL; // NULL if not yet built or out of memory, in which case the lists are searched directly.
+
 
 // Notes about fake shift-key events (there used to be some related variables defined here,
 // but they were superseded by SC_FAKE_LSHIFT and SC_FAKE_RSHIFT):
@@ -154,10 +167,166 @@ inline bool IsIgnored(ULONG_PTR aExtraInfo)
 
 
 
+// HookReplay() feeds events directly to the hook procedures, for testing and benchmarking them
+// without real input.  Only the hook's own outputs are intercepted: while an event is being
+// replayed, the next hook in the chain isn't called and the hotkeys or hotstrings which would
+// have fired are recorded rather than posted to the main thread.  Everything else (including
+// key state, key history, Input hooks and any keystrokes the hook itself sends) is real.
+static HookReplayEvent *sReplayEvent = NULL; // Non-NULL only while the hook thread is replaying an event.
+static volatile bool sReplayDone;
+
+static inline LRESULT CallNextHook(HHOOK aHook, int aCode, WPARAM wParam, LPARAM lParam)
+{
+	if (sReplayEvent)
+		return 0;
+	return CallNextHookEx(aHook, aCode, wParam, lParam);
+}
+
+
+// Events for the main thread (such as AHK_HOOK_HOTKEY, AHK_HOTSTRING and AHK_INPUT_CHAR) are
+// passed through a lock-free, single-producer ring buffer rather than each being posted.  The hook
+// thread is the only producer and the main thread is the only consumer.  When the script stops an
+// Input, the main thread doesn't write to the ring; PostInputEnd() holds AHK_INPUT_END back until
+// the events queued ahead of it have been taken, so it stays in order with them.
+// A producer posts AHK_HOOK_EVENTS only if no wake-up is already pending, so a burst of input
+// causes only one message to be posted by the hook thread.  The main thread takes one event for
+// each AHK_HOOK_EVENTS it receives and handles it exactly as if it had been posted, then posts
+// another AHK_HOOK_EVENTS if any events remain.  This costs the main thread a PostMessage() per
+// event, but keeps events in order with other messages, one at a time, and deferred by
+// MSG_FILTER_MAX while the script is uninterruptible, which wouldn't be possible if a batch was
+// handled in one go.  If the buffer fills up, further events are posted directly (as they were
+// before the buffer existed) rather than being dropped, although they may then be handled ahead
+// of events still in the buffer.
+#define HOOK_EVENT_QUEUE_SIZE 2048 // Must be a power of 2.
+struct HookEvent
+{
+	UINT message;
+	DWORD time;
+	WPARAM wParam;
+	LPARAM lParam;
+};
+static HookEvent sHookEvent[HOOK_EVENT_QUEUE_SIZE];
+static volatile LONG sHookEventHead = 0; // The next event to be read.  Written only by the main thread.
+static volatile LONG sHookEventTail = 0; // The next slot to be written.  Written only by the hook thread.
+static volatile LONG sHookEventWakePending = 0; // Non-zero if AHK_HOOK_EVENTS has been posted but not yet received.
+static UINT_PTR sHookEventCount = 0, sHookEventWakeups = 0, sHookEventOverflow = 0, sHookEventDropped = 0;
+static LONG sHookEventMaxDepth = 0;
+
+// AHK_INPUT_END messages generated by the main thread, waiting for the events which were queued
+// ahead of them to be taken.  Accessed only by the main thread.
+#define INPUT_END_QUEUE_SIZE 16
+struct PendingInputEnd
+{
+	input_type *input;
+	LONG seq; // The value of sHookEventTail when the Input ended.
+};
+static PendingInputEnd sPendingInputEnd[INPUT_END_QUEUE_SIZE];
+static int sPendingInputEndCount = 0;
+
+void PostHookMessage(UINT aMsg, WPARAM wParam, LPARAM lParam)
+// Queues a message for the main thread.  Called only by the hook thread.
+{
+	if (sReplayEvent && (aMsg == AHK_HOOK_HOTKEY || aMsg == AHK_HOTSTRING))
+	{
+		if (aMsg == AHK_HOTSTRING)
+			sReplayEvent->hotstring_id = wParam;
+		else if (sReplayEvent->hotkey_id == HOTKEY_ID_INVALID)
+			sReplayEvent->hotkey_id = wParam;
+		return;
+	}
+	LONG tail = sHookEventTail;
+	LONG depth = tail - sHookEventHead;
+	MemoryBarrier(); // Ensure the main thread has finished reading the slot before it is reused.
+	if (depth >= HOOK_EVENT_QUEUE_SIZE)
+	{
+		// Post it directly rather than dropping it.  This is only likely if the main thread has
+		// been unresponsive for a long time, in which case the order doesn't matter as much.
+		if (PostMessage(g_hWnd, aMsg, wParam, lParam))
+			++sHookEventOverflow;
+		else
+			++sHookEventDropped; // The message queue is also full.
+		return;
+	}
+	HookEvent &event = sHookEvent[tail & (HOOK_EVENT_QUEUE_SIZE - 1)];
+	event.message = aMsg;
+	event.time = GetTickCount();
+	event.wParam = wParam;
+	event.lParam = lParam;
+	InterlockedExchange(&sHookEventTail, tail + 1); // Full barrier, so the event is visible before the new tail.
+	++sHookEventCount;
+	if (sHookEventMaxDepth <= depth)
+		sHookEventMaxDepth = depth + 1;
+	if (!InterlockedExchange(&sHookEventWakePending, 1))
+	{
+		++sHookEventWakeups;
+		if (!PostMessage(g_hWnd, AHK_HOOK_EVENTS, 0, 0))
+			sHookEventWakePending = 0; // Let the next event try again.
+	}
+}
+
+void PostInputEnd(input_type *aInput)
+// Called by the main thread when it ends an Input.  AHK_INPUT_END is delivered by GetHookMessage()
+// after any events the hook thread had already queued, such as AHK_INPUT_CHAR for that Input.
+{
+	LONG tail = sHookEventTail;
+	if (tail == sHookEventHead && !sPendingInputEndCount // Nothing to wait for.
+		|| sPendingInputEndCount == INPUT_END_QUEUE_SIZE) // Very unlikely; order is less important than not losing it.
+	{
+		PostMessage(g_hWnd, AHK_INPUT_END, (WPARAM)aInput, 0);
+		return;
+	}
+	// An AHK_HOOK_EVENTS message is pending for the queued events, or will be posted by the
+	// hook thread when it finishes queuing the latest one.
+	PendingInputEnd &end = sPendingInputEnd[sPendingInputEndCount++];
+	end.input = aInput;
+	end.seq = tail;
+}
+
+bool GetHookMessage(MSG &aMsg)
+// Called by the main thread upon receiving AHK_HOOK_EVENTS.  Replaces aMsg with the next queued
+// event and returns true, or returns false if there are none.
+{
+	// Clear the flag before checking for events, so that any event queued after the check
+	// will post a new AHK_HOOK_EVENTS.
+	InterlockedExchange(&sHookEventWakePending, 0);
+	LONG head = sHookEventHead;
+	LONG tail = sHookEventTail;
+	MemoryBarrier(); // Ensure the event is read only after the tail which published it.
+	HookEvent event;
+	if (sPendingInputEndCount && head - sPendingInputEnd[0].seq >= 0)
+	{
+		// Everything queued before this Input ended has been taken.
+		event.message = AHK_INPUT_END;
+		event.time = GetTickCount();
+		event.wParam = (WPARAM)sPendingInputEnd[0].input;
+		event.lParam = 0;
+		if (--sPendingInputEndCount)
+			memmove(sPendingInputEnd, sPendingInputEnd + 1, sPendingInputEndCount * sizeof(PendingInputEnd));
+	}
+	else if (head != tail)
+	{
+		event = sHookEvent[head & (HOOK_EVENT_QUEUE_SIZE - 1)];
+		InterlockedExchange(&sHookEventHead, ++head); // Full barrier, so the slot isn't released until it has been read.
+	}
+	else
+		return false;
+	if ((head != tail || sPendingInputEndCount) && !InterlockedExchange(&sHookEventWakePending, 1))
+		if (!PostMessage(g_hWnd, AHK_HOOK_EVENTS, 0, 0))
+			sHookEventWakePending = 0;
+	aMsg.hwnd = g_hWnd;
+	aMsg.message = event.message;
+	aMsg.wParam = event.wParam;
+	aMsg.lParam = event.lParam;
+	aMsg.time = event.time;
+	return true;
+}
+
+
+
 LRESULT CALLBACK LowLevelKeybdProc(int aCode, WPARAM wParam, LPARAM lParam)
 {
 	if (aCode != HC_ACTION)  // MSDN docs specify that both LL keybd & mouse hook should return in this case.
-		return CallNextHookEx(g_KeybdHook, aCode, wParam, lParam);
+		return CallNextHook(g_KeybdHook, aCode, wParam, lParam);
 
 	KBDLLHOOKSTRUCT &event = *(PKBDLLHOOKSTRUCT)lParam;  // For convenience, maintainability, and possibly performance.
 
@@ -231,7 +400,7 @@ LRESULT CALLBACK LowLevelMouseProc(int aCode, WPARAM wParam, LPARAM lParam)
 	// of wParam and lParam, because those values may be invalid or untrustworthy
 	// whenever code < 0.
 	if (aCode != HC_ACTION)
-		return CallNextHookEx(g_MouseHook, aCode, wParam, lParam);
+		return CallNextHook(g_MouseHook, aCode, wParam, lParam);
 
 	MSLLHOOKSTRUCT &event = *(PMSLLHOOKSTRUCT)lParam;  // For convenience, maintainability, and possibly performance.
 
@@ -247,7 +416,7 @@ LRESULT CALLBACK LowLevelMouseProc(int aCode, WPARAM wParam, LPARAM lParam)
 		// A final concern is that some drivers might be faulty and might not generate an accurate timestamp.
 
 	if (wParam == WM_MOUSEMOVE) // Only after updating for physical input, above, is this checked.
-		return (g_BlockMouseMove && !(event.flags & LLMHF_INJECTED)) ? 1 : CallNextHookEx(g_MouseHook, aCode, wParam, lParam);
+		return (g_BlockMouseMove && !(event.flags & LLMHF_INJECTED)) ? 1 : CallNextHook(g_MouseHook, aCode, wParam, lParam);
 		// Above: In v1.0.43.11, a new mode was added to block mouse movement only since it's more flexible than
 		// BlockInput (which keybd too, and blocks all mouse buttons too).  However, this mode blocks only
 		// physical mouse movement because it seems most flexible (and simplest) to allow all artificial
@@ -333,7 +502,7 @@ LRESULT LowLevelCommon(const HHOOK aHook, int aCode, WPARAM wParam, LPARAM lPara
 			{
 				// The following line is commented out in favor of the one beneath it (seem below comment):
 				//GetWindowText(fore_win, pKeyHistoryCurr->target_window, sizeof(pKeyHistoryCurr->target_window));
-				PostMessage(g_hWnd, AHK_GETWINDOWTEXT, (WPARAM)pKeyHistoryCurr->target_window, (LPARAM)fore_win);
+				PostHookMessage(AHK_GETWINDOWTEXT, (WPARAM)pKeyHistoryCurr->target_window, (LPARAM)fore_win);
 				// v1.0.44.12: The reason for the above is that clicking a window's close or minimize button
 				// (and possibly other types of title bar clicks) causes a delay for the following window, at least
 				// when XP Theme (but not classic theme) is in effect:
@@ -1929,16 +2098,16 @@ LRESULT SuppressThisKeyFunc(const HHOOK aHook, LPARAM lParam, const vk_type aVK,
 	if (aHotkeyIDToPost != HOTKEY_ID_INVALID)
 	{
 		int input_level = InputLevelFromInfo(aExtraInfo);
-		PostMessage(g_hWnd, AHK_HOOK_HOTKEY, aHotkeyIDToPost, MAKELONG(pKeyHistoryCurr->sc, input_level)); // v1.0.43.03: sc is posted currently only to support the number of wheel turns (to store in A_EventInfo).
+		PostHookMessage(AHK_HOOK_HOTKEY, aHotkeyIDToPost, MAKELONG(pKeyHistoryCurr->sc, input_level)); // v1.0.43.03: sc is posted currently only to support the number of wheel turns (to store in A_EventInfo).
 		if (aKeyUp && hotkey_up[aHotkeyIDToPost & HOTKEY_ID_MASK] != HOTKEY_ID_INVALID)
 		{
 			// This is a key-down hotkey being triggered by releasing a prefix key.
 			// There's also a corresponding key-up hotkey, so fire it too:
-			PostMessage(g_hWnd, AHK_HOOK_HOTKEY, hotkey_up[aHotkeyIDToPost & HOTKEY_ID_MASK], MAKELONG(pKeyHistoryCurr->sc, input_level));
+			PostHookMessage(AHK_HOOK_HOTKEY, hotkey_up[aHotkeyIDToPost & HOTKEY_ID_MASK], MAKELONG(pKeyHistoryCurr->sc, input_level));
 		}
 	}
 	if (aHSwParamToPost != HOTSTRING_INDEX_INVALID)
-		PostMessage(g_hWnd, AHK_HOTSTRING, aHSwParamToPost, aHSlParamToPost);
+		PostHookMessage(AHK_HOTSTRING, aHSwParamToPost, aHSlParamToPost);
 	return 1;
 }
 
@@ -2178,20 +2347,20 @@ LRESULT AllowIt(const HHOOK aHook, int aCode, WPARAM wParam, LPARAM lParam, cons
 	// call it before posting the messages.  This solves conditions in which the main thread is
 	// able to launch a script subroutine before the hook thread can finish updating its key state.
 	// Search on AHK_HOOK_HOTKEY in this file for more comments.
-	LRESULT result_to_return = CallNextHookEx(aHook, aCode, wParam, lParam);
+	LRESULT result_to_return = CallNextHook(aHook, aCode, wParam, lParam);
 	if (aHotkeyIDToPost != HOTKEY_ID_INVALID)
 	{
 		int input_level = InputLevelFromInfo(aExtraInfo);
-		PostMessage(g_hWnd, AHK_HOOK_HOTKEY, aHotkeyIDToPost, MAKELONG(pKeyHistoryCurr->sc, input_level)); // v1.0.43.03: sc is posted currently only to support the number of wheel turns (to store in A_EventInfo).
+		PostHookMessage(AHK_HOOK_HOTKEY, aHotkeyIDToPost, MAKELONG(pKeyHistoryCurr->sc, input_level)); // v1.0.43.03: sc is posted currently only to support the number of wheel turns (to store in A_EventInfo).
 		if (aKeyUp && hotkey_up[aHotkeyIDToPost & HOTKEY_ID_MASK] != HOTKEY_ID_INVALID)
 		{
 			// This is a key-down hotkey being triggered by releasing a prefix key.
 			// There's also a corresponding key-up hotkey, so fire it too:
-    		PostMessage(g_hWnd, AHK_HOOK_HOTKEY, hotkey_up[aHotkeyIDToPost & HOTKEY_ID_MASK], MAKELONG(pKeyHistoryCurr->sc, input_level));
+    		PostHookMessage(AHK_HOOK_HOTKEY, hotkey_up[aHotkeyIDToPost & HOTKEY_ID_MASK], MAKELONG(pKeyHistoryCurr->sc, input_level));
 		}
 	}
 	if (hs_wparam_to_post != HOTSTRING_INDEX_INVALID)
-		PostMessage(g_hWnd, AHK_HOTSTRING, hs_wparam_to_post, hs_lparam_to_post);
+		PostHookMessage(AHK_HOTSTRING, hs_wparam_to_post, hs_lparam_to_post);
 	return result_to_return;
 }
 
@@ -2216,7 +2385,7 @@ bool CollectInput(KBDLLHOOKSTRUCT &aEvent, const vk_type aVK, const sc_type aSC,
 				&& ( ((input->KeySC[aSC] | input->KeyVK[aVK]) & INPUT_KEY_NOTIFY)
 					|| input->NotifyNonText && !((input->KeyVK[aVK]) & INPUT_KEY_IS_TEXT) )   )
 			{
-				PostMessage(g_hWnd, AHK_INPUT_KEYUP, (WPARAM)input, (aSC << 16) | aVK);
+				PostHookMessage(AHK_INPUT_KEYUP, (WPARAM)input, (aSC << 16) | aVK);
 			}
 			if (aKeyUp && (input->KeySC[aSC] & INPUT_KEY_DOWN_SUPPRESSED))
 			{
@@ -2540,6 +2709,181 @@ bool CollectInput(KBDLLHOOKSTRUCT &aEvent, const vk_type aVK, const sc_type aSC,
 
 
 
+// Hotstring recognition: rather than comparing the end of g_HSBuf with every hotstring, the hook
+// maintains a trie of the abbreviations, reversed and lowercased, and walks it backward from the end
+// of the buffer.  Each keystroke therefore visits at most MAX_HOTSTRING_LENGTH nodes (twice if the
+// last char is an end char), and only the hotstrings whose abbreviations end at those nodes are then
+// checked in full, in the order they were defined.  Since hotstrings are never deleted and their
+// abbreviations never change, the trie is only ever extended, upon the first keystroke after new
+// hotstrings are created.  Options which can change at runtime (such as mSuspended and mEndCharRequired)
+// are checked only for the candidates, so the trie doesn't need to be rebuilt when they change.
+// The hook thread allocates the trie from the process heap rather than by malloc(), which it should
+// avoid (see ChangeHookState).  FreeHookMem() frees it after the hook thread has terminated.
+struct HotstringTrieNode
+{
+	int parent;
+	TCHAR ch; // Lowercase.
+	HotstringIDType first, last; // The hotstrings whose abbreviation ends at this node, linked via sHSTrieNext.
+};
+#define HS_TRIE_END ((HotstringIDType)-1)
+static HotstringTrieNode *sHSTrie = NULL; // sHSTrie[0] is the root.
+static int sHSTrieCount = 0, sHSTrieCapacity = 0;
+static int *sHSTrieHash = NULL; // Open addressing by parent and char; -1 indicates an empty slot.  Capacity is sHSTrieCapacity * 2.
+static HotstringIDType *sHSTrieNext = NULL; // Indexed by hotstring ID; the next hotstring with the same abbreviation.
+static HotstringIDType sHSTrieNextCapacity = 0;
+static HotstringIDType sHSTrieHotstringCount = 0; // The number of hotstrings which have been added to the trie.
+
+
+
+static int *HotstringTrieSlot(int aParent, TCHAR aChar)
+// Returns the hash slot which contains the given child of aParent, or the empty slot where it should be put.
+{
+	UINT mask = sHSTrieCapacity * 2 - 1;
+	UINT h = ((UINT)aParent * 31 + (UINT)aChar) * 2654435761U;
+	for (UINT i = (h ^ (h >> 16)) & mask; ; i = (i + 1) & mask)
+	{
+		int *slot = sHSTrieHash + i;
+		if (*slot == -1 || sHSTrie[*slot].parent == aParent && sHSTrie[*slot].ch == aChar)
+			return slot;
+	}
+}
+
+
+
+static bool HotstringTrieExpand()
+{
+	HANDLE heap = GetProcessHeap();
+	int new_capacity = sHSTrieCapacity ? sHSTrieCapacity * 2 : 256;
+	void *new_trie = sHSTrie ? HeapReAlloc(heap, 0, sHSTrie, new_capacity * sizeof(HotstringTrieNode))
+		: HeapAlloc(heap, 0, new_capacity * sizeof(HotstringTrieNode));
+	if (!new_trie)
+		return false;
+	sHSTrie = (HotstringTrieNode *)new_trie;
+	int *new_hash = (int *)HeapAlloc(heap, 0, new_capacity * 2 * sizeof(int));
+	if (!new_hash)
+		return false; // sHSTrie is larger than necessary, but still valid.
+	memset(new_hash, -1, new_capacity * 2 * sizeof(int));
+	if (sHSTrieHash)
+		HeapFree(heap, 0, sHSTrieHash);
+	sHSTrieHash = new_hash;
+	sHSTrieCapacity = new_capacity;
+	for (int n = 1; n < sHSTrieCount; ++n) // Rehash all nodes except the root.
+		*HotstringTrieSlot(sHSTrie[n].parent, sHSTrie[n].ch) = n;
+	return true;
+}
+
+
+
+static bool HotstringTrieUpdate()
+// Adds any hotstrings which were created since the previous call.  Returns false on failure, in which
+// case the caller should check every hotstring.
+{
+	if (!sHSTrieCapacity && !HotstringTrieExpand())
+		return false;
+	if (!sHSTrieCount)
+	{
+		sHSTrie->parent = -1;
+		sHSTrie->ch = '\0';
+		sHSTrie->first = sHSTrie->last = HS_TRIE_END;
+		sHSTrieCount = 1;
+	}
+	HotstringIDType hotstring_count = Hotstring::sHotstringCount;
+	if (hotstring_count > sHSTrieNextCapacity)
+	{
+		HANDLE heap = GetProcessHeap();
+		HotstringIDType new_capacity = (hotstring_count + HOTSTRING_BLOCK_SIZE - 1) / HOTSTRING_BLOCK_SIZE * HOTSTRING_BLOCK_SIZE;
+		void *new_next = sHSTrieNext ? HeapReAlloc(heap, 0, sHSTrieNext, new_capacity * sizeof(HotstringIDType))
+			: HeapAlloc(heap, 0, new_capacity * sizeof(HotstringIDType));
+		if (!new_next)
+			return false;
+		sHSTrieNext = (HotstringIDType *)new_next;
+		sHSTrieNextCapacity = new_capacity;
+	}
+	for (; sHSTrieHotstringCount < hotstring_count; ++sHSTrieHotstringCount)
+	{
+		Hotstring &hs = *Hotstring::shs[sHSTrieHotstringCount];
+		int node = 0;
+		for (LPTSTR cp = hs.mString + hs.mStringLength - 1; cp >= hs.mString; --cp)
+		{
+			TCHAR ch = ltolower(*cp);
+			int *slot = HotstringTrieSlot(node, ch);
+			if (*slot == -1)
+			{
+				if (sHSTrieCount == sHSTrieCapacity)
+				{
+					// Any nodes added for this hotstring so far are kept, and reused if this is retried.
+					if (!HotstringTrieExpand())
+						return false;
+					slot = HotstringTrieSlot(node, ch);
+				}
+				HotstringTrieNode &child = sHSTrie[sHSTrieCount];
+				child.parent = node;
+				child.ch = ch;
+				child.first = child.last = HS_TRIE_END;
+				*slot = sHSTrieCount++;
+			}
+			node = *slot;
+		}
+		// Append to the node's list, which is therefore in order of definition.
+		HotstringTrieNode &match = sHSTrie[node];
+		sHSTrieNext[sHSTrieHotstringCount] = HS_TRIE_END;
+		if (match.last == HS_TRIE_END)
+			match.first = sHSTrieHotstringCount;
+		else
+			sHSTrieNext[match.last] = sHSTrieHotstringCount;
+		match.last = sHSTrieHotstringCount;
+	}
+	return true;
+}
+
+
+
+static int HotstringTrieCandidates(HotstringIDType aHead[])
+// Stores in aHead the first of each list of hotstrings whose abbreviations match the end of g_HSBuf
+// case-insensitively, either including the last char or (if it is an end char) excluding it.
+// aHead must have room for MAX_HOTSTRING_LENGTH * 2 items.  Returns the number of lists, or -1 if
+// the trie is unavailable and therefore every hotstring is a candidate.
+{
+	if (!HotstringTrieUpdate())
+		return -1;
+	int count = 0;
+	for (int end = g_HSBufLength - 1; end >= g_HSBufLength - 2 && end >= 0; --end)
+	{
+		if (end < g_HSBufLength - 1 && !_tcschr(g_EndChars, g_HSBuf[g_HSBufLength - 1]))
+			break;
+		for (int i = end, node = 0; i >= 0; --i)
+		{
+			if (   (node = *HotstringTrieSlot(node, ltolower(g_HSBuf[i]))) == -1   )
+				break;
+			if (sHSTrie[node].first != HS_TRIE_END)
+				aHead[count++] = sHSTrie[node].first;
+		}
+	}
+	return count;
+}
+
+
+
+static bool HotstringTrieNextCandidate(HotstringIDType &aID, HotstringIDType aHead[], int aHeadCount)
+// Sets aID to the lowest candidate ID which is greater than or equal to aID, and returns false if
+// there is none.  aHead and aHeadCount are as returned by HotstringTrieCandidates().
+{
+	if (aHeadCount < 0)
+		return aID < Hotstring::sHotstringCount;
+	HotstringIDType next = HS_TRIE_END;
+	for (int i = 0; i < aHeadCount; ++i)
+	{
+		while (aHead[i] < aID) // This relies on HS_TRIE_END being greater than any valid ID.
+			aHead[i] = sHSTrieNext[aHead[i]];
+		if (aHead[i] < next)
+			next = aHead[i];
+	}
+	aID = next;
+	return next != HS_TRIE_END;
+}
+
+
+
 bool CollectHotstring(KBDLLHOOKSTRUCT &aEvent, TCHAR ch[], int char_count, HWND active_window
 	, KeyHistoryItem *pKeyHistoryCurr, WPARAM &aHotstringWparamToPost, LPARAM &aHotstringLparamToPost)
 {
@@ -2578,8 +2922,11 @@ bool CollectHotstring(KBDLLHOOKSTRUCT &aEvent, TCHAR ch[], int char_count, HWND
 
 		// Searching through the hot strings in the original, physical order is the documented
 		// way in which precedence is determined, i.e. the first match is the only one that will
-		// be triggered.
-		for (HotstringIDType u = 0; u < Hotstring::sHotstringCount; ++u)
+		// be triggered.  The trie narrows the search down to the hotstrings which might match;
+		// each of these is then checked below as though every hotstring was being searched.
+		HotstringIDType candidate[MAX_HOTSTRING_LENGTH * 2];
+		int candidate_count = HotstringTrieCandidates(candidate);
+		for (HotstringIDType u = 0; HotstringTrieNextCandidate(u, candidate, candidate_count); ++u)
 		{
 			Hotstring &hs = *Hotstring::shs[u];  // For performance and convenience.
 			if (hs.mSuspended)
@@ -2886,7 +3233,10 @@ bool CollectInputHook(KBDLLHOOKSTRUCT &aEvent, const vk_type aVK, const sc_type
 			&& !(g_modifiersLR_logical & ~(MOD_LSHIFT | MOD_RSHIFT)))
 		{
 			if (input->BufferLength)
+			{
 				input->Buffer[--input->BufferLength] = '\0';
+				input->Matcher.Invalidate();
+			}
 			visible = input->VisibleText; // Override VisibleNonText.
 			// Fall through to the check below in case this {BS} completed a dead key sequence.
 		}
@@ -2914,13 +3264,13 @@ bool CollectInputHook(KBDLLHOOKSTRUCT &aEvent, const vk_type aVK, const sc_type
 			// complicated by the possibility of an Input being terminated while OnKeyDown
 			// is being executed (and thereby breaking the list).
 			// This leaves room only for the bare essential parameters: aVK and aSC.
-			PostMessage(g_hWnd, AHK_INPUT_KEYDOWN, (WPARAM)input, (aSC << 16) | aVK);
+			PostHookMessage(AHK_INPUT_KEYDOWN, (WPARAM)input, (aSC << 16) | aVK);
 		}
 		// Seems best to not collect dead key chars by default; if needed, OnDeadChar
 		// could be added, or the script could mark each dead key for OnKeyDown.
 		if (collect_chars && input->ScriptObject && input->ScriptObject->onChar)
 		{
-			PostMessage(g_hWnd, AHK_INPUT_CHAR, (WPARAM)input, ((TBYTE)aChar[1] << 16) | (TBYTE)aChar[0]);
+			PostHookMessage(AHK_INPUT_CHAR, (WPARAM)input, ((TBYTE)aChar[1] << 16) | (TBYTE)aChar[0]);
 		}
 
 		if (!visible)
@@ -2949,7 +3299,6 @@ bool input_type::IsInteresting(KBDLLHOOKSTRUCT &aEvent)
 void input_type::CollectChar(TCHAR *ch, int char_count)
 {
 	const auto buffer = Buffer; // Marginally reduces code size.
-	const auto match = this->match;
 
 	for (int i = 0; i < char_count; ++i)
 	{
@@ -2969,59 +3318,13 @@ void input_type::CollectChar(TCHAR *ch, int char_count)
 	}
 
 	// Check if the buffer now matches any of the key phrases, if there are any:
-	if (FindAnywhere)
-	{
-		if (CaseSensitive)
-		{
-			for (UINT i = 0; i < MatchCount; ++i)
-			{
-				if (_tcsstr(buffer, match[i]))
-				{
-					EndByMatch(i);
-					return;
-				}
-			}
-		}
-		else // Not case sensitive.
-		{
-			for (UINT i = 0; i < MatchCount; ++i)
-			{
-				// v1.0.43.03: Changed lstrcasestr to strcasestr because it seems unlikely to break any existing
-				// scripts and is also more useful given that Input with match-list is pretty rarely used,
-				// and even when it is used, match lists are usually short (so performance isn't impacted much
-				// by this change).
-				if (lstrcasestr(buffer, match[i]))
-				{
-					EndByMatch(i);
-					return;
-				}
-			}
-		}
-	}
-	else // Exact match is required
+	if (MatchCount)
 	{
-		if (CaseSensitive)
+		UINT match_index = FindMatch();
+		if (match_index != UINT_MAX)
 		{
-			for (UINT i = 0; i < MatchCount; ++i)
-			{
-				if (!_tcscmp(buffer, match[i]))
-				{
-					EndByMatch(i);
-					return;
-				}
-			}
-		}
-		else // Not case sensitive.
-		{
-			for (UINT i = 0; i < MatchCount; ++i)
-			{
-				// v1.0.43.03: Changed to locale-insensitive search.  See similar v1.0.43.03 comment above for more details.
-				if (!lstrcmpi(buffer, match[i]))
-				{
-					EndByMatch(i);
-					return;
-				}
-			}
+			EndByMatch(match_index);
+			return;
 		}
 	}
 
@@ -3886,6 +4189,8 @@ void ChangeHookState(Hotkey *aHK[], int aHK_count, HookType aWhichHook, HookType
 	if (kvk[VK_MENU].used_as_suffix)
 		LinkKeysForCustomCombo(VK_MENU, VK_LMENU, VK_RMENU);
 
+	BuildHotkeyDispatch(aHK, aHK_count);
+
 	// Add or remove hooks, as needed.  No change is made if the hooks are already in the correct state.
 	AddRemoveHooks(hooks_to_be_active);
 }
@@ -3928,6 +4233,108 @@ bool HookAdjustMaxHotkeys(Hotkey **&aHK, int &aCurrentMax, int aNewMax)
 
 
 
+void BuildHotkeyDispatch(Hotkey *aHK[], int aHK_count)
+// Rebuilds sHotkeyDispatch from the lists of hotkeys formed by first_hotkey and mNextHotkey.
+// Caller must have finished building the lists.  The lists of the left and right modifier keys
+// share the neutral key's list as their tail, so those entries are duplicated; each hotkey's
+// position is its first occurrence, from which the entries follow its own mNextHotkey list.
+{
+	int count = 0, i;
+	HotkeyIDType id;
+	for (i = 0; i < VK_ARRAY_COUNT + SC_ARRAY_COUNT; ++i)
+	{
+		key_type &key = i < VK_ARRAY_COUNT ? kvk[i] : ksc[i - VK_ARRAY_COUNT];
+		if (key.first_hotkey == HOTKEY_ID_INVALID)
+			continue;
+		for (id = key.first_hotkey; id != HOTKEY_ID_INVALID; id = aHK[id]->mNextHotkey)
+			++count;
+		++count; // For the terminator.
+	}
+
+	HotkeyDispatch *table = NULL;
+	if (count)
+		table = (HotkeyDispatch *)malloc(sizeof(HotkeyDispatch) + aHK_count * sizeof(int) + count * sizeof(HotkeyCandidate));
+	if (table)
+	{
+		table->position = (int *)(table + 1);
+		table->candidate = (HotkeyCandidate *)(table->position + aHK_count);
+		table->hotkey_count = aHK_count;
+		table->candidate_count = count;
+		for (i = 0; i < aHK_count; ++i)
+			table->position[i] = -1;
+		HotkeyCandidate *c = table->candidate;
+		for (i = 0; i < VK_ARRAY_COUNT + SC_ARRAY_COUNT; ++i)
+		{
+			key_type &key = i < VK_ARRAY_COUNT ? kvk[i] : ksc[i - VK_ARRAY_COUNT];
+			if (key.first_hotkey == HOTKEY_ID_INVALID)
+				continue;
+			for (id = key.first_hotkey; id != HOTKEY_ID_INVALID; id = aHK[id]->mNextHotkey, ++c)
+			{
+				Hotkey &hk = *aHK[id];
+				if (table->position[id] < 0)
+					table->position[id] = (int)(c - table->candidate);
+				c->id = id;
+				// Custom combos and hook actions are never candidates for the searches which use this table.
+				c->type = (hk.mModifierVK || hk.mModifierSC || hk.mHookAction) ? HOTKEY_CANDIDATE_NONE : hk.mKeyUp;
+				c->excluded = hk.mAllowExtraModifiers ? 0 : (modLR_type)~hk.mModifiersConsolidatedLR;
+				c->required = hk.mModifiersLR;
+				c->required_neutral = ConvertModifiers(hk.mModifiers) & (MOD_LCONTROL | MOD_LALT | MOD_LSHIFT | MOD_LWIN);
+			}
+			c->id = HOTKEY_ID_INVALID;
+			c->type = HOTKEY_CANDIDATE_NONE;
+			++c;
+		}
+	}
+
+	HotkeyDispatch *old_table = sHotkeyDispatch;
+	sHotkeyDispatch = table;
+	if (old_table)
+	{
+		// The hook thread might be in the middle of searching the old table, so wait for it.
+		WaitHookIdle();
+		free(old_table);
+	}
+}
+
+
+
+HotkeyCandidate *FindHotkeyCandidates(HotkeyIDType aHotkeyID)
+// Returns the entry for aHotkeyID in the hook's table of candidate hotkeys, which is followed by
+// the entries of the other hotkeys in its list, or NULL if the table doesn't include it.
+// Should be called only by the hook thread, since the table is freed only when it is idle.
+{
+	HotkeyDispatch *table = sHotkeyDispatch;
+	if (!table || aHotkeyID >= table->hotkey_count || table->position[aHotkeyID] < 0)
+		return NULL;
+	return table->candidate + table->position[aHotkeyID];
+}
+
+
+
+HotkeyIDType NextHotkeyCandidate(HotkeyCandidate *&aCandidate, modLR_type aModsLR, bool aKeyUp)
+// Returns the ID of the next hotkey (starting at aCandidate) which is of the right type and
+// whose modifiers are satisfied by aModsLR, or HOTKEY_ID_INVALID if there are no more.
+// The criteria of the hotkey's variants are not checked.
+{
+	modLR_type either_side = aModsLR | (aModsLR >> 1); // Left-hand bits are set for neutral modifiers which are down.
+	HotkeyCandidate *c;
+	for (c = aCandidate; c->id != HOTKEY_ID_INVALID; ++c)
+	{
+		if (   c->type == (UCHAR)aKeyUp
+			&& !(aModsLR & c->excluded)
+			&& !(c->required & ~aModsLR)
+			&& !(c->required_neutral & ~either_side)   )
+		{
+			aCandidate = c + 1;
+			return c->id;
+		}
+	}
+	aCandidate = c; // Any further calls will also return HOTKEY_ID_INVALID.
+	return HOTKEY_ID_INVALID;
+}
+
+
+
 HotkeyIDType &CustomComboLast(HotkeyIDType *aFirst)
 {
 	for (; *aFirst != HOTKEY_ID_INVALID; aFirst = &Hotkey::shk[*aFirst]->mNextHotkey);
@@ -4272,11 +4679,14 @@ DWORD WINAPI HookThreadProc(LPVOID aUnused)
 			// If caller passes true for msg.lParam, it wants a permanent change to hook state; so in that case, terminate this
 			// thread whenever neither hook is no longer present.
 			if (msg.lParam && !(g_KeybdHook || g_MouseHook)) // Both hooks are inactive (for whatever reason).
+			{
+				HotCriterionCacheStop();
 				return 0; // Thread is no longer needed. The "return" automatically calls ExitThread().
 				// 1) Due to this thread's non-GUI nature, there doesn't seem to be any need to call
 				// the somewhat mysterious PostQuitMessage() here.
 				// 2) For thread safety and maintainability, it seems best to have the caller take
 				// full responsibility for freeing the hook's memory.
+			}
 			break;
 
 		case AHK_HOOK_SYNC:
@@ -4287,6 +4697,47 @@ DWORD WINAPI HookThreadProc(LPVOID aUnused)
 			SetKeyHistoryMax((int)msg.wParam);
 			break;
 
+		case AHK_HOOK_REPLAY:
+			for (auto *event = (HookReplayEvent *)msg.wParam, *end = event + msg.lParam; event < end; ++event)
+			{
+				event->result = 0;
+				event->hotkey_id = HOTKEY_ID_INVALID;
+				event->hotstring_id = HOTSTRING_INDEX_INVALID;
+				LARGE_INTEGER start, stop;
+				bool is_keybd = event->message == WM_KEYDOWN || event->message == WM_KEYUP;
+				if (is_keybd ? !g_KeybdHook : !g_MouseHook)
+				{
+					event->ticks = 0;
+					continue;
+				}
+				sReplayEvent = event;
+				if (is_keybd)
+				{
+					KBDLLHOOKSTRUCT ev = {0};
+					ev.vkCode = event->vk;
+					ev.scanCode = event->sc & 0xFF;
+					ev.flags = ((event->sc & 0x100) ? LLKHF_EXTENDED : 0) | (event->message == WM_KEYUP ? LLKHF_UP : 0);
+					ev.time = GetTickCount();
+					QueryPerformanceCounter(&start);
+					event->result = LowLevelKeybdProc(HC_ACTION, event->message, (LPARAM)&ev);
+					QueryPerformanceCounter(&stop);
+				}
+				else
+				{
+					MSLLHOOKSTRUCT ev = {0};
+					GetCursorPos(&ev.pt);
+					ev.mouseData = event->mouse_data;
+					ev.time = GetTickCount();
+					QueryPerformanceCounter(&start);
+					event->result = LowLevelMouseProc(HC_ACTION, event->message, (LPARAM)&ev);
+					QueryPerformanceCounter(&stop);
+				}
+				sReplayEvent = NULL;
+				event->ticks = stop.QuadPart - start.QuadPart;
+			}
+			sReplayDone = true;
+			break;
+
 		} // switch (msg.message)
 	} // for(;;)
 }
@@ -4429,6 +4880,25 @@ void FreeHookMem()
 		free(hotkey_up);
 		hotkey_up = NULL;
 	}
+	if (sHotkeyDispatch)
+	{
+		free(sHotkeyDispatch);
+		sHotkeyDispatch = NULL;
+	}
+	if (sHSTrie)
+	{
+		HANDLE heap = GetProcessHeap();
+		HeapFree(heap, 0, sHSTrie);
+		if (sHSTrieHash)
+			HeapFree(heap, 0, sHSTrieHash);
+		if (sHSTrieNext)
+			HeapFree(heap, 0, sHSTrieNext);
+		sHSTrie = NULL;
+		sHSTrieHash = NULL;
+		sHSTrieNext = NULL;
+		sHSTrieCount = sHSTrieCapacity = 0;
+		sHSTrieNextCapacity = sHSTrieHotstringCount = 0; // The trie will be rebuilt if the hook is reinstalled.
+	}
 }
 
 
@@ -4462,6 +4932,11 @@ void GetHookStatus(LPTSTR aBuf, int aBufSize)
 		, ModifiersLRToText(g_modifiersLR_physical, LRpText)
 		, pPrefixKey ? _T("yes") : _T("no"));
 
+	GetHotCriterionCacheStatus(aBuf, aBufSize);
+	if (sHookEventCount || sHookEventOverflow || sHookEventDropped)
+		sntprintfcat(aBuf, aBufSize, _T("Hook event queue: %Iu events, %Iu wake-ups, max depth %d, %Iu overflowed, %Iu dropped\r\n")
+			, sHookEventCount, sHookEventWakeups, (int)sHookEventMaxDepth, sHookEventOverflow, sHookEventDropped);
+
 	if (!g_KeybdHook)
 		sntprintfcat(aBuf, aBufSize, _T("\r\n")
 			_T("NOTE: Only the script's own keyboard events are shown\r\n")
@@ -4521,6 +4996,23 @@ void GetHookStatus(LPTSTR aBuf, int aBufSize)
 
 
 
+ResultType HookReplay(HookReplayEvent *aEvent, int aCount)
+// Has the hook thread pass each event to the appropriate hook procedure as though it was real
+// input, and waits for it to finish.  Events for a hook which isn't installed are skipped.
+// Returns FAIL if the hook thread isn't running.
+{
+	if (!sThreadHandle)
+		return FAIL;
+	sReplayDone = false;
+	if (!PostThreadMessage(g_HookThreadID, AHK_HOOK_REPLAY, (WPARAM)aEvent, aCount))
+		return FAIL;
+	while (!sReplayDone)
+		SLEEP_WITHOUT_INTERRUPTION(0);
+	return OK;
+}
+
+
+
 void WaitHookIdle()
 // Wait until the hook has reached a known idle state (i.e. finished any processing
 // that it was in the middle of, though it could start something new immediately after).
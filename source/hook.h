@@ -41,6 +41,8 @@ enum UserMessages {AHK_HOOK_HOTKEY = WM_USER, AHK_HOTSTRING, AHK_USER_MENU, AHK_
 	, AHK_HOOK_SYNC // For WaitHookIdle().
 	, AHK_INPUT_END, AHK_INPUT_KEYDOWN, AHK_INPUT_CHAR, AHK_INPUT_KEYUP
 	, AHK_HOOK_SET_KEYHISTORY
+	, AHK_HOOK_REPLAY // For HookReplay().
+	, AHK_HOOK_EVENTS // Wakes the main thread to process events queued by PostHookMessage().
 };
 // NOTE: TRY NEVER TO CHANGE the specific numbers of the above messages, since some users might be
 // using the Post/SendMessage commands to automate AutoHotkey itself.  Here is the original order
@@ -185,6 +187,60 @@ enum InputStatusType {INPUT_OFF, INPUT_IN_PROGRESS, INPUT_TIMED_OUT, INPUT_TERMI
 #define INPUT_KEY_IS_TEXT 0x40
 #define INPUT_KEY_DOWN_SUPPRESSED 0x80
 
+// The match list of an InputHook, compiled into a trie so that each character collected advances
+// the search by one step instead of comparing the buffer with every phrase.  For FindAnywhere, each
+// node also has an Aho-Corasick failure link, so that a phrase is found wherever it ends.
+// Exact case-insensitive matching must be equivalent to lstrcmpi(), which compares according to the
+// rules of the user's locale rather than character by character, so for that mode the phrases are
+// instead stored in a hash table by their sort keys, which are equal exactly when lstrcmpi() would
+// consider the strings equal.  The buffer's sort key is then looked up after each change.
+struct InputMatcher
+{
+	struct Node
+	{
+		int first_child, next_sibling; // For traversing the trie while compiling it.
+		int fail; // FindAnywhere only: the node of the longest proper suffix of this node's string.
+		UINT match; // The lowest index of a phrase ending at this node (or for FindAnywhere, at any node in its chain of fail links), or UINT_MAX.
+		TCHAR ch;
+	};
+	struct Edge // For finding a child by character.  Open addressing with linear probing.
+	{
+		int node; // -1 indicates an empty slot.
+		int child;
+		TCHAR ch;
+	};
+	struct SortKey // For exact case-insensitive matching.  Open addressing with linear probing.
+	{
+		UINT match; // The lowest index of a phrase with this sort key, or UINT_MAX for an empty slot.
+		UINT hash;
+		size_t offset, length; // The sort key's position within key_data.
+	};
+	Node *node;
+	Edge *edge;
+	size_t edge_mask; // The capacity of edge minus one, where the capacity is a power of 2.
+	SortKey *sort_key;
+	size_t sort_key_mask;
+	LPBYTE key_data; // The sort keys of all phrases.
+	LPBYTE key_buf; // The sort key of the buffer.
+	int key_buf_size;
+	int state; // The node reached by the buffer so far, or -1 if no phrase can match it (exact match only).
+	int state_length; // The length of the buffer which state corresponds to, or INT_MAX to rescan the buffer.
+	bool compiled, case_sensitive, find_anywhere; // The options the trie was compiled for.
+
+	InputMatcher() : node(NULL), edge(NULL), sort_key(NULL), key_data(NULL), key_buf(NULL), key_buf_size(0)
+		, state_length(INT_MAX), compiled(false) {}
+	~InputMatcher() { Free(); free(key_buf); }
+	bool Compile(LPTSTR *aMatch, UINT aMatchCount, bool aCaseSensitive, bool aFindAnywhere);
+	UINT Find(LPCTSTR aBuffer, int aLength);
+	void Invalidate() { state_length = INT_MAX; } // Called when the buffer changes other than by appending.
+	void Free();
+private:
+	int Child(int aNode, TCHAR aCh);
+	bool CompileSortKeys(LPTSTR *aMatch, UINT aMatchCount);
+	UINT FindSortKey(LPCTSTR aBuffer, int aLength);
+	int GetSortKey(LPCTSTR aStr, int aLength);
+};
+
 class InputObject;
 struct input_type
 {
@@ -202,6 +258,7 @@ struct input_type
 	#define INPUT_ARRAY_BLOCK_SIZE 1024  // The increment by which the above array expands.
 	LPTSTR MatchBuf; // The is the buffer whose contents are pointed to by the match array.
 	UINT MatchBufSize; // The capacity of the above buffer.
+	InputMatcher Matcher; // The match phrases above, compiled for the current options.
 	int Timeout;
 	DWORD TimeoutAt;
 	SendLevelType MinSendLevel; // The minimum SendLevel that can be captured by this input (0 allows all).
@@ -255,9 +312,11 @@ struct input_type
 	void EndByLimit() { EndByReason(INPUT_LIMIT_REACHED); }
 	void Stop() { EndByReason(INPUT_OFF); }
 	void CollectChar(TCHAR *ch, int char_count);
+	UINT FindMatch();
 	LPTSTR GetEndReason(LPTSTR aKeyBuf, int aKeyBufSize);
 private:
 	void EndByReason(InputStatusType aReason);
+	UINT FindMatchByComparison();
 };
 
 #include "input_object.h"
@@ -326,6 +385,20 @@ bool SystemHasAnotherMouseHook();
 DWORD WINAPI HookThreadProc(LPVOID aUnused);
 
 void LinkKeysForCustomCombo(vk_type aNeutral, vk_type aLeft, vk_type aRight);
+void BuildHotkeyDispatch(Hotkey *aHK[], int aHK_count);
+
+// An entry in the hook's table of candidate hotkeys for each suffix key (see BuildHotkeyDispatch).
+struct HotkeyCandidate
+{
+	HotkeyIDType id; // HOTKEY_ID_INVALID marks the end of each list.
+	#define HOTKEY_CANDIDATE_NONE 2 // Values for type are 0 (key-down), 1 (key-up) or this (custom combo or hook action).
+	UCHAR type;
+	modLR_type excluded; // Modifiers which must not be down.  Zero if the hotkey allows extra modifiers.
+	modLR_type required; // Left/right-specific modifiers which must be down.
+	modLR_type required_neutral; // The left-hand bit of each neutral modifier which must be down on either side.
+};
+HotkeyCandidate *FindHotkeyCandidates(HotkeyIDType aHotkeyID);
+HotkeyIDType NextHotkeyCandidate(HotkeyCandidate *&aCandidate, modLR_type aModsLR, bool aKeyUp);
 
 void ResetHook(bool aAllModifiersUp = false, HookType aWhichHook = (HOOK_KEYBD | HOOK_MOUSE)
 	, bool aResetKVKandKSC = false);
@@ -336,4 +409,23 @@ void GetHookStatus(LPTSTR aBuf, int aBufSize);
 
 void WaitHookIdle();
 
+void PostHookMessage(UINT aMsg, WPARAM wParam, LPARAM lParam);
+void PostInputEnd(input_type *aInput);
+bool GetHookMessage(MSG &aMsg);
+
+struct HookReplayEvent
+{
+	// Set by the caller:
+	UINT message; // WM_KEYDOWN, WM_KEYUP or a mouse message such as WM_LBUTTONDOWN or WM_MOUSEWHEEL.
+	vk_type vk; // Keyboard events only.
+	sc_type sc; // Keyboard events only.  0x100 indicates an extended key.
+	DWORD mouse_data; // Mouse events only; as for MSLLHOOKSTRUCT::mouseData.
+	// Set by HookReplay():
+	LRESULT result; // Non-zero if the event was suppressed.
+	WPARAM hotkey_id; // The first hotkey which would have fired, or HOTKEY_ID_INVALID.
+	WPARAM hotstring_id; // The hotstring which would have fired, or HOTSTRING_INDEX_INVALID.
+	__int64 ticks; // Time spent in the hook procedure, in performance counter ticks.
+};
+ResultType HookReplay(HookReplayEvent *aEvent, int aCount);
+
 #endif
@@ -35,6 +35,66 @@ DWORD Hotkey::sJoyHotkeyCount = 0;
 
 
 
+// Cache of #HotIf WinActive/WinExist results, used only by the hook thread.  When a key has many
+// context-sensitive variants, each keystroke would otherwise repeat the window search (fetching
+// titles and classes, and perhaps matching a regex) for each variant.  A result remains valid until
+// a WinEvent hook installed by the hook thread reports a change which could affect it:
+//  - WinActive: a change of foreground window, or a change to the foreground window's title or visibility.
+//  - WinExist: the creation, destruction, showing, hiding or cloaking of a top-level window, or a change
+//    to its title.
+// Since the events are delivered asynchronously, the foreground window is also compared directly.
+// Criteria which have WinText or use ahk_group aren't cached, since those can change without any of
+// the events above.  Z-order changes aren't tracked, so when several windows match, WinExist's result
+// might not be the topmost; this only affects which window becomes the hotkey's Last Found Window.
+static UINT sHotCriterionActiveGeneration = 1, sHotCriterionExistGeneration = 1;
+static WinEventHook sHotCriterionEventHook;
+static UINT_PTR sHotCriterionCacheHits = 0, sHotCriterionCacheMisses = 0;
+static __int64 sHotCriterionMissTicks = 0; // Total time spent evaluating criteria which weren't cached.
+
+static void CALLBACK HotCriterionWinEventProc(HWINEVENTHOOK aHook, DWORD aEvent, HWND aHwnd, LONG aObjectID
+	, LONG aChildID, DWORD aEventThread, DWORD aEventTime)
+{
+	if (aEvent == EVENT_SYSTEM_FOREGROUND)
+	{
+		++sHotCriterionActiveGeneration;
+		++sHotCriterionExistGeneration; // Z-order has changed.
+		return;
+	}
+	if (aObjectID != OBJID_WINDOW || aChildID != CHILDID_SELF || !aHwnd)
+		return;
+	HWND parent = GetAncestor(aHwnd, GA_PARENT); // NULL if the window has already been destroyed.
+	if (parent && parent != GetDesktopWindow())
+		return; // A child window, which can't affect any cached criterion.
+	++sHotCriterionExistGeneration;
+	if (aHwnd == GetForegroundWindow())
+		++sHotCriterionActiveGeneration;
+}
+
+void HotCriterionCacheStop()
+// Called by the hook thread before it terminates.
+{
+	if (!sHotCriterionEventHook.IsInstalled())
+		return;
+	sHotCriterionEventHook.Remove();
+	// Invalidate all cached results, since changes won't be tracked until the hook is reinstalled.
+	++sHotCriterionActiveGeneration;
+	++sHotCriterionExistGeneration;
+}
+
+void GetHotCriterionCacheStatus(LPTSTR aBuf, int aBufSize)
+{
+	UINT_PTR hits = sHotCriterionCacheHits, misses = sHotCriterionCacheMisses;
+	if (!hits && !misses)
+		return;
+	__int64 freq;
+	QueryPerformanceFrequency((LARGE_INTEGER *)&freq);
+	double miss_ms = (double)sHotCriterionMissTicks * 1000 / freq;
+	sntprintfcat(aBuf, aBufSize, _T("#HotIf window cache: %Iu hits, %Iu misses (%0.1f%% hit rate), about %0.1f ms saved\r\n")
+		, hits, misses, hits * 100.0 / (hits + misses), misses ? miss_ms / misses * hits : 0.0);
+}
+
+
+
 HWND HotCriterionAllowsFiring(HotkeyCriterion *aCriterion, LPTSTR aHotkeyName)
 // This is a global function because it's used by both hotkeys and hotstrings.
 // In addition to being called by the hook thread, this can now be called by the main thread.
@@ -45,6 +105,29 @@ HWND HotCriterionAllowsFiring(HotkeyCriterion *aCriterion, LPTSTR aHotkeyName)
 	HWND found_hwnd;
 	if (!aCriterion)
 		return (HWND)1; // Always allow hotkey to fire.
+	bool use_cache = false;
+	UINT generation;
+	HWND foreground;
+	UCHAR settings;
+	__int64 start_time;
+	if (aCriterion->Type != HOT_IF_CALLBACK && aCriterion->Cacheable && GetCurrentThreadId() == g_HookThreadID
+		&& (sHotCriterionEventHook.IsInstalled() || sHotCriterionEventHook.Install(HotCriterionWinEventProc, WinEventHook::EVENTS_ALL)))
+	{
+		bool is_active = aCriterion->Type == HOT_IF_ACTIVE || aCriterion->Type == HOT_IF_NOT_ACTIVE;
+		generation = is_active ? sHotCriterionActiveGeneration : sHotCriterionExistGeneration;
+		foreground = GetForegroundWindow();
+		// g_default can change when the auto-execute thread finishes, so include the relevant settings.
+		settings = (UCHAR)(g_default.TitleMatchMode << 1 | g_default.DetectHiddenWindows);
+		if (aCriterion->CachedGeneration == generation && aCriterion->CachedForeground == foreground
+			&& aCriterion->CachedSettings == settings)
+		{
+			++sHotCriterionCacheHits;
+			found_hwnd = aCriterion->CachedHwnd;
+			return (aCriterion->Type == HOT_IF_ACTIVE || aCriterion->Type == HOT_IF_EXIST) ? found_hwnd : (HWND)!found_hwnd;
+		}
+		use_cache = true;
+		QueryPerformanceCounter((LARGE_INTEGER *)&start_time);
+	}
 	switch(aCriterion->Type)
 	{
 	case HOT_IF_ACTIVE:
@@ -61,6 +144,17 @@ HWND HotCriterionAllowsFiring(HotkeyCriterion *aCriterion, LPTSTR aHotkeyName)
 		DWORD_PTR res;
 		return (SendMessageTimeout(g_hWnd, AHK_HOT_IF_EVAL, (WPARAM)aCriterion, (LPARAM)aHotkeyName, SMTO_BLOCK | SMTO_ABORTIFHUNG, g_HotExprTimeout, &res) && res == CONDITION_TRUE) ? (HWND)1 : NULL;
 	}
+	if (use_cache)
+	{
+		__int64 end_time;
+		QueryPerformanceCounter((LARGE_INTEGER *)&end_time);
+		sHotCriterionMissTicks += end_time - start_time;
+		++sHotCriterionCacheMisses;
+		aCriterion->CachedHwnd = found_hwnd;
+		aCriterion->CachedForeground = foreground;
+		aCriterion->CachedSettings = settings;
+		aCriterion->CachedGeneration = generation;
+	}
 	return (aCriterion->Type == HOT_IF_ACTIVE || aCriterion->Type == HOT_IF_EXIST) ? found_hwnd : (HWND)!found_hwnd;
 }
 
@@ -121,6 +215,8 @@ HotkeyCriterion *AddHotkeyCriterion(HotCriterionType aType, LPCTSTR aWinTitle, L
 HotkeyCriterion *AddHotkeyCriterion(HotkeyCriterion *cp)
 {
 	cp->NextCriterion = NULL;
+	cp->CachedGeneration = 0;
+	cp->Cacheable = !*cp->WinText && !tcscasestr(cp->WinTitle, _T("ahk_group"));
 	if (!g_FirstHotCriterion)
 		g_FirstHotCriterion = g_LastHotCriterion = cp;
 	else
@@ -706,11 +802,17 @@ HotkeyVariant *Hotkey::CriterionFiringIsCertain(HotkeyIDType &aHotkeyIDwithFlags
 		// hotkey", or "the uppermost variant among all eclipsed wildcards that is eligible to fire".
 		// UPDATE: This now uses a linked list of hotkeys which share the same suffix key, in the order of
 		// sort_most_general_before_least, which might solve the concern about precedence.
+		// The hook's table of candidates is used if possible, since it skips most of the hotkeys which
+		// can't match without having to visit each one.  Those which it returns are checked again below,
+		// but that's cheap.
 		mod_type modifiers = ConvertModifiersLR(g_modifiersLR_logical_non_ignored); // Neutral modifiers.
-		for (HotkeyIDType candidate_id = hk.mNextHotkey; candidate_id != HOTKEY_ID_INVALID; )
+		HotkeyCandidate *candidate = FindHotkeyCandidates(hotkey_id); // Starts at this hotkey, which is excluded below.
+		for (HotkeyIDType candidate_id = candidate ? NextHotkeyCandidate(candidate, g_modifiersLR_logical_non_ignored, hk.mKeyUp)
+			: hk.mNextHotkey; candidate_id != HOTKEY_ID_INVALID; )
 		{
 			Hotkey &hk2 = *shk[candidate_id]; // For performance and convenience.
-			candidate_id = hk2.mNextHotkey;
+			candidate_id = candidate ? NextHotkeyCandidate(candidate, g_modifiersLR_logical_non_ignored, hk.mKeyUp)
+				: hk2.mNextHotkey;
 			// Non-wildcard hotkeys are eligible for the workaround in cases like ^+a vs <^+a vs ^<+a, where
 			// the neutral modifier acts as a sort of wildcard (it permits left, right or both).  This also
 			// increases support for varying names, such as Esc vs. Escape vs. vk1B (which already partially
@@ -763,6 +865,11 @@ HotkeyVariant *Hotkey::CriterionFiringIsCertain(HotkeyIDType &aHotkeyIDwithFlags
 
 HotkeyIDType Hotkey::FindPairedHotkey(HotkeyIDType aFirstID, modLR_type aModsLR, bool aKeyUp)
 {
+	if (HotkeyCandidate *candidate = FindHotkeyCandidates(aFirstID)) // Use the hook's table if possible.
+	{
+		HotkeyIDType id = NextHotkeyCandidate(candidate, aModsLR, aKeyUp);
+		return (aKeyUp && id != HOTKEY_ID_INVALID) ? (id | HOTKEY_KEY_UP) : id;
+	}
 	mod_type modifiers = ConvertModifiersLR(aModsLR); // Neutral modifiers.
 	for (HotkeyIDType candidate_id = aFirstID; candidate_id != HOTKEY_ID_INVALID; )
 	{
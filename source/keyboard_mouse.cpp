@@ -133,6 +133,87 @@ void SendUnicodeChar(wchar_t aChar, modLR_type aModifiers)
 
 
 
+// Compiled SendInput sequences: Scripts often send the same keys many times (such as a template or
+// a hotstring's replacement), so the events generated by parsing the keys for SendInput are cached
+// along with the state they depend on, and copied directly into the array when the same keys are
+// sent again in the same state.  Like the RegEx cache, this is a crude cache with linear search,
+// which is fine because it is small and searching it costs far less than parsing.  Sends which
+// include mouse events aren't cached, since those depend on the position of the cursor.
+#define SEND_CACHE_SIZE 16
+#define SEND_CACHE_MAX_EVENTS (MAX_INITIAL_EVENTS_SI * 8) // Longer sends seem unlikely to be repeated often enough to justify the memory.
+struct SendCacheState
+{
+	// Zero-initialized before being set so that memcmp() can be used, padding and all.
+	HKL layout;
+	DWORD extra_info;
+	USHORT menu_mask_sc;
+	BYTE menu_mask_vk;
+	modLR_type mods, persistent_for_send, persistent, remapped;
+	KeyEventTypes prev_event_type;
+	vk_type prev_vk, prev_event_modifier_down;
+	SendRawModes send_raw;
+	bool blind;
+};
+struct SendCacheEntry
+{
+	LPTSTR keys; // NULL if this entry is unused.  Allocated in the same block as event.
+	LPINPUT event;
+	UINT event_count;
+	SendCacheState start, end; // The state before and after the events were generated.
+};
+static SendCacheEntry sSendCache[SEND_CACHE_SIZE] = {{0}};
+static int sSendCacheLastInsert = SEND_CACHE_SIZE - 1;
+
+static void GetSendCacheState(SendCacheState &aState, SendRawModes aSendRaw, modLR_type aPersistentForSend)
+{
+	ZeroMemory(&aState, sizeof(aState));
+	aState.layout = sTargetKeybdLayout;
+	aState.extra_info = KEY_IGNORE_LEVEL(g->SendLevel);
+	aState.menu_mask_vk = g_MenuMaskKeyVK;
+	aState.menu_mask_sc = g_MenuMaskKeySC;
+	aState.mods = sEventModifiersLR;
+	aState.persistent_for_send = aPersistentForSend;
+	aState.persistent = sModifiersLR_persistent;
+	aState.remapped = sModifiersLR_remapped;
+	aState.prev_event_type = sPrevEventType;
+	aState.prev_vk = sPrevVK;
+	aState.prev_event_modifier_down = sPrevEventModifierDown;
+	aState.send_raw = aSendRaw;
+	aState.blind = sInBlindMode;
+}
+
+static SendCacheEntry *FindSendCache(LPCTSTR aKeys, SendCacheState &aState)
+{
+	for (int i = 0; i < SEND_CACHE_SIZE; ++i)
+		if (sSendCache[i].keys && !_tcscmp(sSendCache[i].keys, aKeys)
+			&& !memcmp(&sSendCache[i].start, &aState, sizeof(aState)))
+			return sSendCache + i;
+	return NULL;
+}
+
+static void AddSendCache(LPCTSTR aKeys, SendCacheState &aStart, SendCacheState &aEnd)
+// Caches the events in sEventSI, which were generated by parsing aKeys in state aStart.
+{
+	size_t events_size = sEventCount * sizeof(INPUT);
+	size_t keys_size = (_tcslen(aKeys) + 1) * sizeof(TCHAR);
+	LPINPUT event = (LPINPUT)malloc(events_size + keys_size);
+	if (!event)
+		return; // Not caching it is harmless.
+	int insert_pos = (sSendCacheLastInsert == SEND_CACHE_SIZE - 1) ? 0 : sSendCacheLastInsert + 1;
+	SendCacheEntry &entry = sSendCache[insert_pos];
+	free(entry.event); // Also frees keys, if the entry was in use.
+	entry.event = event;
+	entry.keys = (LPTSTR)((char *)event + events_size);
+	memcpy(entry.event, sEventSI, events_size);
+	memcpy(entry.keys, aKeys, keys_size);
+	entry.event_count = sEventCount;
+	entry.start = aStart;
+	entry.end = aEnd;
+	sSendCacheLastInsert = insert_pos;
+}
+
+
+
 void SendKeys(LPCTSTR aKeys, SendRawModes aSendRaw, SendModes aSendModeOrig, HWND aTargetWindow)
 // The aKeys string must be modifiable (not constant), since for performance reasons,
 // it's allowed to be temporarily altered by this function.  mThisHotkeyModifiersLR, if non-zero,
@@ -454,6 +535,42 @@ void SendKeys(LPCTSTR aKeys, SendRawModes aSendRaw, SendModes aSendModeOrig, HWN
 
 	LONG_OPERATION_INIT  // Needed even for SendInput/Play.
 
+	// If these keys were sent in the same state before, use the events from that time rather than
+	// parsing them again.  Otherwise, keep what's needed to cache the events after parsing.
+	LPCTSTR keys_to_cache = NULL;
+	SendCacheState cache_start;
+	if (sSendMode == SM_INPUT)
+	{
+		GetSendCacheState(cache_start, aSendRaw, persistent_modifiers_for_this_SendKeys);
+		if (SendCacheEntry *cached = FindSendCache(aKeys, cache_start))
+		{
+			while (sMaxEvents < cached->event_count && ExpandEventArray());
+			if (!sAbortArraySend)
+			{
+				memcpy(sEventSI, cached->event, cached->event_count * sizeof(INPUT));
+				sEventCount = cached->event_count;
+				if (sEventCount)
+					sHooksToRemoveDuringSendInput |= HOOK_KEYBD;
+				// KeyEvent() would have recorded these in the key history:
+				for (UINT i = 0; i < sEventCount; ++i)
+					if (!(sEventSI[i].ki.dwFlags & KEYEVENTF_UNICODE))
+						UpdateKeyEventHistory(sEventSI[i].ki.dwFlags & KEYEVENTF_KEYUP, (vk_type)sEventSI[i].ki.wVk
+							, sEventSI[i].ki.wScan | ((sEventSI[i].ki.dwFlags & KEYEVENTF_EXTENDEDKEY) ? 0x100 : 0));
+			}
+			// Put the state into effect as though the keys had been parsed.
+			sEventModifiersLR = cached->end.mods;
+			persistent_modifiers_for_this_SendKeys = cached->end.persistent_for_send;
+			sModifiersLR_persistent = cached->end.persistent;
+			sModifiersLR_remapped = cached->end.remapped;
+			sPrevEventType = cached->end.prev_event_type;
+			sPrevVK = cached->end.prev_vk;
+			sPrevEventModifierDown = cached->end.prev_event_modifier_down;
+			aKeys += _tcslen(aKeys); // Skip the loop below.
+		}
+		else
+			keys_to_cache = aKeys;
+	}
+
 	for (; *aKeys; ++aKeys, sPrevEventModifierDown = this_event_modifier_down)
 	{
 		this_event_modifier_down = 0; // Set default for this iteration, overridden selectively below.
@@ -807,6 +924,14 @@ brace_case_end: // This label is used to simplify the code without sacrificing p
 		}
 	} // for()
 
+	if (keys_to_cache && !sAbortArraySend && sEventCount <= SEND_CACHE_MAX_EVENTS
+		&& !(sHooksToRemoveDuringSendInput & HOOK_MOUSE)) // Mouse events depend on the cursor position.
+	{
+		SendCacheState cache_end;
+		GetSendCacheState(cache_end, aSendRaw, persistent_modifiers_for_this_SendKeys);
+		AddSendCache(keys_to_cache, cache_start, cache_end);
+	}
+
 	modLR_type mods_to_set;
 	if (sSendMode)
 	{
@@ -304,6 +304,7 @@ ResultType input_type::SetMatchList(LPCTSTR aMatchList)
 {
 	LPTSTR *realloc_temp;  // Needed since realloc returns NULL on failure but leaves original block allocated.
 	MatchCount = 0;  // Set default.
+	Matcher.Free(); // Compiled by Start() or FindMatch().
 	if (*aMatchList)
 	{
 		// If needed, create the array of pointers that points into MatchBuf to each match phrase:
@@ -379,6 +380,300 @@ ResultType input_type::SetMatchList(LPCTSTR aMatchList)
 }
 
 
+UINT input_type::FindMatch()
+// Returns the index of the match phrase which the buffer now matches, or UINT_MAX if none.
+// Called by the hook thread after each change to the buffer.
+{
+	if (!Matcher.compiled || Matcher.case_sensitive != CaseSensitive || Matcher.find_anywhere != FindAnywhere)
+	{
+		// The options were changed while the input was in progress, so compile the trie again.
+		if (!Matcher.Compile(match, MatchCount, CaseSensitive, FindAnywhere))
+			return FindMatchByComparison(); // Insufficient memory.
+	}
+	return Matcher.Find(Buffer, BufferLength);
+}
+
+
+UINT input_type::FindMatchByComparison()
+// Compares the buffer with each match phrase in turn, for when the matcher couldn't be compiled.
+{
+	for (UINT i = 0; i < MatchCount; ++i)
+		if (FindAnywhere ? (CaseSensitive ? _tcsstr(Buffer, match[i]) : lstrcasestr(Buffer, match[i])) != NULL
+			: !(CaseSensitive ? _tcscmp(Buffer, match[i]) : lstrcmpi(Buffer, match[i])))
+			return i;
+	return UINT_MAX;
+}
+
+
+static inline size_t InputMatchHash(int aNode, TCHAR aCh)
+{
+	return (size_t)((UINT)aNode * 0x9E3779B1u ^ (UINT)(TBYTE)aCh * 0x85EBCA6Bu);
+}
+
+
+int InputMatcher::Child(int aNode, TCHAR aCh)
+// Returns the child of aNode for aCh, or -1 if there isn't one.
+{
+	for (size_t i = InputMatchHash(aNode, aCh) & edge_mask; edge[i].node != -1; i = (i + 1) & edge_mask)
+		if (edge[i].node == aNode && edge[i].ch == aCh)
+			return edge[i].child;
+	return -1;
+}
+
+
+void InputMatcher::Free()
+{
+	free(node);
+	free(edge);
+	free(sort_key);
+	free(key_data);
+	node = NULL;
+	edge = NULL;
+	sort_key = NULL;
+	key_data = NULL;
+	compiled = false;
+	// key_buf is kept, since it doesn't depend on the phrases.  It is freed by the destructor.
+}
+
+
+bool InputMatcher::Compile(LPTSTR *aMatch, UINT aMatchCount, bool aCaseSensitive, bool aFindAnywhere)
+// Returns false if there was insufficient memory.
+{
+	Free();
+	if (!aCaseSensitive && !aFindAnywhere)
+	{
+		if (!CompileSortKeys(aMatch, aMatchCount))
+		{
+			Free();
+			return false;
+		}
+		case_sensitive = aCaseSensitive;
+		find_anywhere = aFindAnywhere;
+		compiled = true;
+		return true;
+	}
+	// Allocate for the worst case, where no phrases share a prefix, to avoid reallocating.
+	size_t max_nodes = 1; // The root node, which represents the empty string.
+	for (UINT i = 0; i < aMatchCount; ++i)
+		max_nodes += _tcslen(aMatch[i]);
+	if (max_nodes > INT_MAX / 2)
+		return false;
+	size_t edge_capacity = 16;
+	while (edge_capacity < max_nodes * 2) // Keep the load factor at or below 0.5.
+		edge_capacity <<= 1;
+	node = (Node *)malloc(max_nodes * sizeof(Node));
+	edge = (Edge *)malloc(edge_capacity * sizeof(Edge));
+	if (!node || !edge)
+	{
+		Free();
+		return false;
+	}
+	edge_mask = edge_capacity - 1;
+	for (size_t i = 0; i < edge_capacity; ++i)
+		edge[i].node = -1;
+
+	node[0].first_child = node[0].next_sibling = -1;
+	node[0].fail = 0;
+	node[0].match = UINT_MAX;
+	node[0].ch = '\0';
+	int node_count = 1;
+	for (UINT i = 0; i < aMatchCount; ++i)
+	{
+		int n = 0;
+		for (LPCTSTR cp = aMatch[i]; *cp; ++cp)
+		{
+			TCHAR ch = aCaseSensitive ? *cp : (TCHAR)ltolower(*cp);
+			int c = Child(n, ch);
+			if (c == -1)
+			{
+				c = node_count++;
+				node[c].first_child = -1;
+				node[c].next_sibling = node[n].first_child;
+				node[c].fail = 0;
+				node[c].match = UINT_MAX;
+				node[c].ch = ch;
+				node[n].first_child = c;
+				size_t e = InputMatchHash(n, ch) & edge_mask;
+				while (edge[e].node != -1)
+					e = (e + 1) & edge_mask;
+				edge[e].node = n;
+				edge[e].ch = ch;
+				edge[e].child = c;
+			}
+			n = c;
+		}
+		if (node[n].match == UINT_MAX) // For duplicate phrases, the first takes precedence.
+			node[n].match = i;
+	}
+
+	if (aFindAnywhere)
+	{
+		// Set the failure links in breadth-first order, so that each node's fail link (which is
+		// shallower) is complete before the node's own children are visited.
+		int *queue = (int *)malloc(node_count * sizeof(int));
+		if (!queue)
+		{
+			Free();
+			return false;
+		}
+		int head = 0, tail = 0;
+		for (int c = node[0].first_child; c != -1; c = node[c].next_sibling)
+			queue[tail++] = c; // The fail link of each child of the root is the root.
+		while (head < tail)
+		{
+			int u = queue[head++];
+			for (int v = node[u].first_child; v != -1; v = node[v].next_sibling)
+			{
+				int f = node[u].fail, t;
+				while ((t = Child(f, node[v].ch)) == -1 && f)
+					f = node[f].fail;
+				node[v].fail = t == -1 ? 0 : t;
+				// A phrase ending at the fail node also ends at this node.
+				if (node[node[v].fail].match < node[v].match)
+					node[v].match = node[node[v].fail].match;
+				queue[tail++] = v;
+			}
+		}
+		free(queue);
+	}
+
+	case_sensitive = aCaseSensitive;
+	find_anywhere = aFindAnywhere;
+	compiled = true;
+	Invalidate();
+	return true;
+}
+
+
+static inline UINT SortKeyHash(LPBYTE aKey, size_t aLength)
+{
+	UINT hash = 2166136261u; // FNV-1a.
+	for (size_t i = 0; i < aLength; ++i)
+		hash = (hash ^ aKey[i]) * 16777619u;
+	return hash;
+}
+
+
+int InputMatcher::GetSortKey(LPCTSTR aStr, int aLength)
+// Stores the sort key of aStr in key_buf, expanding it if necessary, and returns its length in
+// bytes, or 0 on failure.  lstrcmpi() considers two strings equal exactly when these keys are equal.
+{
+	const DWORD flags = LCMAP_SORTKEY | NORM_IGNORECASE;
+	int length = key_buf_size ? LCMapString(LOCALE_USER_DEFAULT, flags, aStr, aLength, (LPTSTR)key_buf, key_buf_size) : 0;
+	if (!length)
+	{
+		if (  !(length = LCMapString(LOCALE_USER_DEFAULT, flags, aStr, aLength, NULL, 0))  )
+			return 0;
+		int new_size = length < 256 ? 256 : length * 2;
+		LPBYTE new_buf = (LPBYTE)realloc(key_buf, new_size);
+		if (!new_buf)
+			return 0;
+		key_buf = new_buf;
+		key_buf_size = new_size;
+		length = LCMapString(LOCALE_USER_DEFAULT, flags, aStr, aLength, (LPTSTR)key_buf, key_buf_size);
+	}
+	return length;
+}
+
+
+bool InputMatcher::CompileSortKeys(LPTSTR *aMatch, UINT aMatchCount)
+// Builds the hash table of sort keys for exact case-insensitive matching.
+{
+	size_t capacity = 16;
+	while (capacity < (size_t)aMatchCount * 2) // Keep the load factor at or below 0.5.
+		capacity <<= 1;
+	if (  !(sort_key = (SortKey *)malloc(capacity * sizeof(SortKey)))  )
+		return false;
+	sort_key_mask = capacity - 1;
+	for (size_t i = 0; i < capacity; ++i)
+		sort_key[i].match = UINT_MAX;
+	size_t data_size = 0, data_length = 0;
+	for (UINT i = 0; i < aMatchCount; ++i)
+	{
+		int length = GetSortKey(aMatch[i], (int)_tcslen(aMatch[i]));
+		if (!length)
+			return false;
+		UINT hash = SortKeyHash(key_buf, length);
+		size_t j = hash & sort_key_mask;
+		for (; sort_key[j].match != UINT_MAX; j = (j + 1) & sort_key_mask)
+			if (sort_key[j].hash == hash && sort_key[j].length == (size_t)length
+				&& !memcmp(key_data + sort_key[j].offset, key_buf, length))
+				break;
+		if (sort_key[j].match != UINT_MAX)
+			continue; // A phrase which lstrcmpi() considers equal to this one takes precedence.
+		if (data_length + length > data_size)
+		{
+			size_t new_size = data_size ? data_size * 2 : 4096;
+			if (new_size < data_length + length)
+				new_size = data_length + length;
+			LPBYTE new_data = (LPBYTE)realloc(key_data, new_size);
+			if (!new_data)
+				return false;
+			key_data = new_data;
+			data_size = new_size;
+		}
+		memcpy(key_data + data_length, key_buf, length);
+		sort_key[j].match = i;
+		sort_key[j].hash = hash;
+		sort_key[j].offset = data_length;
+		sort_key[j].length = length;
+		data_length += length;
+	}
+	return true;
+}
+
+
+UINT InputMatcher::FindSortKey(LPCTSTR aBuffer, int aLength)
+// Returns the index of the phrase which lstrcmpi() considers equal to the buffer, or UINT_MAX.
+{
+	if (!aLength) // Empty phrases are omitted from the match list.
+		return UINT_MAX;
+	int length = GetSortKey(aBuffer, aLength);
+	if (!length)
+		return UINT_MAX;
+	UINT hash = SortKeyHash(key_buf, length);
+	for (size_t j = hash & sort_key_mask; sort_key[j].match != UINT_MAX; j = (j + 1) & sort_key_mask)
+		if (sort_key[j].hash == hash && sort_key[j].length == (size_t)length
+			&& !memcmp(key_data + sort_key[j].offset, key_buf, length))
+			return sort_key[j].match;
+	return UINT_MAX;
+}
+
+
+UINT InputMatcher::Find(LPCTSTR aBuffer, int aLength)
+// Advances the state by any characters added to the buffer since the previous call, and returns
+// the index of the phrase which was matched, or UINT_MAX if none.  If the buffer was changed in
+// any other way, the whole buffer is scanned again.
+{
+	if (sort_key) // Exact case-insensitive matching, which needs the key of the whole buffer.
+		return FindSortKey(aBuffer, aLength);
+	if (state_length > aLength)
+	{
+		state = 0;
+		state_length = 0;
+	}
+	UINT found = UINT_MAX;
+	for (; state_length < aLength; ++state_length)
+	{
+		TCHAR ch = case_sensitive ? aBuffer[state_length] : (TCHAR)ltolower(aBuffer[state_length]);
+		if (find_anywhere)
+		{
+			int next;
+			while ((next = Child(state, ch)) == -1 && state)
+				state = node[state].fail;
+			state = next == -1 ? 0 : next;
+			if (node[state].match < found) // Check each position in case more than one character was added.
+				found = node[state].match;
+		}
+		else if (state != -1)
+			state = Child(state, ch);
+	}
+	if (!find_anywhere) // Only a phrase equal to the whole buffer is a match.
+		found = state == -1 ? UINT_MAX : node[state].match;
+	return found;
+}
+
+
 LPTSTR input_type::GetEndReason(LPTSTR aKeyBuf, int aKeyBufSize)
 {
 	switch (Status)
@@ -440,6 +735,11 @@ LPTSTR input_type::GetEndReason(LPTSTR aKeyBuf, int aKeyBufSize)
 void input_type::Start()
 {
 	ASSERT(!InProgress());
+	// Compile the match list now rather than in the hook thread, unless it's already compiled
+	// for the current options.  Failure is handled by FindMatch().
+	if (MatchCount && (!Matcher.compiled || Matcher.case_sensitive != CaseSensitive || Matcher.find_anywhere != FindAnywhere))
+		Matcher.Compile(match, MatchCount, CaseSensitive, FindAnywhere);
+	Matcher.Invalidate(); // The buffer has been reset.
 	Status = INPUT_IN_PROGRESS;
 }
 
@@ -479,7 +779,13 @@ void input_type::EndByReason(InputStatusType aReason)
 	// ...so that we can rely on MsgSleep() to create a new thread for the OnEnd event.
 	// ...because InputRelease() can't be called by the hook thread.
 	// ...because some callers rely on the list not being broken by this call.
-	PostMessage(g_hWnd, AHK_INPUT_END, (WPARAM)this, 0);
+	// It's queued after any AHK_INPUT_CHAR, etc. for this Input, to keep them in order.  This applies
+	// even when called by the main thread (such as by InputHook.Stop()), since those events might
+	// still be queued and would be discarded if AHK_INPUT_END overtook them.
+	if (GetCurrentThreadId() == g_HookThreadID)
+		PostHookMessage(AHK_INPUT_END, (WPARAM)this, 0);
+	else
+		PostInputEnd(this);
 }
 
 
@@ -341,8 +341,11 @@ int RegExCallout(pcret_callout_block *cb)
 	return (int)number_to_return;
 }
 
-pcret *get_compiled_regex(LPCTSTR aRegEx, pcret_extra *&aExtra, int *aOptionsLength, ResultToken *aResultToken)
+pcret *get_compiled_regex(LPCTSTR aRegEx, pcret_extra *&aExtra, int *aOptionsLength, ResultToken *aResultToken
+	, bool aUseCache = true)
 // Returns the compiled RegEx, or NULL on failure.
+// If aUseCache is false, the RegEx is compiled even if it is in the cache, and isn't added to the cache;
+// caller must free it and aExtra.
 // This function is called by things other than built-in functions so it should be kept general-purpose.
 // Upon failure, if aResultToken!=NULL:
 //   - An exception is thrown with a descriptive message on failure.
@@ -395,7 +398,9 @@ pcret *get_compiled_regex(LPCTSTR aRegEx, pcret_extra *&aExtra, int *aOptionsLen
 	int insert_pos; // v1.0.45.03: This is used to avoid updating sLastInsert until an insert actually occurs (it might not occur if a compile error occurs in the regex, or something else stops it early).
 
 	// CHECK IF THIS REGEX IS ALREADY IN THE CACHE.
-	if (sLastFound == -1) // Cache is empty, so insert this RegEx at the first position.
+	if (!aUseCache)
+		insert_pos = -1; // Not used.
+	else if (sLastFound == -1) // Cache is empty, so insert this RegEx at the first position.
 		insert_pos = 0;  // A section further below will change sLastFound to be 0.
 	else
 	{
@@ -597,6 +602,14 @@ break_both:
 	else // No studying desired.
 		aExtra = NULL; // aExtra is an output parameter for caller.
 
+	if (!aUseCache) // Caller takes ownership of the compiled RegEx.
+	{
+		if (aOptionsLength)
+			*aOptionsLength = (int)(pat - aRegEx);
+		LeaveCriticalSection(&g_CriticalRegExCache);
+		return re_compiled;
+	}
+
 	// ADD THE NEWLY-COMPILED REGEX TO THE CACHE.
 	// An earlier stage has set insert_pos to be the desired insert-position in the cache.
 	pcre_cache_entry &this_entry = sCache[insert_pos]; // For performance and convenience.
@@ -645,16 +658,8 @@ error: // Since NULL is returned here, caller should ignore the contents of the
 
 
 
-LPCTSTR RegExMatch(LPCTSTR aHaystack, LPCTSTR aNeedleRegEx)
-// Returns NULL if no match.  Otherwise, returns the address where the pattern was found in aHaystack.
+static LPCTSTR RegExMatch(LPCTSTR aHaystack, pcret *re, pcret_extra *extra)
 {
-	pcret_extra *extra;
-	pcret *re;
-
-	// Compile the regex or get it from cache.
-	if (   !(re = get_compiled_regex(aNeedleRegEx, extra, NULL, NULL))   ) // Compiling problem.
-		return NULL; // Our callers just want there to be "no match" in this case.
-
 	// Set up the offset array, which consists of int-pairs containing the start/end offset of each match.
 	// For simplicity, use a fixed size because even if it's too small (unlikely for our types of callers),
 	// PCRE will still operate properly (though it returns 0 to indicate the too-small condition).
@@ -670,6 +675,64 @@ LPCTSTR RegExMatch(LPCTSTR aHaystack, LPCTSTR aNeedleRegEx)
 	return aHaystack + offset[0]; // Return the position of the entire-pattern match.
 }
 
+LPCTSTR RegExMatch(LPCTSTR aHaystack, LPCTSTR aNeedleRegEx)
+// Returns NULL if no match.  Otherwise, returns the address where the pattern was found in aHaystack.
+{
+	pcret_extra *extra;
+	pcret *re;
+
+	// Compile the regex or get it from cache.
+	if (   !(re = get_compiled_regex(aNeedleRegEx, extra, NULL, NULL))   ) // Compiling problem.
+		return NULL; // Our callers just want there to be "no match" in this case.
+
+	return RegExMatch(aHaystack, re, extra);
+}
+
+
+
+// A RegEx compiled by RegExCompile(), for callers which match the same pattern many times and
+// would otherwise have to search the cache each time, such as WinCriteria.
+struct CompiledRegEx
+{
+	pcret *re;
+	pcret_extra *extra;
+};
+
+CompiledRegEx *RegExCompile(LPCTSTR aNeedleRegEx)
+// Returns NULL on failure.  Caller must pass the result to RegExFree().
+{
+	pcret_extra *extra;
+	pcret *re;
+	if (   !(re = get_compiled_regex(aNeedleRegEx, extra, NULL, NULL, false))   )
+		return NULL;
+	auto compiled = (CompiledRegEx *)malloc(sizeof(CompiledRegEx));
+	if (!compiled)
+	{
+		pcret_free(re);
+		if (extra)
+			pcret_free_study(extra);
+		return NULL;
+	}
+	compiled->re = re;
+	compiled->extra = extra;
+	return compiled;
+}
+
+void RegExFree(CompiledRegEx *aRegEx)
+{
+	if (!aRegEx)
+		return;
+	pcret_free(aRegEx->re);
+	if (aRegEx->extra)
+		pcret_free_study(aRegEx->extra);
+	free(aRegEx);
+}
+
+LPCTSTR RegExMatch(LPCTSTR aHaystack, CompiledRegEx *aRegEx)
+{
+	return RegExMatch(aHaystack, aRegEx->re, aRegEx->extra);
+}
+
 
 
 void RegExReplace(ResultToken &aResultToken, ExprTokenType *aParam[], int aParamCount
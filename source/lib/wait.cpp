@@ -19,6 +19,8 @@ GNU General Public License for more details.
 #include "window.h"
 #include "application.h"
 #include "script_func_impl.h"
+#include "script_object.h"
+#include "win_criteria.h"
 
 
 
@@ -164,6 +166,132 @@ bif_impl FResult KeyWait(StrArg aKeyName, optl<StrArg> aOptions, BOOL &aRetVal)
 
 
 
+// WinWait and related functions are driven by WinEvents where possible: rather than searching all
+// windows each time MsgSleep() returns, each wait checks its criteria against only the windows which
+// were created, destroyed, shown, hidden, cloaked, renamed or activated since its previous check, and
+// searches all windows only when one of those windows could change the outcome.  Events are recorded in a
+// ring buffer with a sequence number, so that a wait which was interrupted by another thread (which
+// might be waiting too) can tell whether it missed any, in which case it searches all windows again.
+// Criteria involving WinText, ExcludeText or ahk_group are polled as before, since changes to those
+// aren't reliably signalled by events on the top-level window.  All windows are also searched every
+// WINWAIT_FULL_CHECK_INTERVAL in case an event is missed.
+#define WINWAIT_EVENT_RING_SIZE 64 // Must be a power of 2.
+#define WINWAIT_FULL_CHECK_INTERVAL 500
+static HWND sWinWaitEventRing[WINWAIT_EVENT_RING_SIZE];
+static DWORD sWinWaitEventSeq = 0; // Number of events recorded so far.
+static WinEventHook sWinWaitEventHook;
+static int sWinWaitEventUsers = 0; // Number of waits in progress which are using the hooks.
+static bool sWinWaitWakePosted = false;
+
+static void CALLBACK WinWaitEventProc(HWINEVENTHOOK aHook, DWORD aEvent, HWND aHwnd, LONG aObjectID
+	, LONG aChildID, DWORD aEventThread, DWORD aEventTime)
+{
+	if (aObjectID != OBJID_WINDOW || aChildID != CHILDID_SELF || !aHwnd)
+		return; // Caret, cursor or other objects within a window, which aren't relevant.
+	sWinWaitEventRing[sWinWaitEventSeq++ & (WINWAIT_EVENT_RING_SIZE - 1)] = aHwnd;
+	if (!sWinWaitWakePosted)
+	{
+		// Wake the waiting thread's MsgSleep() now rather than at the next tick of the main timer.
+		// MsgSleep() treats this like any other tick of the main timer.
+		sWinWaitWakePosted = true;
+		PostMessage(g_hWnd, WM_TIMER, TIMER_ID_MAIN, 0);
+	}
+}
+
+static bool WinWaitEventStart()
+// Returns true if the hooks are installed, or false if events are unavailable.
+{
+	if (sWinWaitEventUsers)
+	{
+		++sWinWaitEventUsers;
+		return true;
+	}
+	sWinWaitWakePosted = false;
+	if (!sWinWaitEventHook.Install(WinWaitEventProc, WinEventHook::EVENTS_ALL))
+		return false;
+	sWinWaitEventUsers = 1;
+	return true;
+}
+
+static void WinWaitEventStop()
+{
+	if (--sWinWaitEventUsers)
+		return;
+	sWinWaitEventHook.Remove();
+}
+
+
+
+struct WinWaitParams
+{
+	BuiltInFunctionID condition;
+	bool hwnd_specified;
+	bool use_events; // Whether the WinEvent hooks are installed for this wait.
+	bool match_candidates; // Whether an affected window can be checked on its own (i.e. the criteria aren't "A" or blank).
+	HWND hwnd;
+	HWND found; // For WinWaitClose and WinWait[Not]Active, the window which matched at the previous check.
+	LPCTSTR title, text, exclude_title, exclude_text;
+	WinCriteria *criteria;
+	DWORD event_seq; // sWinWaitEventSeq as of the previous check.
+	DWORD check_time; // When all windows were last searched.
+};
+
+static bool WinWaitCandidateMatches(WinWaitParams &p, HWND aWnd)
+// Returns true if aWnd is a top-level window which matches the criteria.
+{
+	if (!IsWindow(aWnd) || GetAncestor(aWnd, GA_PARENT) != GetDesktopWindow() // Only top-level windows are searched.
+		|| !g->DetectWindow(aWnd))
+		return false;
+	WindowSearch ws;
+	ws.SetCandidate(aWnd);
+	if (p.criteria && p.criteria->mParsed ? !ws.SetCriteria(*g, *p.criteria)
+		: !ws.SetCriteria(*g, p.title, p.text, p.exclude_title, p.exclude_text))
+		return false;
+	return ws.IsMatch();
+}
+
+static bool WinWaitNeedsCheck(WinWaitParams &p)
+// Returns true if the wait's condition should be checked again.
+{
+	if (!p.use_events)
+		return true;
+	sWinWaitWakePosted = false;
+	DWORD now = GetTickCount(), seq = sWinWaitEventSeq;
+	bool check = now - p.check_time >= WINWAIT_FULL_CHECK_INTERVAL
+		|| seq - p.event_seq > WINWAIT_EVENT_RING_SIZE; // Some events were overwritten before this wait saw them.
+	HWND fore = (p.condition == FID_WinWaitActive || p.condition == FID_WinWaitNotActive) ? GetForegroundWindow() : NULL;
+	for (DWORD i = p.event_seq; !check && i != seq; ++i)
+	{
+		HWND hwnd = sWinWaitEventRing[i & (WINWAIT_EVENT_RING_SIZE - 1)];
+		switch (p.condition)
+		{
+		case FID_WinWait:
+			// A window can only start to match if it was created, shown or renamed, in which case
+			// that window was recorded.  Search all windows anyway so that the result is the same
+			// as WinExist(), which finds the topmost match.
+			check = !p.match_candidates || WinWaitCandidateMatches(p, hwnd);
+			break;
+		case FID_WinWaitClose:
+			// The condition can only be met if the window found by the previous check no longer
+			// matches, since otherwise that window still exists.
+			check = !p.match_candidates || hwnd == p.found;
+			break;
+		default: // FID_WinWaitActive or FID_WinWaitNotActive.
+			// A FOREGROUND event reports the new foreground window, and only the foreground window
+			// can stop or start matching (by being renamed or hidden).  The window which matched at
+			// the previous check might have been destroyed without another becoming active, in which
+			// case there might be no foreground window and no FOREGROUND event.
+			check = hwnd == fore || !fore || hwnd == p.found;
+		}
+	}
+	p.event_seq = seq;
+	if (check)
+		p.check_time = now;
+	return check;
+}
+
+
+
 static FResult WinWait(ExprTokenType *aWinTitle, optl<StrArg> aWinText, optl<double> aTimeout, optl<StrArg> aExcludeTitle, optl<StrArg> aExcludeText
 	, UINT &aRetVal, BuiltInFunctionID aCondition)
 {
@@ -177,24 +305,23 @@ static FResult WinWait(ExprTokenType *aWinTitle, optl<StrArg> aWinText, optl<dou
 	
 	TCHAR title_buf[MAX_NUMBER_SIZE];
 	WaitCompletedPredicate predicate;
-	struct Params {
-		BuiltInFunctionID condition;
-		bool hwnd_specified;
-		HWND hwnd;
-		LPCTSTR title, text, exclude_title, exclude_text;
-	} p;
+	WinWaitParams p;
 	
 	p.condition = aCondition;
 	p.hwnd_specified = false;
-	p.hwnd = NULL;
+	p.use_events = false;
+	p.hwnd = p.found = NULL;
 	p.title = _T("");
 	p.text = aWinText.value_or_empty();
 	p.exclude_title = aExcludeTitle.value_or_empty();
 	p.exclude_text = aExcludeText.value_or_empty();
+	auto fr = DetermineWinCriteria(p.criteria, aWinTitle, aWinText, aExcludeTitle, aExcludeText);
+	if (fr != OK)
+		return fr;
 
 	if (aWinTitle)
 	{
-		auto fr = DetermineTargetHwnd(p.hwnd, p.hwnd_specified, *aWinTitle);
+		fr = DetermineTargetHwnd(p.hwnd, p.hwnd_specified, *aWinTitle);
 		if (fr != OK)
 			return fr;
 		if (p.hwnd_specified && !p.hwnd)
@@ -214,7 +341,7 @@ static FResult WinWait(ExprTokenType *aWinTitle, optl<StrArg> aWinText, optl<dou
 	{
 		predicate = [](void *pp)
 		{
-			auto &p = *(Params*)pp;
+			auto &p = *(WinWaitParams*)pp;
 			if (!IsWindow(p.hwnd))
 			{
 				// It's not meaningful to wait for another window to be created with this
@@ -256,8 +383,12 @@ static FResult WinWait(ExprTokenType *aWinTitle, optl<StrArg> aWinText, optl<dou
 	case FID_WinWaitClose:
 		predicate = [](void *pp)
 		{
-			auto &p = *(Params*)pp;
-			HWND found = WinExist(*g, p.title, p.text, p.exclude_title, p.exclude_text, false, true);
+			auto &p = *(WinWaitParams*)pp;
+			if (!WinWaitNeedsCheck(p))
+				return false;
+			HWND found = p.criteria ? WinExist(*g, *p.criteria, false, true)
+				: WinExist(*g, p.title, p.text, p.exclude_title, p.exclude_text, false, true);
+			p.found = found;
 			if ((found != NULL) == (p.condition == FID_WinWait))
 			{
 				p.hwnd = found;
@@ -270,8 +401,12 @@ static FResult WinWait(ExprTokenType *aWinTitle, optl<StrArg> aWinText, optl<dou
 	case FID_WinWaitNotActive:
 		predicate = [](void *pp)
 		{
-			auto &p = *(Params*)pp;
-			HWND found = WinActive(*g, p.title, p.text, p.exclude_title, p.exclude_text, true);
+			auto &p = *(WinWaitParams*)pp;
+			if (!WinWaitNeedsCheck(p))
+				return false;
+			HWND found = p.criteria ? WinActive(*g, *p.criteria, true)
+				: WinActive(*g, p.title, p.text, p.exclude_title, p.exclude_text, true);
+			p.found = found;
 			if ((found != NULL) == (p.condition == FID_WinWaitActive))
 			{
 				p.hwnd = found;
@@ -282,7 +417,26 @@ static FResult WinWait(ExprTokenType *aWinTitle, optl<StrArg> aWinText, optl<dou
 		break;
 	}
 
-	if (Wait(timeout, &p, predicate))
+	if (!p.hwnd_specified)
+	{
+		LPCTSTR title = p.criteria ? p.criteria->mTitle : p.title;
+		LPCTSTR text = p.criteria ? p.criteria->mText : p.text;
+		LPCTSTR exclude_title = p.criteria ? p.criteria->mExcludeTitle : p.exclude_title;
+		LPCTSTR exclude_text = p.criteria ? p.criteria->mExcludeText : p.exclude_text;
+		p.match_candidates = !USE_FOREGROUND_WINDOW(title, text, exclude_title, exclude_text)
+			&& (*title || *exclude_title); // Otherwise, it's the Last Found Window or matches only by text.
+		// Changes to the text of a window's controls and to the members of a group aren't signalled
+		// by events on the window itself, so poll in those cases.
+		if (!*text && !*exclude_text && !tcscasestr(title, _T("ahk_group")))
+			p.use_events = WinWaitEventStart();
+		p.event_seq = sWinWaitEventSeq;
+		p.check_time = GetTickCount() - WINWAIT_FULL_CHECK_INTERVAL; // Ensure the first call checks all windows.
+	}
+
+	bool completed = Wait(timeout, &p, predicate);
+	if (p.use_events)
+		WinWaitEventStop();
+	if (completed)
 	{
 		DoWinDelay;
 		if (aCondition == FID_WinWaitClose || aCondition == FID_WinWaitNotActive)
@@ -20,19 +20,26 @@ GNU General Public License for more details.
 #include "application.h"
 #include "script_func_impl.h"
 #include "abi.h"
+#include "script_object.h"
+#include "win_criteria.h"
 
 
 
 static FResult WinAct(WINTITLE_PARAMETERS_DECL, BuiltInFunctionID action, optl<double> aWaitTime = nullptr)
 {
+	WinCriteria *criteria;
+	auto fr = DetermineWinCriteria(criteria, WINTITLE_PARAMETERS);
+	if (fr != OK)
+		return fr;
 	TCHAR title_buf[MAX_NUMBER_SIZE];
-	auto aTitle = aWinTitle ? TokenToString(*aWinTitle, title_buf) : _T("");
-	auto aText = aWinText.value_or_empty();
+	LPCTSTR aTitle = criteria ? criteria->mTitle : aWinTitle ? TokenToString(*aWinTitle, title_buf) : _T("");
+	LPCTSTR aText = criteria ? criteria->mText : aWinText.value_or_empty();
+	LPCTSTR ex_title = criteria ? criteria->mExcludeTitle : aExcludeTitle.value_or_empty();
+	LPCTSTR ex_text = criteria ? criteria->mExcludeText : aExcludeText.value_or_empty();
 	// Set initial guess for is_ahk_group (further refined later).  For ahk_group, WinText,
 	// ExcludeTitle, and ExcludeText must be blank so that they are reserved for future use
 	// (i.e. they're currently not supported since the group's own criteria take precedence):
-	bool is_ahk_group = !_tcsnicmp(aTitle, _T("ahk_group"), 9) && !*aText
-		&& aExcludeTitle.is_blank_or_omitted() && aExcludeText.is_blank_or_omitted();
+	bool is_ahk_group = !_tcsnicmp(aTitle, _T("ahk_group"), 9) && !*aText && !*ex_title && !*ex_text;
 	// The following is not quite accurate since is_ahk_group is only a guess at this stage, but
 	// given the extreme rarity of the guess being wrong, this shortcut seems justified to reduce
 	// the code size/complexity.  A wait_time of zero seems best for group closing because it's
@@ -55,7 +62,7 @@ static FResult WinAct(WINTITLE_PARAMETERS_DECL, BuiltInFunctionID action, optl<d
 	if (aWinTitle)
 	{
 		bool hwnd_specified;
-		auto fr = DetermineTargetHwnd(target_window, hwnd_specified, *aWinTitle);
+		fr = DetermineTargetHwnd(target_window, hwnd_specified, *aWinTitle);
 		if (fr != OK)
 			return fr;
 		if (hwnd_specified && !target_window) // Specified a HWND of 0, or IsWindow() returned false.
@@ -70,7 +77,7 @@ static FResult WinAct(WINTITLE_PARAMETERS_DECL, BuiltInFunctionID action, optl<d
 			DoWinDelay;
 			return OK;
 		}
-		if (!WinClose(*g, aTitle, aText, wait_time, aExcludeTitle.value_or_empty(), aExcludeText.value_or_empty(), action == FID_WinKill))
+		if (!WinClose(*g, aTitle, aText, wait_time, ex_title, ex_text, action == FID_WinKill))
 			// Currently WinClose returns NULL only for this case; it doesn't confirm the window closed.
 			return FError(ERR_NO_WINDOW, nullptr, ErrorPrototype::Target);
 		DoWinDelay;
@@ -85,7 +92,8 @@ static FResult WinAct(WINTITLE_PARAMETERS_DECL, BuiltInFunctionID action, optl<d
 		bool need_restore = (action == FID_WinShow && !g->DetectHiddenWindows);
 		if (need_restore)
 			g->DetectHiddenWindows = true;
-		target_window = Line::DetermineTargetWindow(aTitle, aText, aExcludeTitle.value_or_empty(), aExcludeText.value_or_empty());
+		target_window = criteria ? WinExist(*g, *criteria)
+			: Line::DetermineTargetWindow(aTitle, aText, ex_title, ex_text);
 		if (need_restore)
 			g->DetectHiddenWindows = false;
 		if (!target_window)
@@ -1648,17 +1656,21 @@ static FResult WinGetListCount(WINTITLE_PARAMETERS_DECL, WindowSearch &ws)
 	HWND target_window = NULL;
 	bool hwnd_specified = false;
 
+	WinCriteria *criteria;
+	auto fr = DetermineWinCriteria(criteria, WINTITLE_PARAMETERS);
+	if (fr != OK)
+		return fr;
 	if (aWinTitle)
 	{
-		auto fr = DetermineTargetHwnd(target_window, hwnd_specified, *aWinTitle);
+		fr = DetermineTargetHwnd(target_window, hwnd_specified, *aWinTitle);
 		if (fr != OK)
 			return fr;
 	}
 
-	auto title = aWinTitle ? TokenToString(*aWinTitle) : _T("");
-	auto text = aWinText.value_or_empty();
-	auto ex_title = aExcludeTitle.value_or_empty();
-	auto ex_text = aExcludeText.value_or_empty();
+	LPCTSTR title = criteria ? criteria->mTitle : aWinTitle ? TokenToString(*aWinTitle) : _T("");
+	LPCTSTR text = criteria ? criteria->mText : aWinText.value_or_empty();
+	LPCTSTR ex_title = criteria ? criteria->mExcludeTitle : aExcludeTitle.value_or_empty();
+	LPCTSTR ex_text = criteria ? criteria->mExcludeText : aExcludeText.value_or_empty();
 
 	// Check if we were asked to count the active window:
 	if (USE_FOREGROUND_WINDOW(title, text, ex_title, ex_text))
@@ -1682,8 +1694,9 @@ static FResult WinGetListCount(WINTITLE_PARAMETERS_DECL, WindowSearch &ws)
 	// Enumerate all windows which match the criteria:
 	// If aTitle is ahk_id nnnn, the Enum() below will be inefficient.  However, ahk_id is almost unheard of
 	// in this context because it makes little sense, so no extra code is added to make that case efficient.
-	if (ws.SetCriteria(*g, title, text, ex_title, ex_text)) // These criteria allow the possibility of a match.
-		EnumWindows(EnumParentFind, (LPARAM)&ws);
+	if (criteria && criteria->mParsed ? ws.SetCriteria(*g, *criteria)
+		: ws.SetCriteria(*g, title, text, ex_title, ex_text)) // These criteria allow the possibility of a match.
+		WindowSnapshot::Enum(ws, EnumParentFind);
 	//else leave ws.mFoundCount set to zero (by the constructor).
 	return OK;
 }
@@ -2218,6 +2231,8 @@ ResultType DetermineTargetHwnd(HWND &aWindow, ResultToken &aResultToken, ExprTok
 	__int64 n = NULL;
 	if (IObject *obj = TokenToObject(aToken))
 	{
+		if (dynamic_cast<WinCriteria *>(obj)) // Not a window, but criteria for finding one.
+			return CONDITION_FALSE;
 		if (!GetObjectIntProperty(obj, _T("Hwnd"), n, aResultToken))
 			return FAIL;
 	}
@@ -2244,10 +2259,32 @@ FResult DetermineTargetHwnd(HWND &aWindow, bool &aDetermined, ExprTokenType &aTo
 }
 
 
+FResult DetermineWinCriteria(WinCriteria *&aCriteria, WINTITLE_PARAMETERS_DECL)
+// Sets aCriteria to the WinCriteria passed as WinTitle, or nullptr if it wasn't one.  Since the
+// object carries its own WinText, ExcludeTitle and ExcludeText, those parameters must be blank.
+{
+	aCriteria = WinCriteria::FromToken(aWinTitle);
+	if (aCriteria && !(aWinText.is_blank_or_omitted() && aExcludeTitle.is_blank_or_omitted() && aExcludeText.is_blank_or_omitted()))
+		return FValueError(ERR_WINCRITERIA_PARAMS);
+	return OK;
+}
+
+
 FResult DetermineTargetWindow(HWND &aWindow, WINTITLE_PARAMETERS_DECL, bool aFindLastMatch)
 {
 	TCHAR number_buf[MAX_NUMBER_SIZE];
 	LPCTSTR title = _T("");
+	WinCriteria *criteria;
+	auto fr = DetermineWinCriteria(criteria, WINTITLE_PARAMETERS);
+	if (fr != OK)
+		return fr;
+	if (criteria)
+	{
+		aWindow = WinExist(*g, *criteria, aFindLastMatch);
+		if (aWindow)
+			return OK;
+		return FError(ERR_NO_WINDOW, criteria->mTitle, ErrorPrototype::Target);
+	}
 	if (aWinTitle)
 	{
 		ResultToken result_token; // TODO: Factor out the use of ResultToken just for error-reporting.
@@ -2309,6 +2346,20 @@ ResultType DetermineTargetWindow(HWND &aWindow, ResultToken &aResultToken, ExprT
 {
 	if (aParamCount > 0)
 	{
+		if (auto criteria = WinCriteria::FromToken(aParam[0]))
+		{
+			// As for DetermineWinCriteria(), the other window parameters must be blank.
+			for (int i = 1, j = 1; i < 4; ++i, ++j)
+			{
+				if (i == 2) j += aNonWinParamCount;
+				if (!ParamIndexIsOmittedOrEmpty(j))
+					return aResultToken.ValueError(ERR_WINCRITERIA_PARAMS);
+			}
+			aWindow = WinExist(*g, *criteria);
+			if (aWindow)
+				return OK;
+			return aResultToken.Error(ERR_NO_WINDOW, criteria->mTitle, ErrorPrototype::Target);
+		}
 		auto result = DetermineTargetHwnd(aWindow, aResultToken, *aParam[0]);
 		if (result != CONDITION_FALSE)
 		{
@@ -2354,7 +2405,17 @@ BIF_DECL(BIF_WinExistActive)
 		}
 	}
 
-	if (!hwnd_specified) // Do not call WinExist()/WinActive() even if the specified hwnd was 0.
+	auto criteria = ParamIndexIsOmitted(0) ? nullptr : WinCriteria::FromToken(aParam[0]);
+	if (criteria && !hwnd_specified)
+	{
+		for (int j = 1; j < 4; ++j)
+			if (!ParamIndexIsOmitted(j) && *ParamIndexToString(j, _f_number_buf))
+				_f_throw_value(ERR_WINCRITERIA_PARAMS);
+		hwnd = _f_callee_id == FID_WinExist
+			? WinExist(*g, *criteria, false, true)
+			: WinActive(*g, *criteria, true);
+	}
+	else if (!hwnd_specified) // Do not call WinExist()/WinActive() even if the specified hwnd was 0.
 	{
 		TCHAR *param[4], param_buf[4][MAX_NUMBER_SIZE];
 		for (int j = 0; j < 4; ++j) // For each formal parameter, including optional ones.
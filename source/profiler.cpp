@@ -0,0 +1,1552 @@
+#include "stdafx.h" // pre-compiled headers
+#include "defines.h"
+#include "globaldata.h"
+#include "script.h"
+#include "TextIO.h"
+#include "qmath.h"
+
+#include "script_object.h"
+#include "script_func_impl.h"
+#include "profiler.h"
+#include "hook.h"
+#include "window.h"
+
+
+//
+// AllocProfiler
+//
+
+bool AllocProfiler::sEnabled = false;
+AllocProfiler::Site *AllocProfiler::sSite = nullptr;
+int AllocProfiler::sSiteCount = 0, AllocProfiler::sSiteCapacity = 0;
+int *AllocProfiler::sSiteHash = nullptr;
+AllocProfiler::LiveObject *AllocProfiler::sLive = nullptr;
+size_t AllocProfiler::sLiveCount = 0, AllocProfiler::sLiveCapacity = 0;
+LPTSTR AllocProfiler::sReportFile = nullptr;
+
+
+static void WriteJsonString(TextFile &aFile, LPCTSTR aStr)
+{
+	aFile.Write(_T("\""));
+	for (LPCTSTR cp = aStr; ; ++cp)
+	{
+		// Write everything up to the next character which requires escaping.
+		LPCTSTR start = cp;
+		while (*cp && *cp != '"' && *cp != '\\' && *cp >= ' ')
+			++cp;
+		if (cp > start)
+			aFile.Write(start, DWORD(cp - start));
+		if (!*cp)
+			break;
+		if (*cp == '"' || *cp == '\\')
+			aFile.Format(_T("\\%c"), *cp);
+		else
+			aFile.Format(_T("\\u%04x"), *cp);
+	}
+	aFile.Write(_T("\""));
+}
+
+
+static inline size_t PtrHash(void *aPtr)
+{
+	// Objects are at least 8-byte aligned, so discard the low bits before mixing.
+	return (size_t)(((UINT_PTR)aPtr >> 3) * (UINT_PTR)Exp32or64(0x9E3779B1, 0x9E3779B97F4A7C15));
+}
+
+
+void AllocProfiler::Enable(LPCTSTR aReportFile)
+{
+	if (aReportFile && *aReportFile)
+		sReportFile = _tcsdup(aReportFile);
+	sEnabled = true;
+}
+
+
+int AllocProfiler::FindOrAddSite(Line *aLine, Object *aProto)
+{
+	if (sSiteCount >= sSiteCapacity && !ExpandSites()) // The index has twice this capacity, so is at most half full.
+		return -1;
+	size_t mask = (size_t)sSiteCapacity * 2 - 1;
+	size_t i = (PtrHash(aLine) ^ PtrHash(aProto)) & mask;
+	for (; sSiteHash[i] != -1; i = (i + 1) & mask)
+	{
+		auto &site = sSite[sSiteHash[i]];
+		if (site.line == aLine && site.proto == aProto)
+			return sSiteHash[i];
+	}
+	auto &site = sSite[sSiteCount];
+	site.line = aLine;
+	site.proto = aProto;
+	site.count = site.bytes = site.live = 0;
+	if (aProto)
+		aProto->AddRef();
+	sSiteHash[i] = sSiteCount;
+	return sSiteCount++;
+}
+
+
+bool AllocProfiler::ExpandSites()
+{
+	int new_capacity = sSiteCapacity ? sSiteCapacity * 2 : 256;
+	auto new_site = (Site *)realloc(sSite, new_capacity * sizeof(Site));
+	if (!new_site)
+		return false;
+	sSite = new_site;
+	auto new_hash = (int *)malloc(new_capacity * 2 * sizeof(int));
+	if (!new_hash)
+		return false;
+	free(sSiteHash);
+	sSiteHash = new_hash;
+	sSiteCapacity = new_capacity;
+	// Rebuild the index.
+	size_t mask = (size_t)new_capacity * 2 - 1;
+	memset(sSiteHash, -1, new_capacity * 2 * sizeof(int));
+	for (int s = 0; s < sSiteCount; ++s)
+	{
+		size_t i = (PtrHash(sSite[s].line) ^ PtrHash(sSite[s].proto)) & mask;
+		while (sSiteHash[i] != -1)
+			i = (i + 1) & mask;
+		sSiteHash[i] = s;
+	}
+	return true;
+}
+
+
+AllocProfiler::LiveObject *AllocProfiler::FindLive(Object *aObj)
+// Returns the entry for aObj, or the empty slot where it should be inserted.
+{
+	size_t mask = sLiveCapacity - 1;
+	size_t i = PtrHash(aObj) & mask;
+	while (sLive[i].obj && sLive[i].obj != aObj)
+		i = (i + 1) & mask;
+	return sLive + i;
+}
+
+
+bool AllocProfiler::ExpandLive()
+{
+	size_t new_capacity = sLiveCapacity ? sLiveCapacity * 2 : 4096;
+	auto new_live = (LiveObject *)calloc(new_capacity, sizeof(LiveObject));
+	if (!new_live)
+		return false;
+	auto old_live = sLive;
+	auto old_capacity = sLiveCapacity;
+	sLive = new_live;
+	sLiveCapacity = new_capacity;
+	for (size_t i = 0; i < old_capacity; ++i)
+		if (old_live[i].obj)
+			*FindLive(old_live[i].obj) = old_live[i];
+	free(old_live);
+	return true;
+}
+
+
+void AllocProfiler::RemoveLive(LiveObject *aEntry)
+{
+	// Backward-shift deletion keeps each probe sequence unbroken without the need for tombstones.
+	size_t mask = sLiveCapacity - 1;
+	size_t i = aEntry - sLive, j = i;
+	for (;;)
+	{
+		j = (j + 1) & mask;
+		if (!sLive[j].obj)
+			break;
+		size_t k = PtrHash(sLive[j].obj) & mask; // The slot where this entry would ideally be.
+		// Move the entry into the hole unless its ideal slot lies cyclically within (i, j].
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		sLive[i] = sLive[j];
+		i = j;
+	}
+	sLive[i].obj = nullptr;
+	--sLiveCount;
+}
+
+
+void AllocProfiler::Created(Object *aObj, Object *aProto, size_t aBytes)
+{
+	if (sLiveCount >= sLiveCapacity / 2 && !ExpandLive()) // Keep the table at most half full.
+		return;
+	int s = FindOrAddSite(g_script.mCurrLine, aProto);
+	if (s < 0)
+		return;
+	auto &site = sSite[s];
+	++site.count;
+	++site.live;
+	site.bytes += aBytes;
+	auto entry = FindLive(aObj);
+	if (!entry->obj)
+		++sLiveCount;
+	else // Shouldn't happen, since deleted objects are removed.
+		--sSite[entry->site].live;
+	entry->obj = aObj;
+	entry->site = s;
+}
+
+
+void AllocProfiler::SetClass(Object *aObj, Object *aProto)
+{
+	if (!sLiveCount)
+		return;
+	auto entry = FindLive(aObj);
+	if (!entry->obj)
+		return; // Not tracked; e.g. created before profiling was enabled.
+	auto &old_site = sSite[entry->site];
+	if (old_site.proto == aProto)
+		return;
+	auto line = old_site.line; // Attribute the object to the line which created it, not the caller of New.
+	int s = FindOrAddSite(line, aProto); // This may invalidate old_site.
+	if (s < 0)
+		return;
+	auto &from = sSite[entry->site], &to = sSite[s];
+	--from.count;
+	--from.live;
+	++to.count;
+	++to.live;
+	to.bytes += from.bytes / (from.count + 1); // Approximate; all objects at a given site usually have the same size.
+	from.bytes -= from.bytes / (from.count + 1);
+	entry->site = s;
+}
+
+
+void AllocProfiler::Deleted(Object *aObj)
+{
+	if (!sLiveCount)
+		return;
+	auto entry = FindLive(aObj);
+	if (!entry->obj)
+		return;
+	--sSite[entry->site].live;
+	RemoveLive(entry);
+}
+
+
+LPTSTR AllocProfiler::ClassName(Object *aProto)
+{
+	ExprTokenType token;
+	if (aProto && aProto->GetOwnProp(token, _T("__Class")) && token.symbol == SYM_STRING)
+		return token.marker;
+	return _T("(unknown)");
+}
+
+
+Map *AllocProfiler::Snapshot()
+// Returns a Map of class name to the number of live objects of that class.
+{
+	auto map = Map::Create();
+	if (!map)
+		return nullptr;
+	for (int s = 0; s < sSiteCount; ++s)
+	{
+		auto &site = sSite[s];
+		if (!site.live)
+			continue;
+		auto name = ClassName(site.proto);
+		ExprTokenType existing;
+		__int64 live = (__int64)site.live;
+		if (map->GetItem(existing, name))
+			live += existing.value_int64;
+		if (!map->SetItem(name, live))
+		{
+			map->Release();
+			return nullptr;
+		}
+	}
+	return map;
+}
+
+
+bool AllocProfiler::WriteReport(LPCTSTR aFileName)
+{
+	TextFile tf;
+	if (!tf.Open(aFileName, TextStream::WRITE | TextStream::EOL_CRLF | TextStream::BOM_UTF8, CP_UTF8))
+		return false;
+
+	// Sort a list of site indices by allocation count, descending.
+	auto order = (int *)malloc(sSiteCount * sizeof(int) + 1);
+	if (!order)
+		return false;
+	for (int s = 0; s < sSiteCount; ++s)
+		order[s] = s;
+	qsort(order, sSiteCount, sizeof(int), [](const void *a, const void *b) {
+		auto &sa = sSite[*(int *)a], &sb = sSite[*(int *)b];
+		return sa.count < sb.count ? 1 : sa.count > sb.count ? -1 : 0;
+	});
+
+	tf.Format(_T("Allocation profile for %s\n\n"), g_script.mFileSpec);
+	tf.Write(_T("Allocations by line and class:\n")
+		_T("      Count        Bytes         Live  Class                 Location\n"));
+	for (int n = 0; n < sSiteCount; ++n)
+	{
+		auto &site = sSite[order[n]];
+		if (!site.count)
+			continue;
+		tf.Format(_T("%11Iu  %11Iu  %11Iu  %-20s  "), site.count, site.bytes, site.live, ClassName(site.proto));
+		if (site.line)
+			tf.Format(_T("%s (%u)\n"), Line::sSourceFile[site.line->mFileIndex], site.line->mLineNumber);
+		else
+			tf.Write(_T("(startup)\n"));
+	}
+
+	// Aggregate surviving objects by class.  Since sites are already sorted by count and the number
+	// of classes is usually small, a simple nested loop is sufficient.
+	tf.Write(_T("\nSurviving objects by class:\n")
+		_T("       Live  Class\n"));
+	for (int n = 0; n < sSiteCount; ++n)
+	{
+		auto &site = sSite[order[n]];
+		if (!site.live)
+			continue;
+		auto name = ClassName(site.proto);
+		int m;
+		for (m = 0; m < n; ++m) // Skip this class if it was already listed.
+			if (sSite[order[m]].live && !_tcscmp(ClassName(sSite[order[m]].proto), name))
+				break;
+		if (m < n)
+			continue;
+		UINT_PTR live = 0;
+		for (m = n; m < sSiteCount; ++m)
+			if (!_tcscmp(ClassName(sSite[order[m]].proto), name))
+				live += sSite[order[m]].live;
+		tf.Format(_T("%11Iu  %s\n"), live, name);
+	}
+	free(order);
+
+#ifdef CONFIG_EXPR_ALLOC_STATS
+	tf.Write(_T("\nExpression temporaries by line:\n")
+		_T("     Allocs       Copies        Moves  Location\n"));
+	for (Line *line = g_script.mFirstLine; line; line = line->mNextLine)
+	{
+		UINT allocs = 0, copies = 0, moves = 0;
+		for (int i = 0; i < line->mArgc; ++i)
+		{
+			ArgStruct &arg = line->mArg[i];
+			if (!arg.is_expression || !arg.postfix)
+				continue;
+			allocs += arg.stats.allocs;
+			copies += arg.stats.copies;
+			moves += arg.stats.moves;
+		}
+		if (allocs || copies || moves)
+			tf.Format(_T("%11u  %11u  %11u  %s (%u)\n"), allocs, copies, moves
+				, Line::sSourceFile[line->mFileIndex], line->mLineNumber);
+	}
+#endif
+	return true;
+}
+
+
+void AllocProfiler::Exit()
+// Called by TerminateApp() after global and static variables are released.
+{
+	if (!sEnabled)
+		return;
+	if (sReportFile)
+		WriteReport(sReportFile);
+	else
+	{
+		TCHAR file[T_MAX_PATH];
+		sntprintf(file, _countof(file), _T("%s.alloc.txt"), g_script.mFileSpec);
+		WriteReport(file);
+	}
+	sEnabled = false;
+}
+
+
+BIF_DECL(BIF_ObjAllocSnapshot)
+{
+	if (!AllocProfiler::sEnabled)
+		_f_throw(_T("Allocation profiling is not enabled."), _T("/ProfileAlloc"));
+	if (auto map = AllocProfiler::Snapshot())
+		_f_return(map);
+	_f_throw_oom;
+}
+
+
+
+#ifdef CONFIG_DEBUGGER
+
+//
+// SampleProfiler
+//
+
+bool SampleProfiler::sEnabled = false;
+volatile bool SampleProfiler::sSampleDue = false;
+SampleProfiler::Node *SampleProfiler::sNode = nullptr;
+int SampleProfiler::sNodeCount = 0, SampleProfiler::sNodeCapacity = 0;
+int *SampleProfiler::sNodeHash = nullptr;
+PTP_TIMER SampleProfiler::sTimer = nullptr;
+DWORD SampleProfiler::sInterval = 10;
+__int64 SampleProfiler::sLastSample = 0, SampleProfiler::sFrequency = 0;
+
+
+static inline size_t NodeHash(int aParent, void *aKey)
+{
+	return PtrHash(aKey) ^ ((size_t)(aParent + 1) * 0x9E3779B1);
+}
+
+
+static VOID CALLBACK SampleTimerCallback(PTP_CALLBACK_INSTANCE aInstance, PVOID aContext, PTP_TIMER aTimer)
+{
+	SampleProfiler::sSampleDue = true;
+	g_script.mPeekDue = true; // Causes ExecUntil() to call PeekIfDue(), which calls TakeSample().
+}
+
+
+void SampleProfiler::Enable(LPCTSTR aInterval)
+{
+	if (aInterval && *aInterval)
+	{
+		int interval = ATOI(aInterval);
+		sInterval = interval > 0 ? interval : 1;
+	}
+	sEnabled = true;
+}
+
+
+void SampleProfiler::Start()
+// Called by AutoExecSection() immediately before the script begins executing.
+{
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	sFrequency = freq.QuadPart;
+	ThreadStarted();
+	if (  !(sTimer = CreateThreadpoolTimer(SampleTimerCallback, NULL, NULL))  )
+	{
+		sEnabled = false;
+		return;
+	}
+	// Due time is relative (negative) and in 100-nanosecond units.
+	ULARGE_INTEGER due;
+	due.QuadPart = (ULONGLONG)-((LONGLONG)sInterval * 10000);
+	FILETIME due_time;
+	due_time.dwLowDateTime = due.LowPart;
+	due_time.dwHighDateTime = due.HighPart;
+	SetThreadpoolTimer(sTimer, &due_time, sInterval, 0);
+}
+
+
+void SampleProfiler::ThreadStarted()
+// Called when a thread starts, so that the time spent idle isn't attributed to the next sample.
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	sLastSample = now.QuadPart;
+}
+
+
+void SampleProfiler::TakeSample()
+// Called by Script::PeekIfDue() before the next line executes, so g_script.mCurrLine is the
+// line which was executing when the timer fired (or the last line of a function it called).
+{
+	sSampleDue = false;
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	__int64 weight = now.QuadPart - sLastSample;
+	sLastSample = now.QuadPart;
+
+	auto &stack = g_Debugger.mStack;
+	int node = -1;
+	for (auto se = stack.mBottom; se <= stack.mTop; ++se)
+	{
+		switch (se->type)
+		{
+		case DbgStack::SE_Thread: node = FindOrAddNode(node, (void *)se->desc, NT_Thread); break;
+		case DbgStack::SE_UDF: node = FindOrAddNode(node, static_cast<Func *>(se->udf->func), NT_Func); break;
+		case DbgStack::SE_BIF: node = FindOrAddNode(node, static_cast<Func *>(se->func), NT_Func); break;
+		}
+		if (node < 0) // Out of memory.
+			return;
+	}
+	if (g_script.mCurrLine)
+		node = FindOrAddNode(node, g_script.mCurrLine, NT_Line);
+	if (node < 0)
+		return;
+	++sNode[node].samples;
+	sNode[node].time += weight;
+}
+
+
+int SampleProfiler::FindOrAddNode(int aParent, void *aKey, NodeType aType)
+{
+	if (sNodeCount >= sNodeCapacity && !ExpandNodes()) // The index has twice this capacity, so is at most half full.
+		return -1;
+	size_t mask = (size_t)sNodeCapacity * 2 - 1;
+	size_t i = NodeHash(aParent, aKey) & mask;
+	for (; sNodeHash[i] != -1; i = (i + 1) & mask)
+	{
+		auto &node = sNode[sNodeHash[i]];
+		if (node.key == aKey && node.parent == aParent && node.type == aType)
+			return sNodeHash[i];
+	}
+	auto &node = sNode[sNodeCount];
+	node.key = aKey;
+	node.parent = aParent;
+	node.type = aType;
+	node.name = nullptr;
+	node.samples = 0;
+	node.time = 0;
+	if (aType == NT_Thread)
+		// Copy the description since it might not be permanent (such as a hotkey's name).
+		node.name = aKey ? _tcsdup((LPCTSTR)aKey) : nullptr;
+	else if (aType == NT_Func)
+		((Func *)aKey)->AddRef(); // Keep the name valid for the report.
+	sNodeHash[i] = sNodeCount;
+	return sNodeCount++;
+}
+
+
+bool SampleProfiler::ExpandNodes()
+{
+	int new_capacity = sNodeCapacity ? sNodeCapacity * 2 : 1024;
+	auto new_node = (Node *)realloc(sNode, new_capacity * sizeof(Node));
+	if (!new_node)
+		return false;
+	sNode = new_node;
+	auto new_hash = (int *)malloc(new_capacity * 2 * sizeof(int));
+	if (!new_hash)
+		return false;
+	free(sNodeHash);
+	sNodeHash = new_hash;
+	sNodeCapacity = new_capacity;
+	// Rebuild the index.
+	size_t mask = (size_t)new_capacity * 2 - 1;
+	memset(sNodeHash, -1, new_capacity * 2 * sizeof(int));
+	for (int n = 0; n < sNodeCount; ++n)
+	{
+		size_t i = NodeHash(sNode[n].parent, sNode[n].key) & mask;
+		while (sNodeHash[i] != -1)
+			i = (i + 1) & mask;
+		sNodeHash[i] = n;
+	}
+	return true;
+}
+
+
+LPCTSTR SampleProfiler::NodeName(Node &aNode, LPTSTR aBuf, size_t aBufSize)
+{
+	switch (aNode.type)
+	{
+	case NT_Thread:
+		return aNode.name ? aNode.name : _T("(thread)");
+	case NT_Func:
+		return ((Func *)aNode.key)->mName;
+	default: // NT_Line
+		auto line = (Line *)aNode.key;
+		LPCTSTR file = Line::sSourceFile[line->mFileIndex], name = _tcsrchr(file, '\\');
+		sntprintf(aBuf, (int)aBufSize, _T("%s:%u"), name ? name + 1 : file, line->mLineNumber);
+		return aBuf;
+	}
+}
+
+
+bool SampleProfiler::WriteFolded(LPCTSTR aFileName)
+// Writes one line per distinct stack in the "folded" format used by flame graph tools: the
+// names of each frame from outermost to innermost separated by semicolons, then a space and
+// the time in microseconds.
+{
+	TextFile tf;
+	if (!tf.Open(aFileName, TextStream::WRITE, CP_UTF8))
+		return false;
+	auto path = (int *)malloc(sNodeCount * sizeof(int) + 1);
+	if (!path)
+		return false;
+	for (int n = 0; n < sNodeCount; ++n)
+	{
+		__int64 usec = sNode[n].time * 1000000 / sFrequency;
+		if (!usec)
+			continue;
+		int depth = 0;
+		for (int p = n; p >= 0; p = sNode[p].parent)
+			path[depth++] = p;
+		while (depth--)
+		{
+			TCHAR buf[MAX_PATH + 16], name[MAX_PATH + 16];
+			tcslcpy(name, NodeName(sNode[path[depth]], buf, _countof(buf)), _countof(name));
+			for (LPTSTR cp = name; *cp; ++cp)
+				if (*cp == ';') // Reserved as the frame separator.
+					*cp = ':';
+			tf.Write(name);
+			tf.Write(depth ? _T(";") : _T(" "));
+		}
+		tf.Format(_T("%I64d\n"), usec);
+	}
+	free(path);
+	return true;
+}
+
+
+bool SampleProfiler::WriteTable(LPCTSTR aFileName)
+{
+	TextFile tf;
+	if (!tf.Open(aFileName, TextStream::WRITE | TextStream::EOL_CRLF | TextStream::BOM_UTF8, CP_UTF8))
+		return false;
+
+	struct Stat
+	{
+		int node; // The first node with this key.
+		UINT_PTR samples;
+		__int64 self, total;
+	};
+	// Allocate everything at once, for simplicity.
+	auto subtotal = (__int64 *)malloc(sNodeCount * (2 * sizeof(__int64) + sizeof(int) + sizeof(Stat)) + 1);
+	if (!subtotal)
+		return false;
+	auto self = subtotal + sNodeCount;
+	auto order = (int *)(self + sNodeCount);
+	auto stat = (Stat *)(order + sNodeCount);
+
+	// Compute the total time of each subtree.  Since each node's parent precedes it, a single
+	// reverse pass is sufficient.
+	__int64 grand_total = 0;
+	UINT_PTR sample_count = 0;
+	for (int n = 0; n < sNodeCount; ++n)
+	{
+		subtotal[n] = self[n] = sNode[n].time;
+		grand_total += sNode[n].time;
+		sample_count += sNode[n].samples;
+	}
+	for (int n = sNodeCount; --n >= 0; )
+	{
+		int p = sNode[n].parent;
+		if (p < 0)
+			continue;
+		subtotal[p] += subtotal[n];
+		if (sNode[n].type == NT_Line) // Lines are attributed to their function or thread as self time.
+			self[p] += sNode[n].time;
+	}
+
+	// Group nodes with the same key together.
+	for (int n = 0; n < sNodeCount; ++n)
+		order[n] = n;
+	qsort(order, sNodeCount, sizeof(int), [](const void *a, const void *b) {
+		auto &na = sNode[*(int *)a], &nb = sNode[*(int *)b];
+		if (na.type != nb.type)
+			return na.type < nb.type ? -1 : 1;
+		return na.key < nb.key ? -1 : na.key > nb.key ? 1 : *(int *)a - *(int *)b;
+	});
+
+	// Aggregate each group.  Total time is counted only for the outermost occurrence of a function
+	// in each stack, so that recursion doesn't inflate it.
+	int stat_count = 0, line_stat_start = -1;
+	for (int i = 0; i < sNodeCount; )
+	{
+		auto &first = sNode[order[i]];
+		if (first.type == NT_Line && line_stat_start < 0)
+			line_stat_start = stat_count;
+		Stat &s = stat[stat_count++];
+		s.node = order[i];
+		s.samples = 0;
+		s.self = s.total = 0;
+		for ( ; i < sNodeCount && sNode[order[i]].key == first.key && sNode[order[i]].type == first.type; ++i)
+		{
+			int n = order[i];
+			s.samples += sNode[n].samples;
+			s.self += self[n];
+			int p;
+			for (p = sNode[n].parent; p >= 0; p = sNode[p].parent)
+				if (sNode[p].key == first.key)
+					break;
+			if (p < 0)
+				s.total += subtotal[n];
+		}
+	}
+	if (line_stat_start < 0)
+		line_stat_start = stat_count;
+
+	auto by_self = [](const void *a, const void *b) {
+		auto &sa = *(Stat *)a, &sb = *(Stat *)b;
+		return sa.self < sb.self ? 1 : sa.self > sb.self ? -1 : 0;
+	};
+	qsort(stat, line_stat_start, sizeof(Stat), by_self);
+	qsort(stat + line_stat_start, stat_count - line_stat_start, sizeof(Stat), by_self);
+
+	double ms_per_tick = 1000.0 / sFrequency, pct_per_tick = grand_total ? 100.0 / grand_total : 0;
+	tf.Format(_T("Sampling profile for %s\n\n"), g_script.mFileSpec);
+	tf.Format(_T("%Iu samples over %.1f ms (interval %u ms)\n\n"), sample_count, grand_total * ms_per_tick, sInterval);
+	TCHAR buf[MAX_PATH + 16];
+	tf.Write(_T("Threads and functions:\n")
+		_T("    Self ms  Self %   Total ms Total %  Name\n"));
+	for (int i = 0; i < line_stat_start; ++i)
+	{
+		auto &s = stat[i];
+		auto &node = sNode[s.node];
+		tf.Format(_T("%11.1f %6.2f %11.1f %6.2f  %s%s\n")
+			, s.self * ms_per_tick, s.self * pct_per_tick, s.total * ms_per_tick, s.total * pct_per_tick
+			, node.type == NT_Thread ? _T("(thread) ") : _T(""), NodeName(node, buf, _countof(buf)));
+	}
+	tf.Write(_T("\nLines:\n")
+		_T("    Self ms  Self %     Samples  Location\n"));
+	for (int i = line_stat_start; i < stat_count; ++i)
+	{
+		auto &s = stat[i];
+		auto line = (Line *)sNode[s.node].key;
+		tf.Format(_T("%11.1f %6.2f %11Iu  %s (%u)\n")
+			, s.self * ms_per_tick, s.self * pct_per_tick, s.samples
+			, Line::sSourceFile[line->mFileIndex], line->mLineNumber);
+	}
+	free(subtotal);
+	return true;
+}
+
+
+bool SampleProfiler::WriteReport(LPCTSTR aFileName)
+// Writes folded stacks if aFileName ends with ".folded", otherwise a table of functions and lines.
+{
+	LPCTSTR ext = _tcsrchr(aFileName, '.');
+	if (ext && !_tcsicmp(ext, _T(".folded")))
+		return WriteFolded(aFileName);
+	return WriteTable(aFileName);
+}
+
+
+void SampleProfiler::Exit()
+// Called by TerminateApp() after any __delete handlers have been called, so they are included.
+{
+	if (!sEnabled)
+		return;
+	sEnabled = false;
+	if (!sFrequency) // Start() was never called, such as due to a load-time error.
+		return;
+	if (sTimer)
+	{
+		SetThreadpoolTimer(sTimer, NULL, 0, 0); // Cancel any pending callback.
+		WaitForThreadpoolTimerCallbacks(sTimer, TRUE);
+		CloseThreadpoolTimer(sTimer);
+		sTimer = nullptr;
+	}
+	TCHAR file[T_MAX_PATH];
+	sntprintf(file, _countof(file), _T("%s.samples.txt"), g_script.mFileSpec);
+	WriteTable(file);
+	sntprintf(file, _countof(file), _T("%s.folded"), g_script.mFileSpec);
+	WriteFolded(file);
+}
+
+
+BIF_DECL(BIF_SampleProfileWrite)
+{
+	if (!SampleProfiler::sEnabled)
+		_f_throw(_T("Sampling profiling is not enabled."), _T("/ProfileSample"));
+	TCHAR file[T_MAX_PATH];
+	LPTSTR file_name = ParamIndexIsOmitted(0) ? nullptr : ParamIndexToString(0, _f_number_buf);
+	if (!file_name || !*file_name)
+	{
+		sntprintf(file, _countof(file), _T("%s.samples.txt"), g_script.mFileSpec);
+		file_name = file;
+	}
+	if (!SampleProfiler::WriteReport(file_name))
+		_f_throw_win32();
+	_f_return_empty;
+}
+
+#endif
+
+
+
+#ifdef CONFIG_DEBUGGER
+
+//
+// CallProfiler
+//
+
+bool CallProfiler::sEnabled = false;
+CallProfiler::Stat *CallProfiler::sStat = nullptr;
+int CallProfiler::sStatCount = 0, CallProfiler::sStatCapacity = 0;
+int *CallProfiler::sStatHash = nullptr;
+CallProfiler::Frame *CallProfiler::sFrame = nullptr;
+int CallProfiler::sFrameCount = 0, CallProfiler::sFrameCapacity = 0;
+CallProfiler::Event *CallProfiler::sEvent = nullptr;
+size_t CallProfiler::sEventCount = 0, CallProfiler::sEventCapacity = 0, CallProfiler::sEventsDropped = 0;
+__int64 CallProfiler::sFrequency = 0, CallProfiler::sStartTime = 0;
+
+// Limits memory usage to around 24 MB (on x64); calls beyond this are still counted and timed.
+#define CALL_PROFILER_MAX_EVENTS 1000000
+
+
+void CallProfiler::Enable()
+{
+	LARGE_INTEGER li;
+	QueryPerformanceFrequency(&li);
+	sFrequency = li.QuadPart;
+	QueryPerformanceCounter(&li);
+	sStartTime = li.QuadPart;
+	sEnabled = true;
+}
+
+
+void CallProfiler::Enter(void *aKey, bool aIsThread)
+{
+	if (sFrameCount == sFrameCapacity)
+	{
+		int new_capacity = sFrameCapacity ? sFrameCapacity * 2 : 128;
+		auto new_frame = (Frame *)realloc(sFrame, new_capacity * sizeof(Frame));
+		if (!new_frame)
+		{
+			// Disable profiling rather than letting Leave() get out of sync with the call stack.
+			sEnabled = false;
+			return;
+		}
+		sFrame = new_frame;
+		sFrameCapacity = new_capacity;
+	}
+	auto &frame = sFrame[sFrameCount++];
+	frame.stat = FindOrAddStat(aKey, aIsThread);
+	if (frame.stat >= 0)
+	{
+		++sStat[frame.stat].calls;
+		++sStat[frame.stat].active;
+	}
+	frame.children = 0;
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	frame.start = now.QuadPart; // Last, to exclude the overhead above from this call.
+}
+
+
+void CallProfiler::Leave()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now); // First, to exclude the overhead below from this call.
+	if (!sFrameCount) // Should be impossible.
+		return;
+	auto &frame = sFrame[--sFrameCount];
+	__int64 elapsed = now.QuadPart - frame.start;
+	if (sFrameCount)
+		sFrame[sFrameCount - 1].children += elapsed;
+	if (frame.stat < 0)
+		return;
+	auto &stat = sStat[frame.stat];
+	stat.exclusive += elapsed - frame.children;
+	if (!--stat.active)
+		stat.inclusive += elapsed;
+	if (sEventCount == sEventCapacity)
+	{
+		size_t new_capacity = sEventCapacity ? sEventCapacity * 2 : 4096;
+		if (new_capacity > CALL_PROFILER_MAX_EVENTS)
+			new_capacity = CALL_PROFILER_MAX_EVENTS;
+		auto new_event = new_capacity > sEventCapacity ? (Event *)realloc(sEvent, new_capacity * sizeof(Event)) : nullptr;
+		if (!new_event)
+		{
+			++sEventsDropped;
+			return;
+		}
+		sEvent = new_event;
+		sEventCapacity = new_capacity;
+	}
+	auto &event = sEvent[sEventCount++];
+	event.stat = frame.stat;
+	event.start = frame.start;
+	event.duration = elapsed;
+}
+
+
+int CallProfiler::FindOrAddStat(void *aKey, bool aIsThread)
+{
+	if (sStatCount >= sStatCapacity && !ExpandStats()) // The index has twice this capacity, so is at most half full.
+		return -1;
+	size_t mask = (size_t)sStatCapacity * 2 - 1;
+	size_t i = PtrHash(aKey) & mask;
+	for (; sStatHash[i] != -1; i = (i + 1) & mask)
+	{
+		auto &stat = sStat[sStatHash[i]];
+		if (stat.key == aKey && stat.is_thread == aIsThread)
+			return sStatHash[i];
+	}
+	auto &stat = sStat[sStatCount];
+	stat.key = aKey;
+	stat.is_thread = aIsThread;
+	stat.name = nullptr;
+	stat.active = 0;
+	stat.calls = 0;
+	stat.inclusive = stat.exclusive = 0;
+	if (aIsThread)
+		// Copy the description since it might not be permanent (such as a hotkey's name).
+		stat.name = aKey ? _tcsdup((LPCTSTR)aKey) : nullptr;
+	else
+		((Func *)aKey)->AddRef(); // Keep the name valid for the report.
+	sStatHash[i] = sStatCount;
+	return sStatCount++;
+}
+
+
+bool CallProfiler::ExpandStats()
+{
+	int new_capacity = sStatCapacity ? sStatCapacity * 2 : 256;
+	auto new_stat = (Stat *)realloc(sStat, new_capacity * sizeof(Stat));
+	if (!new_stat)
+		return false;
+	sStat = new_stat;
+	auto new_hash = (int *)malloc(new_capacity * 2 * sizeof(int));
+	if (!new_hash)
+		return false;
+	free(sStatHash);
+	sStatHash = new_hash;
+	sStatCapacity = new_capacity;
+	// Rebuild the index.
+	size_t mask = (size_t)new_capacity * 2 - 1;
+	memset(sStatHash, -1, new_capacity * 2 * sizeof(int));
+	for (int s = 0; s < sStatCount; ++s)
+	{
+		size_t i = PtrHash(sStat[s].key) & mask;
+		while (sStatHash[i] != -1)
+			i = (i + 1) & mask;
+		sStatHash[i] = s;
+	}
+	return true;
+}
+
+
+LPCTSTR CallProfiler::StatName(Stat &aStat)
+{
+	if (aStat.is_thread)
+		return aStat.name ? aStat.name : _T("(thread)");
+	return ((Func *)aStat.key)->mName;
+}
+
+
+bool CallProfiler::WriteTrace(LPCTSTR aFileName)
+// Writes recorded calls in the Chrome trace event format, as "complete" events with timestamps
+// and durations in microseconds.  Threads appear as the outermost events.
+{
+	TextFile tf;
+	if (!tf.Open(aFileName, TextStream::WRITE, CP_UTF8))
+		return false;
+	double usec_per_tick = 1000000.0 / sFrequency;
+	tf.Write(_T("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"));
+	for (size_t e = 0; e < sEventCount; ++e)
+	{
+		auto &event = sEvent[e];
+		auto &stat = sStat[event.stat];
+		tf.Write(_T("{\"name\":"));
+		WriteJsonString(tf, StatName(stat));
+		tf.Format(_T(",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}%s\n")
+			, stat.is_thread ? _T("thread") : _T("function")
+			, (event.start - sStartTime) * usec_per_tick, event.duration * usec_per_tick
+			, e + 1 < sEventCount ? _T(",") : _T(""));
+	}
+	tf.Write(_T("]}\n"));
+	return true;
+}
+
+
+bool CallProfiler::WriteTable(LPCTSTR aFileName)
+{
+	TextFile tf;
+	if (!tf.Open(aFileName, TextStream::WRITE | TextStream::EOL_CRLF | TextStream::BOM_UTF8, CP_UTF8))
+		return false;
+
+	auto order = (int *)malloc(sStatCount * sizeof(int) + 1);
+	if (!order)
+		return false;
+	for (int s = 0; s < sStatCount; ++s)
+		order[s] = s;
+	qsort(order, sStatCount, sizeof(int), [](const void *a, const void *b) {
+		auto &sa = sStat[*(int *)a], &sb = sStat[*(int *)b];
+		return sa.exclusive < sb.exclusive ? 1 : sa.exclusive > sb.exclusive ? -1 : 0;
+	});
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	__int64 wall_time = now.QuadPart - sStartTime;
+	double ms_per_tick = 1000.0 / sFrequency, pct_per_tick = wall_time ? 100.0 / wall_time : 0;
+	UINT_PTR total_calls = 0;
+	for (int s = 0; s < sStatCount; ++s)
+		if (!sStat[s].is_thread)
+			total_calls += sStat[s].calls;
+
+	tf.Format(_T("Call profile for %s\n\n"), g_script.mFileSpec);
+	tf.Format(_T("%Iu function calls over %.1f ms\n"), total_calls, wall_time * ms_per_tick);
+	if (sEventsDropped)
+		tf.Format(_T("%Iu calls were not recorded for the trace due to the limit of %u events\n"), sEventsDropped, CALL_PROFILER_MAX_EVENTS);
+	tf.Write(_T("\n")
+		_T("      Calls    Excl ms  Excl %    Incl ms  Incl %  Avg incl us  Name\n"));
+	for (int i = 0; i < sStatCount; ++i)
+	{
+		auto &stat = sStat[order[i]];
+		tf.Format(_T("%11Iu %10.2f %6.2f %10.2f %6.2f %12.2f  %s%s\n")
+			, stat.calls
+			, stat.exclusive * ms_per_tick, stat.exclusive * pct_per_tick
+			, stat.inclusive * ms_per_tick, stat.inclusive * pct_per_tick
+			, stat.calls ? stat.inclusive * ms_per_tick * 1000 / stat.calls : 0.0
+			, stat.is_thread ? _T("(thread) ") : _T(""), StatName(stat));
+	}
+	free(order);
+	return true;
+}
+
+
+bool CallProfiler::WriteReport(LPCTSTR aFileName)
+// Writes trace events if aFileName ends with ".json", otherwise a table of functions.
+{
+	LPCTSTR ext = _tcsrchr(aFileName, '.');
+	if (ext && !_tcsicmp(ext, _T(".json")))
+		return WriteTrace(aFileName);
+	return WriteTable(aFileName);
+}
+
+
+void CallProfiler::Exit()
+// Called by TerminateApp() after any __delete handlers have been called, so they are included.
+{
+	if (!sEnabled)
+		return;
+	// Complete any calls which are still in progress, such as those which called ExitApp.
+	while (sFrameCount)
+		Leave();
+	sEnabled = false;
+	TCHAR file[T_MAX_PATH];
+	sntprintf(file, _countof(file), _T("%s.calls.txt"), g_script.mFileSpec);
+	WriteTable(file);
+	sntprintf(file, _countof(file), _T("%s.trace.json"), g_script.mFileSpec);
+	WriteTrace(file);
+}
+
+
+BIF_DECL(BIF_CallProfileWrite)
+{
+	if (!CallProfiler::sEnabled)
+		_f_throw(_T("Call profiling is not enabled."), _T("/ProfileCalls"));
+	TCHAR file[T_MAX_PATH];
+	LPTSTR file_name = ParamIndexIsOmitted(0) ? nullptr : ParamIndexToString(0, _f_number_buf);
+	if (!file_name || !*file_name)
+	{
+		sntprintf(file, _countof(file), _T("%s.calls.txt"), g_script.mFileSpec);
+		file_name = file;
+	}
+	if (!CallProfiler::WriteReport(file_name))
+		_f_throw_win32();
+	_f_return_empty;
+}
+
+#endif
+
+
+
+//
+// BenchmarkRunner
+//
+
+bool BenchmarkRunner::sEnabled = false;
+BenchmarkRunner::Result *BenchmarkRunner::sResult = nullptr;
+int BenchmarkRunner::sResultCount = 0, BenchmarkRunner::sResultCapacity = 0;
+LPTSTR BenchmarkRunner::sReportFile = nullptr;
+__int64 BenchmarkRunner::sFrequency = 0;
+
+
+void BenchmarkRunner::Enable(LPCTSTR aReportFile)
+{
+	if (aReportFile && *aReportFile)
+		sReportFile = _tcsdup(aReportFile);
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	sFrequency = freq.QuadPart;
+	sEnabled = true;
+}
+
+
+ResultType BenchmarkRunner::Call(IObject *aCallback, __int64 aIterations, __int64 &aTicks)
+{
+	ExprTokenType param(aIterations);
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	auto result = CallMethod(aCallback, aCallback, nullptr, &param, 1);
+	QueryPerformanceCounter(&end);
+	aTicks = end.QuadPart - start.QuadPart;
+	if (aTicks < 1)
+		aTicks = 1; // Avoid division by zero for callbacks faster than the timer's resolution.
+	return result;
+}
+
+
+bool BenchmarkRunner::AddResult(Result &aResult)
+{
+	if (sResultCount == sResultCapacity)
+	{
+		int new_capacity = sResultCapacity ? sResultCapacity * 2 : 16;
+		auto new_result = (Result *)realloc(sResult, new_capacity * sizeof(Result));
+		if (!new_result)
+			return false;
+		sResult = new_result;
+		sResultCapacity = new_capacity;
+	}
+	if (  !(aResult.name = _tcsdup(aResult.name))  )
+		return false;
+	sResult[sResultCount++] = aResult;
+	return true;
+}
+
+
+#define BENCHMARK_MAX_ITERATIONS 1000000000000000 // 10^15, far more than any real benchmark calibrates to.
+
+void BenchmarkRunner::Run(ResultToken &aResultToken, LPTSTR aName, IObject *aCallback
+	, int aWarmup, int aRepetitions, int aTargetTime, __int64 aIterations)
+{
+	ResultType result;
+	__int64 ticks, target = sFrequency * aTargetTime / 1000;
+
+	if (!aIterations)
+	{
+		// Calibrate by increasing the iteration count until a single call takes at least the target
+		// time.  Growth is limited to 10x per step since short timings are dominated by noise.
+		// A callback which ignores its parameter would never reach the target, so give up before
+		// the count could overflow.
+		for (aIterations = 1; ; )
+		{
+			if ((result = Call(aCallback, aIterations, ticks)) == FAIL || result == EARLY_EXIT)
+				_f_return_FAIL;
+			if (ticks >= target)
+				break;
+			if (aIterations > BENCHMARK_MAX_ITERATIONS / 10)
+				_f_throw(_T("Calibration failed.  The callback must perform the operation N times, where N is its parameter."), aName);
+			double scale = 1.1 * target / ticks;
+			aIterations = (__int64)(aIterations * (scale < 10 ? scale : 10)) + 1;
+		}
+	}
+
+	for (int i = 0; i < aWarmup; ++i)
+		if ((result = Call(aCallback, aIterations, ticks)) == FAIL || result == EARLY_EXIT)
+			_f_return_FAIL;
+
+	auto ops = (double *)malloc(aRepetitions * sizeof(double));
+	if (!ops)
+		_f_throw_oom;
+	for (int i = 0; i < aRepetitions; ++i)
+	{
+		if ((result = Call(aCallback, aIterations, ticks)) == FAIL || result == EARLY_EXIT)
+		{
+			free(ops);
+			_f_return_FAIL;
+		}
+		ops[i] = (double)aIterations * sFrequency / ticks;
+	}
+
+	qsort(ops, aRepetitions, sizeof(double), [](const void *a, const void *b) {
+		double da = *(double *)a, db = *(double *)b;
+		return da < db ? -1 : da > db ? 1 : 0;
+	});
+	double sum = 0, sum_sq = 0;
+	for (int i = 0; i < aRepetitions; ++i)
+		sum += ops[i];
+	double mean = sum / aRepetitions;
+	for (int i = 0; i < aRepetitions; ++i)
+		sum_sq += (ops[i] - mean) * (ops[i] - mean);
+
+	Result r;
+	r.name = aName;
+	r.iterations = aIterations;
+	r.warmup = aWarmup;
+	r.repetitions = aRepetitions;
+	r.min = ops[0];
+	r.max = ops[aRepetitions - 1];
+	r.median = aRepetitions & 1 ? ops[aRepetitions / 2] : (ops[aRepetitions / 2 - 1] + ops[aRepetitions / 2]) / 2;
+	r.mean = mean;
+	r.stddev = aRepetitions > 1 ? qmathSqrt(sum_sq / (aRepetitions - 1)) : 0.0;
+	free(ops);
+	if (!AddResult(r))
+		_f_throw_oom;
+
+	auto map = Map::Create();
+	if (!map)
+		_f_throw_oom;
+	if (  !(map->SetItem(_T("Name"), ExprTokenType(aName))
+		&& map->SetItem(_T("Iterations"), r.iterations)
+		&& map->SetItem(_T("Repetitions"), (__int64)r.repetitions)
+		&& map->SetItem(_T("Min"), ExprTokenType(r.min))
+		&& map->SetItem(_T("Median"), ExprTokenType(r.median))
+		&& map->SetItem(_T("Mean"), ExprTokenType(r.mean))
+		&& map->SetItem(_T("Max"), ExprTokenType(r.max))
+		&& map->SetItem(_T("StdDev"), ExprTokenType(r.stddev)))  )
+	{
+		map->Release();
+		_f_throw_oom;
+	}
+	_f_return(map);
+}
+
+
+bool BenchmarkRunner::WriteReport(LPCTSTR aFileName)
+// Writes all results as a single JSON object, with rates in operations per second.
+{
+	TextFile tf;
+	if (!tf.Open(aFileName, TextStream::WRITE, CP_UTF8))
+		return false;
+	tf.Write(_T("{\"version\":"));
+	WriteJsonString(tf, T_AHK_VERSION);
+	tf.Write(_T(",\"exe\":"));
+	WriteJsonString(tf, g_script.mOurEXE);
+	tf.Write(_T(",\"script\":"));
+	WriteJsonString(tf, g_script.mFileSpec);
+	tf.Format(_T(",\"ptr_size\":%d,\"benchmarks\":[\n"), (int)sizeof(void *));
+	for (int i = 0; i < sResultCount; ++i)
+	{
+		auto &r = sResult[i];
+		tf.Write(_T("{\"name\":"));
+		WriteJsonString(tf, r.name);
+		tf.Format(_T(",\"iterations\":%I64d,\"warmup\":%d,\"repetitions\":%d")
+			_T(",\"ops_per_sec\":{\"min\":%.2f,\"median\":%.2f,\"mean\":%.2f,\"max\":%.2f,\"stddev\":%.2f}}%s\n")
+			, r.iterations, r.warmup, r.repetitions
+			, r.min, r.median, r.mean, r.max, r.stddev
+			, i + 1 < sResultCount ? _T(",") : _T(""));
+	}
+	tf.Write(_T("]}\n"));
+	return true;
+}
+
+
+void BenchmarkRunner::Exit()
+{
+	if (!sEnabled)
+		return;
+	sEnabled = false;
+	if (sReportFile)
+		WriteReport(sReportFile);
+	else
+	{
+		TCHAR file[T_MAX_PATH];
+		sntprintf(file, _countof(file), _T("%s.bench.json"), g_script.mFileSpec);
+		WriteReport(file);
+	}
+}
+
+
+BIF_DECL(BIF_Benchmark)
+{
+	if (!BenchmarkRunner::sEnabled)
+		_f_throw(_T("Benchmarking is not enabled."), _T("/Benchmark"));
+	_f_param_string(name, 0);
+	auto callback = ParamIndexToObject(1);
+	if (!callback)
+		_f_throw_param(1, _T("object"));
+	if (!ValidateFunctor(callback, 1, aResultToken))
+		return;
+	// Options: Wn (warm-up repetitions), Rn (measured repetitions), Tn (target time per repetition
+	// in milliseconds) and Nn (fixed iteration count, which skips calibration).
+	int warmup = 2, repetitions = 10, target_time = 100;
+	__int64 iterations = 0;
+	_f_param_string_opt(options, 2);
+	for (LPTSTR cp = options; *cp; ++cp)
+	{
+		switch (ctoupper(*cp))
+		{
+		case 'W': warmup = ATOI(cp + 1); break;
+		case 'R': repetitions = ATOI(cp + 1); break;
+		case 'T': target_time = ATOI(cp + 1); break;
+		case 'N': iterations = ATOI64(cp + 1); break;
+		}
+	}
+	if (warmup < 0 || repetitions < 1 || repetitions > 10000 || target_time < 1 || iterations < 0)
+		_f_throw_param(2);
+	BenchmarkRunner::Run(aResultToken, name, callback, warmup, repetitions, target_time, iterations);
+}
+
+
+
+static int ParseReplayEvent(LPTSTR aText, HookReplayEvent *aEvent)
+// Parses a key name optionally followed by " down" or " up" into one event, or a key name alone
+// into two (down and up).  Wheel events are always single.  Returns the number of events, or 0
+// if aText is invalid.
+{
+	TCHAR name[64];
+	tcslcpy(name, omit_leading_whitespace(aText), _countof(name));
+	int count = 2;
+	bool up = false;
+	LPTSTR space = _tcsrchr(name, ' ');
+	if (space)
+	{
+		if (!_tcsicmp(space + 1, _T("up")))
+			up = true;
+		else if (_tcsicmp(space + 1, _T("down")))
+			return 0;
+		count = 1;
+		*space = '\0';
+	}
+	vk_type vk;
+	sc_type sc;
+	if (!TextToVKandSC(name, vk, sc))
+		return 0;
+	if (!vk)
+		vk = sc_to_vk(sc);
+	if (IsMouseVK(vk))
+	{
+		UINT down_msg, up_msg;
+		DWORD data = 0;
+		switch (vk)
+		{
+		case VK_LBUTTON: down_msg = WM_LBUTTONDOWN; up_msg = WM_LBUTTONUP; break;
+		case VK_RBUTTON: down_msg = WM_RBUTTONDOWN; up_msg = WM_RBUTTONUP; break;
+		case VK_MBUTTON: down_msg = WM_MBUTTONDOWN; up_msg = WM_MBUTTONUP; break;
+		case VK_XBUTTON1:
+		case VK_XBUTTON2:
+			down_msg = WM_XBUTTONDOWN; up_msg = WM_XBUTTONUP;
+			data = MAKELONG(0, vk == VK_XBUTTON1 ? XBUTTON1 : XBUTTON2);
+			break;
+		default: // Wheel.
+			if (up)
+				return 0;
+			down_msg = up_msg = (vk == VK_WHEEL_UP || vk == VK_WHEEL_DOWN) ? WM_MOUSEWHEEL : WM_MOUSEHWHEEL;
+			data = MAKELONG(0, (vk == VK_WHEEL_UP || vk == VK_WHEEL_RIGHT) ? WHEEL_DELTA : -WHEEL_DELTA);
+			count = 1;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			aEvent[i].message = (up || i) ? up_msg : down_msg;
+			aEvent[i].vk = 0;
+			aEvent[i].sc = 0;
+			aEvent[i].mouse_data = data;
+		}
+	}
+	else
+	{
+		if (!sc)
+			sc = vk_to_sc(vk);
+		for (int i = 0; i < count; ++i)
+		{
+			aEvent[i].message = (up || i) ? WM_KEYUP : WM_KEYDOWN;
+			aEvent[i].vk = vk;
+			aEvent[i].sc = sc;
+			aEvent[i].mouse_data = 0;
+		}
+	}
+	return count;
+}
+
+
+BIF_DECL(BIF_HookReplay)
+// HookReplay(Events [, Repeat]): Passes each event to the keyboard or mouse hook as though it was
+// physical input, without actually firing any hotkeys or hotstrings.  Events is an array of key
+// names, each optionally followed by " down" or " up".  The sequence is replayed Repeat times,
+// and the decisions made for the final repetition are returned along with a summary of the
+// time taken by each event, so that changes to the hook can be checked for both correctness
+// and latency.
+{
+	if (!BenchmarkRunner::sEnabled)
+		_f_throw(_T("HookReplay is not enabled."), _T("/Benchmark"));
+	auto events = dynamic_cast<Array *>(ParamIndexToObject(0));
+	if (!events)
+		_f_throw_param(0, _T("Array"));
+	int repeat = ParamIndexIsOmitted(1) ? 1 : ParamIndexToInt(1);
+	if (repeat < 1)
+		_f_throw_param(1);
+
+	int count = 0;
+	auto event = (HookReplayEvent *)malloc((events->Length() * 2 + 1) * sizeof(HookReplayEvent));
+	if (!event)
+		_f_throw_oom;
+	bool need_keybd = false, need_mouse = false;
+	for (index_t i = 0; i < events->Length(); ++i)
+	{
+		ExprTokenType item;
+		TCHAR buf[MAX_NUMBER_SIZE];
+		events->ItemToToken(i, item);
+		LPTSTR text = TokenToString(item, buf);
+		int n = ParseReplayEvent(text, event + count);
+		if (!n)
+		{
+			free(event);
+			_f_throw_value(ERR_INVALID_KEYNAME, text);
+		}
+		if (event[count].message == WM_KEYDOWN || event[count].message == WM_KEYUP)
+			need_keybd = true;
+		else
+			need_mouse = true;
+		count += n;
+	}
+	if (need_keybd && !g_KeybdHook || need_mouse && !g_MouseHook)
+	{
+		free(event);
+		_f_throw(need_keybd && !g_KeybdHook ? _T("The keyboard hook is not installed.") : _T("The mouse hook is not installed."));
+	}
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	double us_per_tick = 1000000.0 / freq.QuadPart;
+	auto time = (double *)malloc(((size_t)count * repeat + 1) * sizeof(double));
+	if (!time)
+	{
+		free(event);
+		_f_throw_oom;
+	}
+	for (int r = 0; r < repeat; ++r)
+	{
+		if (!HookReplay(event, count))
+		{
+			free(event);
+			free(time);
+			_f_throw(_T("The hook thread is not running."));
+		}
+		for (int i = 0; i < count; ++i)
+			time[(size_t)r * count + i] = event[i].ticks * us_per_tick;
+	}
+
+	// Build the result: a Map for each event of the final repetition, and a summary of all repetitions.
+	auto result = Map::Create();
+	auto results = Array::Create();
+	auto histogram = Array::Create();
+	bool ok = result && results && histogram;
+	for (int i = 0; ok && i < count; ++i)
+	{
+		auto &e = event[i];
+		TCHAR desc[64];
+		GetKeyName(e.vk, e.sc, desc, _countof(desc), _T(""));
+		if (!e.vk)
+		{
+			switch (e.message)
+			{
+			case WM_LBUTTONDOWN: case WM_LBUTTONUP: _tcscpy(desc, _T("LButton")); break;
+			case WM_RBUTTONDOWN: case WM_RBUTTONUP: _tcscpy(desc, _T("RButton")); break;
+			case WM_MBUTTONDOWN: case WM_MBUTTONUP: _tcscpy(desc, _T("MButton")); break;
+			case WM_XBUTTONDOWN: case WM_XBUTTONUP: _tcscpy(desc, HIWORD(e.mouse_data) == XBUTTON1 ? _T("XButton1") : _T("XButton2")); break;
+			case WM_MOUSEWHEEL: _tcscpy(desc, (short)HIWORD(e.mouse_data) > 0 ? _T("WheelUp") : _T("WheelDown")); break;
+			case WM_MOUSEHWHEEL: _tcscpy(desc, (short)HIWORD(e.mouse_data) > 0 ? _T("WheelRight") : _T("WheelLeft")); break;
+			}
+		}
+		if (e.message != WM_MOUSEWHEEL && e.message != WM_MOUSEHWHEEL)
+			_tcscat(desc, (e.message == WM_KEYUP || e.message == WM_LBUTTONUP || e.message == WM_RBUTTONUP
+				|| e.message == WM_MBUTTONUP || e.message == WM_XBUTTONUP) ? _T(" up") : _T(" down"));
+		HotkeyIDType hotkey_id = (HotkeyIDType)(e.hotkey_id & HOTKEY_ID_MASK);
+		ExprTokenType t_desc(desc), t_hotkey(_T("")), t_hotstring(_T(""))
+			, t_time(time[(size_t)(repeat - 1) * count + i]);
+		if (hotkey_id < Hotkey::sHotkeyCount)
+			t_hotkey.SetValue(Hotkey::shk[hotkey_id]->mName);
+		if (e.hotstring_id < Hotstring::sHotstringCount)
+			t_hotstring.SetValue(Hotstring::shs[e.hotstring_id]->mName);
+		auto map = Map::Create();
+		ok = map
+			&& map->SetItem(_T("Event"), t_desc)
+			&& map->SetItem(_T("Suppressed"), (__int64)(e.result != 0))
+			&& map->SetItem(_T("Hotkey"), t_hotkey)
+			&& map->SetItem(_T("Hotstring"), t_hotstring)
+			&& map->SetItem(_T("Time"), t_time);
+		if (ok)
+		{
+			ExprTokenType t_map(map);
+			ok = results->Append(t_map);
+		}
+		if (map)
+			map->Release();
+	}
+	size_t total = (size_t)count * repeat;
+	if (ok)
+	{
+		// Histogram[n] is the number of events which took less than 2**(n-1) microseconds
+		// (and at least half that, except for n = 1).
+		__int64 bucket[32] = {0};
+		int bucket_count = 0;
+		double sum = 0;
+		for (size_t i = 0; i < total; ++i)
+		{
+			int b = 0;
+			while (b < 31 && time[i] >= (double)(1 << b))
+				++b;
+			++bucket[b];
+			if (bucket_count <= b)
+				bucket_count = b + 1;
+			sum += time[i];
+		}
+		for (int b = 0; ok && b < bucket_count; ++b)
+			ok = histogram->Append(bucket[b]);
+		qsort(time, total, sizeof(double), [](const void *a, const void *b) {
+			double da = *(double *)a, db = *(double *)b;
+			return da < db ? -1 : da > db ? 1 : 0;
+		});
+		ExprTokenType t_min(total ? time[0] : 0.0), t_median(total ? time[total / 2] : 0.0)
+			, t_mean(total ? sum / total : 0.0), t_max(total ? time[total - 1] : 0.0);
+		ok = ok
+			&& result->SetItem(_T("Events"), results)
+			&& result->SetItem(_T("Histogram"), histogram)
+			&& result->SetItem(_T("Count"), (__int64)total)
+			&& result->SetItem(_T("Min"), t_min)
+			&& result->SetItem(_T("Median"), t_median)
+			&& result->SetItem(_T("Mean"), t_mean)
+			&& result->SetItem(_T("Max"), t_max);
+	}
+	free(event);
+	free(time);
+	if (results)
+		results->Release();
+	if (histogram)
+		histogram->Release();
+	if (!ok)
+	{
+		if (result)
+			result->Release();
+		_f_throw_oom;
+	}
+	_f_return(result);
+}
+
+
+
+// Synthetic windows for SyntheticWindows().  Window n has a handle derived from n, and is titled
+// "Document n - App m", where m (0..63) also determines its class, PID and executable.
+#define SYNTHETIC_HWND_BASE 0x40000000
+#define SYNTHETIC_PID_BASE 100000
+#define SYNTHETIC_APP_COUNT 64
+static int sSyntheticWindowCount = 0;
+
+static int SyntheticWindowIndex(HWND aWnd)
+{
+	UINT_PTR offset = (UINT_PTR)aWnd - SYNTHETIC_HWND_BASE;
+	return (offset & 1) || offset >= (UINT_PTR)sSyntheticWindowCount * 2 ? -1 : (int)(offset / 2);
+}
+
+static BOOL SyntheticEnum(WNDENUMPROC aCallback, LPARAM lParam)
+{
+	for (int i = 0; i < sSyntheticWindowCount; ++i)
+		if (!aCallback((HWND)(UINT_PTR)(SYNTHETIC_HWND_BASE + i * 2), lParam))
+			return FALSE;
+	return TRUE;
+}
+
+static bool SyntheticExists(HWND aWnd) { return SyntheticWindowIndex(aWnd) >= 0; }
+static bool SyntheticIsVisible(HWND aWnd) { return SyntheticWindowIndex(aWnd) % 8 > 0; } // One in eight is hidden.
+
+static int SyntheticGetTitle(HWND aWnd, LPTSTR aBuf, int aBufSize)
+{
+	int i = SyntheticWindowIndex(aWnd);
+	return i < 0 ? 0 : sntprintf(aBuf, aBufSize, _T("Document %i - App %i"), i, i % SYNTHETIC_APP_COUNT);
+}
+
+static int SyntheticGetClass(HWND aWnd, LPTSTR aBuf, int aBufSize)
+{
+	int i = SyntheticWindowIndex(aWnd);
+	return i < 0 ? 0 : sntprintf(aBuf, aBufSize, _T("AppClass%i"), i % SYNTHETIC_APP_COUNT);
+}
+
+static DWORD SyntheticGetPID(HWND aWnd)
+{
+	int i = SyntheticWindowIndex(aWnd);
+	return i < 0 ? 0 : SYNTHETIC_PID_BASE + i % SYNTHETIC_APP_COUNT;
+}
+
+static DWORD SyntheticGetPath(DWORD aPID, LPTSTR aBuf, DWORD aBufSize)
+{
+	if (aPID < SYNTHETIC_PID_BASE || aPID >= SYNTHETIC_PID_BASE + SYNTHETIC_APP_COUNT)
+		return 0;
+	return sntprintf(aBuf, aBufSize, _T("C:\\Synthetic\\app%u.exe"), aPID - SYNTHETIC_PID_BASE);
+}
+
+static WindowSource sSyntheticSource = {
+	SyntheticEnum, SyntheticExists, SyntheticIsVisible, SyntheticGetTitle, SyntheticGetClass
+	, SyntheticGetPID, SyntheticGetPath
+};
+
+
+BIF_DECL(BIF_SyntheticWindows)
+// SyntheticWindows(Count): Replaces the top-level windows seen by window searches on the script's
+// thread, such as by WinExist, WinGetList and ahk_group, with Count synthetic windows, so that the
+// searches can be measured independently of the windows which happen to exist.  Window n (counting
+// from 0) is titled "Document n - App m", where m is n mod 64, and has the class "AppClass<m>" and
+// the executable "C:\Synthetic\app<m>.exe".  One window in eight is hidden.  A Count of 0 restores
+// the real windows.  Searches which don't enumerate windows, such as WinActive and ahk_id, aren't
+// meaningful while synthetic windows are in use.
+{
+	if (!BenchmarkRunner::sEnabled)
+		_f_throw(_T("SyntheticWindows is not enabled."), _T("/Benchmark"));
+	int count = ParamIndexToInt(0);
+	if (count < 0 || count > 0x1000000)
+		_f_throw_param(0);
+	WindowSnapshot::SetSource(count ? &sSyntheticSource : NULL);
+	sSyntheticWindowCount = count;
+	_f_return_empty;
+}
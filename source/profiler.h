@@ -0,0 +1,222 @@
+#pragma once
+
+//
+// AllocProfiler: Opt-in object allocation profiler, enabled by the /ProfileAlloc switch.
+//
+// Objects created by Object::Create, Array::Create and Map::Create are attributed to the line
+// which was executing at the time (g_script.mCurrLine) and to their class, which Object::New
+// updates once the object's base has been set.  ~Object removes each object from the live set,
+// so the objects remaining at exit (after global and static variables are released) are those
+// which were leaked, such as due to circular references.  When disabled, each hook costs only
+// a check of sEnabled.
+//
+
+class AllocProfiler
+{
+	struct Site
+	{
+		Line *line;
+		Object *proto; // A counted reference, so that the class name remains valid for the report.
+		UINT_PTR count, bytes, live;
+	};
+	struct LiveObject
+	{
+		Object *obj;
+		int site;
+	};
+
+	// Sites are stored in the order they were first used, and found via a hash table of indices.
+	static Site *sSite;
+	static int sSiteCount, sSiteCapacity;
+	static int *sSiteHash; // Open addressing; -1 indicates an empty slot.  Capacity is sSiteCapacity * 2.
+
+	// Open addressing with linear probing; a null obj indicates an empty slot.
+	static LiveObject *sLive;
+	static size_t sLiveCount, sLiveCapacity;
+
+	static LPTSTR sReportFile;
+
+	static int FindOrAddSite(Line *aLine, Object *aProto);
+	static bool ExpandSites();
+	static LiveObject *FindLive(Object *aObj);
+	static bool ExpandLive();
+	static void RemoveLive(LiveObject *aEntry);
+
+public:
+	static bool sEnabled;
+
+	static void Enable(LPCTSTR aReportFile);
+	static void Created(Object *aObj, Object *aProto, size_t aBytes);
+	static void SetClass(Object *aObj, Object *aProto);
+	static void Deleted(Object *aObj);
+	static Map *Snapshot();
+	static bool WriteReport(LPCTSTR aFileName);
+	static void Exit();
+
+	static LPTSTR ClassName(Object *aProto);
+};
+
+
+
+#ifdef CONFIG_DEBUGGER
+//
+// SampleProfiler: Opt-in sampling profiler, enabled by the /ProfileSample[=interval] switch.
+//
+// A thread pool timer periodically sets sSampleDue and g_script.mPeekDue, and the sample is then
+// taken by Script::PeekIfDue() on the script's own thread, before the next line executes.  Taking
+// samples only between lines avoids having to suspend the thread while the debugger's call stack
+// might be partially updated.  Each sample is weighted by the time elapsed since the previous one,
+// so time spent within a single long-running line (such as a DllCall or Sleep) is attributed to that
+// line, and the interval affects only the granularity of the results.  Samples are aggregated into
+// a call tree of threads, functions and (as leaf nodes) lines, from which the report derives the
+// self and total time of each function and line.  When disabled, the only cost is a check of
+// sEnabled when each thread starts.
+//
+class SampleProfiler
+{
+	enum NodeType : UCHAR { NT_Thread, NT_Func, NT_Line };
+	struct Node
+	{
+		void *key; // Thread description, Func or Line.
+		LPTSTR name; // Copy of the thread description, or nullptr.
+		int parent; // -1 for a thread at the bottom of the stack.
+		NodeType type;
+		UINT_PTR samples; // Samples where this was the innermost node.
+		__int64 time; // Total weight of those samples, in performance counter ticks.
+	};
+
+	// Nodes are stored in the order they were first used, so each node's parent precedes it.
+	static Node *sNode;
+	static int sNodeCount, sNodeCapacity;
+	static int *sNodeHash; // Open addressing; -1 indicates an empty slot.  Capacity is sNodeCapacity * 2.
+
+	static PTP_TIMER sTimer;
+	static DWORD sInterval;
+	static __int64 sLastSample, sFrequency;
+
+	static int FindOrAddNode(int aParent, void *aKey, NodeType aType);
+	static bool ExpandNodes();
+	static LPCTSTR NodeName(Node &aNode, LPTSTR aBuf, size_t aBufSize);
+	static bool WriteFolded(LPCTSTR aFileName);
+	static bool WriteTable(LPCTSTR aFileName);
+
+public:
+	static bool sEnabled;
+	static volatile bool sSampleDue;
+
+	static void Enable(LPCTSTR aInterval);
+	static void Start();
+	static void ThreadStarted();
+	static void TakeSample();
+	static bool WriteReport(LPCTSTR aFileName);
+	static void Exit();
+};
+#endif
+
+
+
+#ifdef CONFIG_DEBUGGER
+//
+// CallProfiler: Opt-in instrumentation profiler, enabled by the /ProfileCalls switch.
+//
+// DbgStack::Push() and Pop() call Enter() and Leave() for each function call (user-defined or
+// built-in, including methods) and each thread, so every call is counted and timed exactly.
+// Time is measured with QueryPerformanceCounter.  Each function's exclusive time excludes the
+// time spent in the functions it called and in any threads which interrupted it, while its
+// inclusive time counts only the outermost call of each recursive series.  Completed calls are
+// also recorded as events (up to a limit) for export as Chrome trace event JSON, which can be
+// viewed as a timeline by chrome://tracing or Perfetto.  When disabled, each push or pop costs
+// only a check of sEnabled.
+//
+class CallProfiler
+{
+	struct Stat
+	{
+		void *key; // Func or thread description.
+		LPTSTR name; // Copy of the thread description, or nullptr.
+		bool is_thread;
+		int active; // Number of calls currently on the stack, for excluding recursion from inclusive time.
+		UINT_PTR calls;
+		__int64 inclusive, exclusive; // Performance counter ticks.
+	};
+	struct Frame
+	{
+		int stat; // -1 if there was insufficient memory to record this call.
+		__int64 start, children;
+	};
+	struct Event
+	{
+		int stat;
+		__int64 start, duration;
+	};
+
+	// Stats are stored in the order they were first used, and found via a hash table of indices.
+	static Stat *sStat;
+	static int sStatCount, sStatCapacity;
+	static int *sStatHash; // Open addressing; -1 indicates an empty slot.  Capacity is sStatCapacity * 2.
+
+	static Frame *sFrame;
+	static int sFrameCount, sFrameCapacity;
+
+	static Event *sEvent;
+	static size_t sEventCount, sEventCapacity, sEventsDropped;
+
+	static __int64 sFrequency, sStartTime;
+
+	static int FindOrAddStat(void *aKey, bool aIsThread);
+	static bool ExpandStats();
+	static LPCTSTR StatName(Stat &aStat);
+	static bool WriteTrace(LPCTSTR aFileName);
+	static bool WriteTable(LPCTSTR aFileName);
+
+public:
+	static bool sEnabled;
+
+	static void Enable();
+	static void Enter(void *aKey, bool aIsThread);
+	static void Leave();
+	static bool WriteReport(LPCTSTR aFileName);
+	static void Exit();
+};
+#endif
+
+
+
+//
+// BenchmarkRunner: Opt-in benchmark harness, enabled by the /Benchmark[=file] switch.
+//
+// Benchmark(Name, Callback [, Options]) calls Callback(N), which is expected to perform the
+// operation being measured N times.  N is first calibrated so that each call takes at least the
+// target time (100 ms by default), then the callback is called for a number of warm-up repetitions
+// which are discarded and a number of measured repetitions.  The operations per second of the
+// measured repetitions are summarized as min, median, mean, max and standard deviation, which are
+// returned as a Map and written as JSON at exit, so that the results of two builds can be compared.
+//
+class BenchmarkRunner
+{
+	struct Result
+	{
+		LPTSTR name;
+		__int64 iterations; // Per repetition.
+		int warmup, repetitions;
+		double min, median, mean, max, stddev; // Operations per second.
+	};
+
+	static Result *sResult;
+	static int sResultCount, sResultCapacity;
+
+	static LPTSTR sReportFile;
+	static __int64 sFrequency;
+
+	static ResultType Call(IObject *aCallback, __int64 aIterations, __int64 &aTicks);
+	static bool AddResult(Result &aResult);
+
+public:
+	static bool sEnabled;
+
+	static void Enable(LPCTSTR aReportFile);
+	static void Run(ResultToken &aResultToken, LPTSTR aName, IObject *aCallback
+		, int aWarmup, int aRepetitions, int aTargetTime, __int64 aIterations);
+	static bool WriteReport(LPCTSTR aFileName);
+	static void Exit();
+};
@@ -21,6 +21,7 @@ GNU General Public License for more details.
 #include "window.h" // for a lot of things
 #include "application.h" // for MsgSleep()
 #include "TextIO.h"
+#include "profiler.h"
 
 #define NA MAX_FUNCTION_PARAMS
 #define BIFn(name, minp, maxp, bif, ...) {_T(#name), bif, minp, maxp, FID_##name, __VA_ARGS__}
@@ -37,6 +38,10 @@ FuncEntry g_BIF[] =
 	BIFn(ASin, 1, 1, BIF_ASinACos),
 	BIF1(ATan, 1, 1),
 	BIF1(ATan2, 2, 2),
+	BIF1(Benchmark, 2, 3),
+#ifdef CONFIG_DEBUGGER
+	BIF1(CallProfileWrite, 0, 1),
+#endif
 	BIF1(CaretGetPos, 0, 2, {1, 2}),
 	BIFn(Ceil, 1, 1, BIF_FloorCeil),
 	BIF1(Chr, 1, 1),
@@ -65,6 +70,7 @@ FuncEntry g_BIF[] =
 	BIF1(HasBase, 2, 2),
 	BIFn(HasMethod, 1, 3, BIF_GetMethod),
 	BIF1(HasProp, 2, 2),
+	BIF1(HookReplay, 1, 2),
 	BIF1(InStr, 2, 5),
 	BIFi(IsAlnum, 1, 2, BIF_IsTypeish, VAR_TYPE_ALNUM),
 	BIFi(IsAlpha, 1, 2, BIF_IsTypeish, VAR_TYPE_ALPHA),
@@ -88,6 +94,7 @@ FuncEntry g_BIF[] =
 	BIF1(NumGet, 2, 3),
 	BIF1(NumPut, 3, NA),
 	BIFn(ObjAddRef, 1, 1, BIF_ObjAddRefRelease),
+	BIF1(ObjAllocSnapshot, 0, 0),
 	BIF1(ObjBindMethod, 1, NA),
 	BIFn(ObjFromPtr, 1, 1, BIF_ObjPtr),
 	BIFn(ObjFromPtrAddRef, 1, 1, BIF_ObjPtr),
@@ -103,6 +110,7 @@ FuncEntry g_BIF[] =
 	BIFn(ObjSetCapacity, 2, 2, BIF_ObjXXX),
 	BIF1(Ord, 1, 1),
 	BIF1(Random, 0, 2),
+	BIF1(Range, 1, 3),
 	BIFn(RegCreateKey, 0, 1, BIF_Reg),
 	BIFn(RegDelete, 0, 2, BIF_Reg),
 	BIFn(RegDeleteKey, 0, 1, BIF_Reg),
@@ -113,6 +121,9 @@ FuncEntry g_BIF[] =
 	BIF1(Round, 1, 2),
 	BIFn(RTrim, 1, 2, BIF_Trim),
 	BIF1(RunWait, 1, 4, {4}),
+#ifdef CONFIG_DEBUGGER
+	BIF1(SampleProfileWrite, 0, 1),
+#endif
 	BIF1(Sin, 1, 1),
 	BIF1(Sort, 1, 3),
 	BIFn(SoundGetInterface, 1, 3, BIF_Sound),
@@ -134,6 +145,7 @@ FuncEntry g_BIF[] =
 	BIF1(StructFromPtr, 2, 2),
 	BIFn(StrUpper, 1, 1, BIF_StrCase),
 	BIF1(SubStr, 2, 3),
+	BIF1(SyntheticWindows, 1, 1),
 	BIF1(Tan, 1, 1),
 	BIF1(Throw, 0, NA),
 	BIFn(Trim, 1, 2, BIF_Trim),
@@ -325,9 +337,11 @@ Script::Script()
 	, mIsRestart(false), mErrorStdOut(false), mErrorStdOutCP(0)
 #ifndef AUTOHOTKEYSC
 	, mValidateThenExit(false)
+	, mLazyParse(false)
 	, mCmdLineInclude(NULL)
 #endif
 	, mUninterruptedLineCountMax(1000), mUninterruptibleTime(17)
+	, mPeekDue(true), mPeekTimer(NULL), mPeekWait(NULL), mPeekTimerResolution(0), mPeekCheckCount(0), mPeekCount(0), mConstantFoldCount(0), mDeadBranchCount(0)
 	, mCustomIcon(NULL), mCustomIconSmall(NULL) // Normally NULL unless there's a custom tray icon loaded dynamically.
 	, mCustomIconFile(NULL), mIconFrozen(false), mTrayIconTip(NULL) // Allocated on first use.
 	, mCustomIconNumber(0)
@@ -378,6 +392,14 @@ Script::~Script() // Destructor.
 {
 	Hotkey::AllDestruct(); // Unregister hooks and hotkeys.
 
+	if (mPeekWait)
+	{
+		SetThreadpoolWait(mPeekWait, NULL, NULL); // Cancel any pending callback.
+		WaitForThreadpoolWaitCallbacks(mPeekWait, TRUE);
+		CloseThreadpoolWait(mPeekWait);
+		CloseHandle(mPeekTimer);
+	}
+
 	if (mNIC.hWnd) // Tray icon is installed.
 		Shell_NotifyIcon(NIM_DELETE, &mNIC); // Remove it.
 
@@ -948,6 +970,10 @@ ResultType Script::AutoExecSection()
 	// Must be done before InitClasses(), otherwise destroying a Gui in a class constructor
 	// would terminate the script:
 	++g_nThreads;
+#ifdef CONFIG_DEBUGGER
+	if (SampleProfiler::sEnabled)
+		SampleProfiler::Start();
+#endif
 
 	// v1.0.48: Due to switching from SET_UNINTERRUPTIBLE_TIMER to IsInterruptible():
 	// In spite of the comments in IsInterruptible(), periodically have a timer call IsInterruptible() due to
@@ -1296,8 +1322,13 @@ void Script::TerminateApp(ExitReasons aExitReason, int aExitCode)
 
 		ReleaseVarObjects(mVars);
 		ReleaseStaticVarObjects(mFuncs);
+		// Any objects still alive at this point were leaked, such as due to circular references.
+		AllocProfiler::Exit();
 	}
+	BenchmarkRunner::Exit();
 #ifdef CONFIG_DEBUGGER // L34: Exit debugger *after* the above to allow debugging of any invoked __Delete handlers.
+	SampleProfiler::Exit();
+	CallProfiler::Exit();
 	g_Debugger.Exit(aExitReason);
 #endif
 
@@ -1402,6 +1433,7 @@ UINT Script::LoadFromFile(LPCTSTR aFileSpec)
 
 	if (!PreparseCommands(mFirstLine))
 		return LOADING_FAILED; // Error was already displayed by the above calls.
+	RemoveDeadBranches();
 	
 #ifndef AUTOHOTKEYSC
 	if (mValidateThenExit)
@@ -7444,32 +7476,115 @@ ResultType Script::PreparseExpressions(FuncList &aFuncs)
 		if (func.mOuterFunc && func.mOuterFunc->IsAssumeGlobal() && func.mDefaultVarType == VAR_DECLARE_LOCAL)
 			func.mDefaultVarType = VAR_GLOBAL; // Not VAR_DECLARE_GLOBAL, which would prevent referencing of outer vars.
 
+#ifndef AUTOHOTKEYSC
+		if (mLazyParse && !mValidateThenExit && CanDeferPreparse(func))
+		{
+			func.mPreparseState = FUNC_PREPARSE_DEFERRED;
+			continue;
+		}
+#endif
 		g->CurrentFunc = &func;
-		if (!PreparseExpressions(func.mJumpToLine)) // Preparse this function's body.
+		if (!PreparseFuncExpressions(func))
 			return FAIL;
-		// Now that expressions have been preparsed, remove any parameter default expressions
-		// from the normal flow of execution by adjusting the function's mJumpToLine.  (This
-		// wasn't done earlier because the original value is needed above.)
-		if (mLastParamInitializer && func.mMinParams < func.mParamCount)
+		// Nested functions will be preparsed next, due to the fact that they immediately
+		// follow the outer function in aFuncs.
+	}
+	g->CurrentFunc = nullptr;
+	return OK;
+}
+
+
+
+ResultType Script::PreparseFuncExpressions(UserFunc &aFunc)
+// Caller must set g->CurrentFunc to &aFunc.
+{
+	if (!PreparseExpressions(aFunc.mJumpToLine)) // Preparse this function's body.
+		return FAIL;
+	// Now that expressions have been preparsed, remove any parameter default expressions
+	// from the normal flow of execution by adjusting the function's mJumpToLine.  (This
+	// wasn't done earlier because the original value is needed above.)
+	if (mLastParamInitializer && aFunc.mMinParams < aFunc.mParamCount)
+	{
+		for (int i = aFunc.mParamCount; --i >= aFunc.mMinParams; )
 		{
-			for (int i = func.mParamCount; --i >= func.mMinParams; )
+			if (aFunc.mParam[i].default_type == PARAM_DEFAULT_EXPR)
 			{
-				if (func.mParam[i].default_type == PARAM_DEFAULT_EXPR)
-				{
-					func.mJumpToLine = func.mParam[i].default_expr->mNextLine;
-					break;
-				}
+				aFunc.mJumpToLine = aFunc.mParam[i].default_expr->mNextLine;
+				break;
 			}
 		}
-		// Nested functions will be preparsed next, due to the fact that they immediately
-		// follow the outer function in aFuncs.
 	}
-	g->CurrentFunc = nullptr;
 	return OK;
 }
 
 
 
+bool Script::CanDeferPreparse(UserFunc &aFunc)
+// Returns true if preparsing aFunc's body can be deferred until it is first called without
+// affecting how any other part of the script is preparsed.
+{
+	// Nested functions and their outer functions share variables, which must be resolved together
+	// before PreprocessLocalVars() sets up closures.  Assignments in an assume-global function or
+	// to declared globals would affect global variables, and therefore load-time warnings for code
+	// elsewhere in the script.
+	if (aFunc.mOuterFunc || aFunc.IsAssumeGlobal())
+		return false;
+	// A #HotIf expression's function must be preparsed with the rest of the script, since its
+	// criterion is registered (and possibly optimized by PreparseHotkeyIfExpr()) at load time.
+	if (aFunc.mJumpToLine->mActionType == ACT_HOTKEY_IF)
+		return false;
+	for (int i = 0; i < aFunc.mStaticVars.mCount; ++i)
+		if (!aFunc.mStaticVars.mItem[i]->IsLocal())
+			return false;
+	for (Line *line = aFunc.mJumpToLine; line->mActionType != ACT_BLOCK_END || !line->mAttribute; line = line->mNextLine)
+		if (line->mActionType == ACT_BLOCK_BEGIN && line->mAttribute) // Nested function.
+			return false;
+	return true;
+}
+
+
+
+ResultType Script::PreparseDeferredFunc(UserFunc &aFunc)
+// Called by UserFunc::Call() to perform the preparsing which LoadFromFile() deferred.
+// Errors are reported as runtime errors, since the script is already running.
+{
+	if (aFunc.mPreparseState == FUNC_PREPARSE_FAILED)
+		// The error was already reported, or an error dialog allowed another thread to call
+		// aFunc while it is still being preparsed.
+		return RuntimeError(_T("Function failed to load."), aFunc.mName, FAIL);
+	aFunc.mPreparseState = FUNC_PREPARSE_FAILED; // Until it succeeds.
+
+	auto prev_func = g->CurrentFunc;
+	auto prev_line = mCurrLine;
+	g->CurrentFunc = &aFunc;
+
+	// Do the same work as LoadFromFile(), but only for this function's body.  CanDeferPreparse()
+	// ensured that the body contains no nested functions and can't create or assign globals.
+	Line *line = aFunc.mJumpToLine; // Must be retrieved before PreparseFuncExpressions() adjusts it.
+	ResultType result = PreparseFuncExpressions(aFunc);
+	for ( ; result && (line->mActionType != ACT_BLOCK_END || !line->mAttribute); line = line->mNextLine)
+	{
+		mCurrLine = line;
+		if (!PreparseVarRefs(line)
+			|| line->mActionType == ACT_CATCH && !PreparseCatchClass(line))
+			result = FAIL;
+		for (int i = 0; result && i < line->mArgc; ++i)
+			if (line->mArg[i].postfix && !line->FinalizeExpression(line->mArg[i]))
+				result = FAIL;
+		if (line->mActionType == ACT_BLOCK_END && line->mParentLine->mPrevLine
+			&& line->mParentLine->mPrevLine->mActionType == ACT_SWITCH)
+			PreparseSwitchTable(line->mParentLine->mPrevLine);
+	}
+
+	g->CurrentFunc = prev_func;
+	mCurrLine = prev_line;
+	if (result)
+		aFunc.mPreparseState = FUNC_PREPARSED;
+	return result;
+}
+
+
+
 Line *Script::PreparseCommands(Line *aStartingLine)
 // Preparse any commands which might rely on blocks having been fully preparsed,
 // such as any command which has a jump target (label).
@@ -7533,6 +7648,10 @@ Line *Script::PreparseCommands(Line *aStartingLine)
 					return block_begin->PreparseError(_T("Unexpected function"));
 				}
 			}
+			else if (line->mParentLine->mPrevLine && line->mParentLine->mPrevLine->mActionType == ACT_SWITCH
+				&& !(g->CurrentFunc && g->CurrentFunc->mPreparseState == FUNC_PREPARSE_DEFERRED)) // PreparseDeferredFunc() will do this.
+				// All of this Switch's case expressions have been finalized by this point.
+				PreparseSwitchTable(line->mParentLine->mPrevLine);
 			break;
 		case ACT_BREAK:
 		case ACT_CONTINUE:
@@ -7617,6 +7736,8 @@ Line *Script::PreparseCommands(Line *aStartingLine)
 			break;
 
 		case ACT_CATCH:
+			if (g->CurrentFunc && g->CurrentFunc->mPreparseState == FUNC_PREPARSE_DEFERRED)
+				break; // PreparseDeferredFunc() will call PreparseCatchClass() after PreparseCatchVar().
 			if (!PreparseCatchClass(line))
 				return nullptr;
 			break;
@@ -7666,6 +7787,145 @@ Line *Script::PreparseCommands(Line *aStartingLine)
 
 
 
+void Script::PreparseSwitchTable(Line *aLine)
+// Builds a SwitchCaseTable for aLine (a Switch) if it has a value and enough cases, and every case
+// value is a constant string or integer.  Since constants have no side-effects, the order in which
+// they are compared doesn't matter, except that the first of any duplicates must take precedence.
+{
+	if (!aLine->mArgc) // Each case is evaluated as a condition.
+		return;
+	int count = 0;
+	Line *default_case = nullptr;
+	for (Line *case_line = aLine->mNextLine->mNextLine; case_line && case_line->mActionType == ACT_CASE; case_line = case_line->mRelatedLine)
+	{
+		if (!case_line->mArgc)
+		{
+			default_case = case_line;
+			continue;
+		}
+		for (int i = 0; i < case_line->mArgc; ++i)
+		{
+			ExprTokenType *postfix = case_line->mArg[i].postfix;
+			if (!postfix || postfix[1].symbol != SYM_INVALID // Not a single operand.
+				|| postfix->symbol != SYM_STRING && postfix->symbol != SYM_INTEGER) // Not a constant, or a float/object.
+				return;
+		}
+		count += case_line->mArgc;
+	}
+	if (count < SWITCH_TABLE_MIN_CASES)
+		return;
+
+	size_t capacity = 16;
+	while (capacity < (size_t)count * 2) // Keep each index at most half full.
+		capacity *= 2;
+	bool need_insensitive = aLine->mArgc > 1; // Only the CaseSense parameter permits case-insensitive comparison.
+	auto table = SimpleHeap::Alloc<SwitchCaseTable>();
+	table->entry = SimpleHeap::Alloc<SwitchCaseTable::Entry>(count);
+	table->int_index = SimpleHeap::Alloc<int>(capacity * (need_insensitive ? 3 : 2));
+	table->sensitive_index = table->int_index + capacity;
+	table->insensitive_index = need_insensitive ? table->sensitive_index + capacity : nullptr;
+	table->index_mask = capacity - 1;
+	table->default_case = default_case;
+	table->has_numeric_string = false;
+	memset(table->int_index, -1, capacity * (need_insensitive ? 3 : 2) * sizeof(int));
+
+	int e = 0;
+	for (Line *case_line = aLine->mNextLine->mNextLine; case_line && case_line->mActionType == ACT_CASE; case_line = case_line->mRelatedLine)
+	{
+		for (int i = 0; i < case_line->mArgc; ++i, ++e)
+		{
+			ExprTokenType &value = *case_line->mArg[i].postfix;
+			auto &entry = table->entry[e];
+			entry.case_line = case_line;
+			entry.is_int = value.symbol == SYM_INTEGER;
+			if (entry.is_int)
+			{
+				TCHAR buf[MAX_INTEGER_SIZE];
+				entry.value = value.value_int64;
+				entry.str = SimpleHeap::Alloc(ITOA64(value.value_int64, buf));
+				int *slot = table->IntSlot(entry.value);
+				if (*slot < 0) // Not a duplicate.
+					*slot = e;
+			}
+			else
+			{
+				entry.value = 0;
+				entry.str = value.marker;
+				if (IsNumeric(value.marker, TRUE, FALSE, TRUE))
+					table->has_numeric_string = true;
+			}
+			// Integers are also indexed as strings, for when CaseSense is specified.
+			int *slot = table->StringSlot(entry.str, false);
+			if (*slot < 0)
+				*slot = e;
+			if (need_insensitive && *(slot = table->StringSlot(entry.str, true)) < 0)
+				*slot = e;
+		}
+	}
+	aLine->mAttribute = table;
+}
+
+
+
+void Script::RemoveDeadBranches()
+// Removes each If statement whose condition is a constant (possibly as a result of FoldConstants),
+// along with its body if the condition is false.  This is limited to an If without Else which is
+// directly within a block or at the top level, so that no other line's body needs to be adjusted,
+// and to statements which can't be reached by Goto except from the top.  As with Static, lines
+// which refer to the removed lines are updated to skip them; other pointers to removed lines are
+// harmless, since the removed lines retain their own links into the main list.
+{
+	for (Line *line = mFirstLine, *next_line; line; line = next_line)
+	{
+		next_line = line->mNextLine;
+		switch (line->mActionType)
+		{ // Establish context for IsLabelTarget:
+		case ACT_BLOCK_BEGIN: if (line->mAttribute) g->CurrentFunc = (UserFunc *)line->mAttribute; continue;
+		case ACT_BLOCK_END: if (line->mAttribute) g->CurrentFunc = g->CurrentFunc->mOuterFunc; continue;
+		case ACT_IF: break;
+		default: continue;
+		}
+		if (!line->mPrevLine
+			|| line->mParentLine && line->mParentLine->mActionType != ACT_BLOCK_BEGIN
+			|| line->mRelatedLine->mActionType == ACT_ELSE)
+			continue;
+		ArgStruct &arg = line->mArg[0];
+		ExprTokenType *postfix = arg.postfix;
+		if (!postfix || arg.type != ARG_TYPE_NORMAL || postfix[1].symbol != SYM_INVALID
+			|| postfix->symbol != SYM_STRING && postfix->symbol != SYM_INTEGER && postfix->symbol != SYM_FLOAT)
+			continue;
+		TCHAR number_buf[MAX_NUMBER_SIZE];
+		bool condition = ResultToBOOL(TokenToString(*postfix, number_buf)); // Same as EvaluateCondition().
+		Line *body = line->mNextLine, *after = line->mRelatedLine;
+		if (IsLabelTarget(line))
+			continue;
+		if (!condition)
+		{
+			Line *body_line = body;
+			for ( ; body_line != after; body_line = body_line->mNextLine)
+				if (IsLabelTarget(body_line) // Reachable via Goto.
+					|| body_line->mActionType == ACT_BLOCK_BEGIN && body_line->mAttribute) // Function body.
+					break;
+			if (body_line != after)
+				continue;
+		}
+		Line *new_next = condition ? body : after;
+		if (g->CurrentFunc && g->CurrentFunc->mJumpToLine == line)
+			g->CurrentFunc->mJumpToLine = new_next;
+		for (Line *parent = line->mPrevLine->mParentLine; parent && parent->mRelatedLine == line; parent = parent->mParentLine)
+			parent->mRelatedLine = new_next;
+		if (condition)
+			body->mParentLine = line->mParentLine;
+		line->mPrevLine->mNextLine = new_next;
+		new_next->mPrevLine = line->mPrevLine;
+		next_line = new_next;
+		++mDeadBranchCount;
+	}
+	g->CurrentFunc = nullptr;
+}
+
+
+
 ResultType Script::PreparseCatchVar(Line *aLine)
 {
 	if (!aLine->mArgc)
@@ -9507,6 +9767,9 @@ end_of_infix_to_postfix:
 	aArg.postfix[postfix_count].symbol = SYM_INVALID;  // Special item to mark the end of the array.
 	aArg.max_stack = max_stack;
 	aArg.max_alloc = max_alloc;
+#ifdef CONFIG_EXPR_ALLOC_STATS
+	ZeroMemory(&aArg.stats, sizeof(aArg.stats));
+#endif
 
 	return OK;
 }
@@ -9675,10 +9938,389 @@ ResultType Line::FinalizeExpression(ArgStruct &aArg)
 			g_script.WarnUnassignedVar(this_postfix->var, this);
 	}
 
+	FoldConstants(aArg);
+
 	return OK;
 }
 
 
+
+static bool FoldUnaryOperator(ExprTokenType &aOp, ExprTokenType &aRight)
+// Evaluates a unary operator whose operand is a literal, the same as ExpandExpression() would.
+// Returns false if the operation would throw or isn't supported.
+{
+	switch (aOp.symbol)
+	{
+	case SYM_LOWNOT:
+	case SYM_HIGHNOT:
+		aOp.SetValue(!TokenToBOOL(aRight));
+		return true;
+	case SYM_NEGATIVE:
+		if (aRight.symbol == SYM_INTEGER)
+			aOp.SetValue(-aRight.value_int64);
+		else if (aRight.symbol == SYM_FLOAT)
+			aOp.SetValue(-aRight.value_double);
+		else // Numeric strings are left to ExpandExpression().
+			return false;
+		return true;
+	case SYM_POSITIVE:
+		if (aRight.symbol == SYM_STRING)
+			return false;
+		aOp.CopyValueFrom(aRight);
+		return true;
+	case SYM_BITNOT:
+		if (aRight.symbol != SYM_INTEGER)
+			return false;
+		aOp.SetValue(~aRight.value_int64);
+		return true;
+	}
+	return false;
+}
+
+
+
+static bool FoldBinaryOperator(ExprTokenType &aOp, ExprTokenType &aLeft, ExprTokenType &aRight)
+// Evaluates a binary operator whose operands are literals, the same as ExpandExpression() would.
+// Returns false if the operation would throw or isn't supported.
+{
+	if (aOp.symbol == SYM_CONCAT)
+	{
+		TCHAR left_buf[MAX_NUMBER_SIZE], right_buf[MAX_NUMBER_SIZE];
+		size_t left_length, right_length;
+		LPTSTR left_string = TokenToString(aLeft, left_buf, &left_length);
+		LPTSTR right_string = TokenToString(aRight, right_buf, &right_length);
+		if (left_length + right_length > 4096) // Avoid wasting memory on intermediate results of long chains.
+			return false;
+		LPTSTR result = SimpleHeap::Alloc<TCHAR>(left_length + right_length + 1);
+		tmemcpy(result, left_string, left_length);
+		tmemcpy(result + left_length, right_string, right_length + 1); // +1 to include its zero terminator.
+		aOp.SetValue(result, left_length + right_length);
+		return true;
+	}
+	if (aLeft.symbol == SYM_STRING || aRight.symbol == SYM_STRING) // String comparison or numeric strings.
+		return false;
+	if (aLeft.symbol == SYM_INTEGER && aRight.symbol == SYM_INTEGER && aOp.symbol != SYM_DIVIDE)
+	{
+		__int64 left = aLeft.value_int64, right = aRight.value_int64, result;
+		switch (aOp.symbol)
+		{
+		case SYM_ADD:			result = left + right; break;
+		case SYM_SUBTRACT:		result = left - right; break;
+		case SYM_MULTIPLY:		result = left * right; break;
+		case SYM_EQUALCASE:
+		case SYM_EQUAL:			result = left == right; break;
+		case SYM_NOTEQUALCASE:
+		case SYM_NOTEQUAL:		result = left != right; break;
+		case SYM_GT:			result = left > right; break;
+		case SYM_LT:			result = left < right; break;
+		case SYM_GTOE:			result = left >= right; break;
+		case SYM_LTOE:			result = left <= right; break;
+		case SYM_BITAND:		result = left & right; break;
+		case SYM_BITOR:			result = left | right; break;
+		case SYM_BITXOR:		result = left ^ right; break;
+		case SYM_BITSHIFTLEFT:
+		case SYM_BITSHIFTRIGHT:
+		case SYM_BITSHIFTRIGHT_LOGICAL:
+			if (right < 0 || right > 63)
+				return false;
+			if (aOp.symbol == SYM_BITSHIFTRIGHT_LOGICAL)
+				result = (unsigned __int64)left >> right;
+			else
+				result = aOp.symbol == SYM_BITSHIFTLEFT ? left << right : left >> right;
+			break;
+		case SYM_INTEGERDIVIDE:
+			if (right == 0 || right == -1 && left == _I64_MIN) // The latter would raise an exception at load time rather than run time.
+				return false;
+			result = left / right;
+			break;
+		case SYM_POWER:
+			if (right < 0 || left == 0 && right == 0) // Float result or error.
+				return false;
+			result = pow_ll(left, right);
+			break;
+		default:
+			return false;
+		}
+		aOp.SetValue(result);
+		return true;
+	}
+	double left = aLeft.symbol == SYM_INTEGER ? (double)aLeft.value_int64 : aLeft.value_double;
+	double right = aRight.symbol == SYM_INTEGER ? (double)aRight.value_int64 : aRight.value_double;
+	switch (aOp.symbol)
+	{
+	case SYM_ADD:			aOp.SetValue(left + right); break;
+	case SYM_SUBTRACT:		aOp.SetValue(left - right); break;
+	case SYM_MULTIPLY:		aOp.SetValue(left * right); break;
+	case SYM_DIVIDE:
+		if (right == 0.0)
+			return false;
+		aOp.SetValue(left / right);
+		break;
+	case SYM_EQUALCASE:
+	case SYM_EQUAL:			aOp.SetValue(left == right); break;
+	case SYM_NOTEQUALCASE:
+	case SYM_NOTEQUAL:		aOp.SetValue(left != right); break;
+	case SYM_GT:			aOp.SetValue(left > right); break;
+	case SYM_LT:			aOp.SetValue(left < right); break;
+	case SYM_GTOE:			aOp.SetValue(left >= right); break;
+	case SYM_LTOE:			aOp.SetValue(left <= right); break;
+	default: // Float power, or an integer operator with a float operand (an error).
+		return false;
+	}
+	return true;
+}
+
+
+
+static bool FoldCall(ExprTokenType &aOp, BuiltInFunc *aFunc, ExprTokenType &aParam)
+// Evaluates a call to a built-in function which has no side-effects and whose sole parameter is
+// a literal, the same as the function itself would.  Returns false if the call would throw or the
+// function isn't supported.
+{
+	if (aFunc->mBIF == &BIF_StrLen)
+	{
+		TCHAR number_buf[MAX_NUMBER_SIZE];
+		size_t length;
+		TokenToString(aParam, number_buf, &length);
+		aOp.SetValue((__int64)length);
+		return true;
+	}
+	if (aFunc->mBIF == &BIF_Ord)
+	{
+		if (aParam.symbol != SYM_STRING)
+			return false;
+		LPTSTR cp = aParam.marker;
+#ifdef UNICODE
+		if (IS_SURROGATE_PAIR(cp[0], cp[1]))
+			aOp.SetValue((__int64)(((cp[0] - 0xd800) << 10) + (cp[1] - 0xdc00) + 0x10000));
+		else
+#endif
+			aOp.SetValue((__int64)(TBYTE)*cp);
+		return true;
+	}
+	if (aFunc->mBIF == &BIF_Chr)
+	{
+		// Chr(0) is excluded because its result contains a binary zero.
+		if (aParam.symbol != SYM_INTEGER || aParam.value_int64 < 1 || aParam.value_int64 > UorA(0x10FFFF, UCHAR_MAX))
+			return false;
+		int code = (int)aParam.value_int64;
+		TCHAR buf[3];
+		size_t length = 1;
+#ifdef UNICODE
+		if (code >= 0x10000)
+		{
+			code -= 0x10000;
+			buf[0] = 0xd800 + ((code >> 10) & 0x3ff);
+			buf[1] = 0xdc00 + ( code        & 0x3ff);
+			length = 2;
+		}
+		else
+#endif
+			buf[0] = (TCHAR)code;
+		buf[length] = '\0';
+		aOp.SetValue(SimpleHeap::Alloc(buf, length), length);
+		return true;
+	}
+	return false;
+}
+
+
+
+void Line::FoldConstants(ArgStruct &aArg)
+// Replaces each operation whose operands are all literals with its result, where the operation has
+// no side-effects and can't throw.  Short-circuit operators with a literal condition are reduced to
+// whichever branch would be evaluated.  This relies on FinalizeExpression() having already verified
+// that the stack is balanced, and mirrors its simulation of the stack.  Each stack item records the
+// index of the token which produced it, and whether the item is only that token, i.e. it is not the
+// result of a short-circuit operator which might instead come from the left branch.
+{
+	ExprTokenType *postfix = aArg.postfix;
+	int count = 0;
+	while (postfix[count].symbol != SYM_INVALID)
+		++count;
+	if (count < 2)
+		return;
+
+	struct StackItem { int index; bool single; };
+	auto stack = (StackItem *)_alloca(aArg.max_stack * sizeof(StackItem));
+	auto removed = (bool *)_alloca(count * sizeof(bool));
+	auto target_count = (int *)_alloca(count * sizeof(int)); // Number of circuit_tokens which point to each token.
+	int stack_count = 0, fold_count = 0, i;
+	for (i = 0; i < count; ++i)
+		removed[i] = false, target_count[i] = 0;
+	for (i = 0; i < count; ++i)
+		if (SYM_USES_CIRCUIT_TOKEN(postfix[i].symbol))
+			++target_count[postfix[i].circuit_token - postfix];
+
+#define IS_LITERAL(item) ((item).single && (postfix[(item).index].symbol == SYM_STRING \
+	|| postfix[(item).index].symbol == SYM_INTEGER || postfix[(item).index].symbol == SYM_FLOAT))
+
+	for (i = 0; i < count; ++i)
+	{
+		if (removed[i])
+			continue;
+		ExprTokenType &this_postfix = postfix[i];
+		auto postfix_symbol = this_postfix.symbol;
+		bool single = false; // Set default: the result depends on other tokens.
+		if (IS_OPERAND(postfix_symbol))
+		{
+			if (postfix_symbol == SYM_DYNAMIC)
+				--stack_count;
+			else
+				single = true;
+		}
+		else if (IS_POSTFIX_OPERATOR(postfix_symbol) || IS_PREFIX_OPERATOR(postfix_symbol))
+		{
+			auto &right = stack[--stack_count];
+			if (IS_LITERAL(right) && FoldUnaryOperator(this_postfix, postfix[right.index]))
+			{
+				removed[right.index] = true;
+				single = true;
+				++fold_count;
+			}
+		}
+		else if (SYM_USES_CIRCUIT_TOKEN(postfix_symbol))
+		{
+			if (postfix_symbol == SYM_OR_MAYBE
+				&& this_postfix.circuit_token->symbol == SYM_ASSIGN
+				&& *this_postfix.circuit_token->error_reporting_marker == '?')
+				continue; // See FinalizeExpression().
+			auto left = stack[--stack_count];
+			if (!IS_LITERAL(left) || postfix_symbol == SYM_IFF_ELSE)
+				continue;
+			int target = int(this_postfix.circuit_token - postfix);
+			bool left_is_true = TokenToBOOL(postfix[left.index]);
+			if (postfix_symbol == SYM_IFF_THEN)
+			{
+				// The THEN branch ends at the SYM_IFF_ELSE (target), and the ELSE branch ends at its circuit_token.
+				int else_end = int(postfix[target].circuit_token - postfix);
+				if (left_is_true && target_count[else_end] > 1) // Some other operator's result also ends here.
+					continue;
+				removed[left.index] = removed[i] = true;
+				if (left_is_true)
+				{
+					for (int j = target; j <= else_end; ++j)
+						removed[j] = true;
+				}
+				else
+				{
+					for (int j = i + 1; j <= target; ++j)
+						removed[j] = true;
+					--target_count[else_end];
+					i = target; // Continue at the ELSE branch.
+				}
+				++fold_count;
+				continue;
+			}
+			if (postfix_symbol == SYM_OR_MAYBE // A literal is never unset.
+				|| left_is_true == (postfix_symbol == SYM_OR))
+			{
+				// The right branch would never be evaluated, and the left operand is the result.
+				if (target_count[target] > 1)
+					continue;
+				for (int j = i; j <= target; ++j)
+					removed[j] = true;
+				stack[stack_count++] = left;
+				i = target;
+			}
+			else
+			{
+				// The right branch is always evaluated and its value is the result.
+				removed[left.index] = removed[i] = true;
+				--target_count[target];
+			}
+			++fold_count;
+			continue;
+		}
+		else if (postfix_symbol == SYM_COMMA)
+		{
+			auto left = stack[--stack_count];
+			if (IS_LITERAL(left))
+			{
+				removed[left.index] = removed[i] = true;
+				++fold_count;
+			}
+			continue;
+		}
+		else if (postfix_symbol != SYM_FUNC)
+		{
+			auto right = stack[--stack_count];
+			auto &left = stack[--stack_count];
+			if (IS_LITERAL(left) && IS_LITERAL(right)
+				&& FoldBinaryOperator(this_postfix, postfix[left.index], postfix[right.index]))
+			{
+				removed[left.index] = removed[right.index] = true;
+				single = true;
+				++fold_count;
+			}
+		}
+		else // SYM_FUNC
+		{
+			auto callsite = this_postfix.callsite;
+			int prev_stack_count = stack_count;
+			int param_count = callsite->param_count;
+			stack_count -= param_count;
+			auto param = stack + stack_count;
+			bool call_call = !callsite->member && IT_CALL == (callsite->flags & IT_BITMASK);
+			if (callsite->flags & EIF_STACK_MEMBER)
+			{
+				--stack_count;
+				call_call = false;
+			}
+			StackItem func_op = { -1, false };
+			if (!callsite->func)
+				func_op = stack[--stack_count];
+			if (callsite->flags & EIF_LEAVE_PARAMS)
+			{
+				// These items remain on the stack for a later operation, so must not be removed.
+				for (int j = stack_count; j < prev_stack_count; ++j)
+					stack[j].single = false;
+				stack_count = prev_stack_count;
+			}
+			else if (call_call && param_count == 1 && !callsite->is_variadic()
+				&& func_op.single && postfix[func_op.index].symbol == SYM_OBJECT && IS_LITERAL(*param))
+			{
+				auto bif = dynamic_cast<BuiltInFunc *>(postfix[func_op.index].object);
+				if (bif && FoldCall(this_postfix, bif, postfix[param->index]))
+				{
+					removed[func_op.index] = removed[param->index] = true;
+					single = true;
+					++fold_count;
+				}
+			}
+		}
+		stack[stack_count].index = i;
+		stack[stack_count].single = single && !target_count[i]; // Not also the result of a short-circuit operator.
+		++stack_count;
+	}
+#undef IS_LITERAL
+
+	if (!fold_count)
+		return;
+	g_script.mConstantFoldCount += fold_count;
+
+	// Remove the operands and branches which were folded, and adjust each circuit_token accordingly.
+	// Any token which is still the target of a circuit_token was not removed.
+	auto new_index = target_count; // Reuse this array.
+	int new_count = 0;
+	for (i = 0; i < count; ++i)
+		new_index[i] = removed[i] ? -1 : new_count++;
+	for (i = 0; i < count; ++i)
+	{
+		if (removed[i])
+			continue;
+		ExprTokenType &token = postfix[new_index[i]];
+		token.CopyExprFrom(postfix[i]);
+		if (SYM_USES_CIRCUIT_TOKEN(token.symbol))
+		{
+			ASSERT(new_index[postfix[i].circuit_token - postfix] >= 0);
+			token.circuit_token = postfix + new_index[postfix[i].circuit_token - postfix];
+		}
+	}
+	postfix[new_count].symbol = SYM_INVALID;
+}
+
+
 //-------------------------------------------------------------------------------------
 
 // Init static vars:
@@ -9733,6 +10375,82 @@ void Line::FreeDerefBufIfLarge()
 
 
 
+static VOID CALLBACK PeekTimerCallback(PTP_CALLBACK_INSTANCE aInstance, PVOID aContext, PTP_WAIT aWait, TP_WAIT_RESULT aWaitResult)
+{
+	g_script.mPeekDue = true;
+}
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION // Requires a newer SDK.
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+void Script::CreatePeekTimer()
+// Creates mPeekTimer and mPeekWait, and sets mPeekTimerResolution.
+{
+	// Ordinary timers expire only on ticks of the system timer, typically every 15.6 ms, which
+	// would make the default PeekFrequency of 5 ms about three times longer.  A high resolution
+	// timer (Windows 10 1803+) avoids that without raising the timer resolution of the whole
+	// system, as timeBeginPeriod() would.
+	mPeekTimerResolution = 0;
+	if (  !(mPeekTimer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS))  )
+	{
+		mPeekTimer = CreateWaitableTimerEx(NULL, NULL, 0, TIMER_ALL_ACCESS);
+		DWORD adjustment, increment; // The increment is in 100-nanosecond units.
+		BOOL adjustment_disabled;
+		mPeekTimerResolution = GetSystemTimeAdjustment(&adjustment, &increment, &adjustment_disabled)
+			? (increment + 9999) / 10000 : 16;
+	}
+	if (mPeekTimer && !(mPeekWait = CreateThreadpoolWait(PeekTimerCallback, NULL, NULL)))
+	{
+		CloseHandle(mPeekTimer);
+		mPeekTimer = NULL;
+	}
+	if (!mPeekTimer)
+		mPeekTimerResolution = UINT_MAX; // Don't try again.
+}
+
+void Script::PeekIfDue()
+// Called by ExecUntil() when mPeekDue is set.  This does what LONG_OPERATION_UPDATE does,
+// then arms mPeekTimer so that mPeekDue is set again when the next check would be due.  Because the
+// timer is one-shot and only armed from here, it doesn't fire repeatedly while the script
+// is idle.  mPeekDue must also be set directly wherever g->PeekFrequency changes or another
+// thread becomes current, since the timer may be armed for a different interval.
+{
+	mPeekDue = false; // Reset this first so that a timer callback occurring below isn't missed.
+	++mPeekCheckCount;
+#ifdef CONFIG_DEBUGGER
+	if (SampleProfiler::sSampleDue)
+		SampleProfiler::TakeSample();
+#endif
+	DWORD tick_now = GetTickCount();
+	DWORD elapsed = tick_now - mLastPeekTime;
+	if (elapsed > g->PeekFrequency)
+	{
+		++mPeekCount;
+		MSG msg;
+		if (PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE))
+			MsgSleep(-1); // This might launch new threads, which could reenter this function.
+		mLastPeekTime = GetTickCount();
+		elapsed = 0;
+	}
+	if (!mPeekWait && mPeekTimerResolution != UINT_MAX)
+		CreatePeekTimer();
+	if (g->PeekFrequency < mPeekTimerResolution)
+	{
+		// The timer couldn't be created, or can't expire soon enough for this PeekFrequency,
+		// so fall back to checking the tick count on every line.
+		mPeekDue = true;
+		return;
+	}
+	// Due time is relative (negative) and in 100-nanosecond units.  +1 because the check above
+	// requires elapsed to be greater than PeekFrequency.
+	LARGE_INTEGER due;
+	due.QuadPart = -((LONGLONG)(g->PeekFrequency - elapsed + 1) * 10000);
+	SetWaitableTimer(mPeekTimer, &due, 0, NULL, NULL, FALSE);
+	SetThreadpoolWait(mPeekWait, mPeekTimer, NULL);
+}
+
+
 ResultType Line::ExecUntil(ExecUntilMode aMode, ResultToken *aResultToken, Line **apJumpToLine)
 // Start executing at "this" line, stop when aMode indicates.
 // RECURSIVE: Handles all lines that involve flow-control.
@@ -9760,7 +10478,6 @@ ResultType Line::ExecUntil(ExecUntilMode aMode, ResultToken *aResultToken, Line
 	Line *jump_to_line; // Don't use *apJumpToLine because it might not exist.
 	Label *jump_to_label;  // For use with Goto.
 	ResultType if_condition, result;
-	LONG_OPERATION_INIT
 	global_struct &g = *::g; // Reduces code size and may improve performance. Eclipsing ::g with local g makes compiler remind/enforce the use of the right one.
 
 	for (Line *line = this; line != NULL;)
@@ -9786,7 +10503,10 @@ ResultType Line::ExecUntil(ExecUntilMode aMode, ResultToken *aResultToken, Line
 		// 4) Timed subroutines are run as consistently as possible (to help with this, a check
 		//    similar to the below is also done for single commmands that take a long time, such
 		//    as Download, FileSetAttrib, etc.
-		LONG_OPERATION_UPDATE
+		// Rather than calling GetTickCount() for every line, a thread pool timer sets mPeekDue
+		// when the next check is due.  See PeekIfDue() for details.
+		if (g_script.mPeekDue)
+			g_script.PeekIfDue();
 
 		// If interruptions are currently forbidden, it's our responsibility to check if the number
 		// of lines that have been run since this quasi-thread started now indicate that
@@ -9811,6 +10531,7 @@ ResultType Line::ExecUntil(ExecUntilMode aMode, ResultToken *aResultToken, Line
 			{
 				g.AllowThreadToBeInterrupted = true;
 				g.PeekFrequency = DEFAULT_PEEK_FREQUENCY;
+				g_script.mPeekDue = true; // Re-arm the peek timer for the new frequency.
 			}
 		}
 
@@ -10481,8 +11202,13 @@ ResultType Line::ExecUntil(ExecUntilMode aMode, ResultToken *aResultToken, Line
 					our_deref_buf = NULL;
 					our_deref_buf_size = 0;
 				}
-				// For each CASE:
-				for (Line *case_line = line->mNextLine->mNextLine; case_line && case_line->mActionType == ACT_CASE; case_line = case_line->mRelatedLine)
+				// If the case values are all constants, use the table built by PreparseSwitchTable().
+				auto table = (SwitchCaseTable *)line->mAttribute;
+				Line *found_case;
+				if (table && table->Find(switch_value, switch_is_numeric, string_case_sense, found_case))
+					line_to_execute = found_case ? found_case->mNextLine : NULL;
+				// Otherwise, for each CASE:
+				else for (Line *case_line = line->mNextLine->mNextLine; case_line && case_line->mActionType == ACT_CASE; case_line = case_line->mRelatedLine)
 				{
 					int arg, arg_count = case_line->mArgc;
 					if (!arg_count) // The default case.
@@ -10783,6 +11509,78 @@ ResultType Line::EvaluateSwitchCase(ExprTokenType &aSwitch, SymbolType aSwitchIs
 
 
 
+bool SwitchCaseTable::Find(ExprTokenType &aSwitch, SymbolType aSwitchIsNumeric, StringCaseSenseType aStringCaseSense, Line *&aCaseLine)
+// Finds the case which EvaluateSwitchCase() would match first, or the default case.
+// Returns false if the caller must compare each case instead.
+{
+	int found = -1;
+	if (aStringCaseSense == SCS_INVALID)
+	{
+		switch (aSwitch.symbol)
+		{
+		case SYM_OBJECT:
+			break; // An object can't be equal to any constant.
+		case SYM_INTEGER:
+			if (has_numeric_string)
+				return false;
+			// Since the non-numeric strings can't match, only the integer values need to be checked.
+			found = *IntSlot(aSwitch.value_int64);
+			break;
+		case SYM_STRING:
+			if (!aSwitchIsNumeric)
+			{
+				// String comparison is used for every case, and the integers can't match.
+				found = *StringSlot(aSwitch.marker, false);
+				break;
+			}
+			if (aSwitchIsNumeric != PURE_INTEGER || has_numeric_string)
+				return false;
+			found = *IntSlot(TokenToInt64(aSwitch));
+			break;
+		default: // SYM_FLOAT, which would require comparing each integer as a double.
+			return false;
+		}
+	}
+	else
+	{
+		// String comparison is used for every case.
+		bool insensitive = aStringCaseSense != SCS_SENSITIVE;
+		if (insensitive && (aStringCaseSense != SCS_INSENSITIVE || !insensitive_index))
+			return false; // Locale-insensitive comparison isn't supported by the index.
+		TCHAR buf[MAX_NUMBER_SIZE];
+		found = *StringSlot(TokenToString(aSwitch, buf), insensitive);
+	}
+	aCaseLine = found >= 0 ? entry[found].case_line : default_case;
+	return true;
+}
+
+
+int *SwitchCaseTable::IntSlot(__int64 aValue)
+{
+	size_t i = (size_t)((UINT64)aValue * 0x9E3779B97F4A7C15 >> 32) & index_mask;
+	for (; int_index[i] != -1; i = (i + 1) & index_mask)
+		if (entry[int_index[i]].value == aValue)
+			break;
+	return int_index + i;
+}
+
+
+int *SwitchCaseTable::StringSlot(LPCTSTR aStr, bool aInsensitive)
+// Case-insensitive lookups fold only ASCII letters, consistent with _tcsicmp in the "C" locale.
+{
+	size_t h = 2166136261U; // FNV-1a.
+	for (LPCTSTR cp = aStr; *cp; ++cp)
+		h = (h ^ (TBYTE)(aInsensitive ? ctolower(*cp) : *cp)) * 16777619;
+	int *index = aInsensitive ? insensitive_index : sensitive_index;
+	size_t i = h & index_mask;
+	for (; index[i] != -1; i = (i + 1) & index_mask)
+		if (!(aInsensitive ? _tcsicmp(entry[index[i]].str, aStr) : _tcscmp(entry[index[i]].str, aStr)))
+			break;
+	return index + i;
+}
+
+
+
 // Evaluate an #HotIf expression or callback function.
 // This is called by MainWindowProc when it receives an AHK_HOT_IF_EVAL message.
 ResultType HotkeyCriterion::Eval(LPTSTR aHotkeyName)
@@ -10996,11 +11794,19 @@ ResultType Line::PerformLoopFor(ResultToken *aResultToken, Line *&aJumpToLine, L
 	
 	int var_count = mArgc - 1;
 	
-	IObject *enumerator;
-	result = GetEnumerator(enumerator, enum_token, var_count, true);
+	// Array and Map items are retrieved directly, without creating an enumerator object,
+	// unless __Enum has been redefined.
+	IObject *enumerator = nullptr;
+	Object *direct_obj = nullptr;
+	auto direct_get_item = GetDirectEnumerator(TokenToObject(enum_token), direct_obj);
+	if (direct_get_item)
+		direct_obj->AddRef();
+	else
+		result = GetEnumerator(enumerator, enum_token, var_count, true);
 	enum_token.Free();
 	if (result == FAIL || result == EARLY_EXIT)
 		return result;
+	UINT direct_index = UINT_MAX;
 
 	// "Localize" the loop variables.
 	auto var_bkp = (VarBkp *)_alloca(sizeof(VarBkp) * var_count);
@@ -11024,13 +11830,37 @@ ResultType Line::PerformLoopFor(ResultToken *aResultToken, Line *&aJumpToLine, L
 		token.symbol = SYM_MISSING;
 	}
 
+	// Native enumerators are called directly, bypassing Invoke(), the ResultToken protocol
+	// and the per-iteration checks performed by CallEnumerator().  Whether the enumerator
+	// has own properties is rechecked on each iteration, below.
+	auto native_enum = enumerator ? EnumBase::ToNative(enumerator) : nullptr;
+	Var *native_var[2] {};
+	if ((native_enum || direct_get_item) && result != FAIL)
+		for (int i = 0; i < var_count && i < 2; ++i)
+			native_var[i] = TokenToOutputVar(*var_param[i]);
+
 	// Now that the enumerator expression has been evaluated, init A_Index:
 	g.mLoopIteration = 1;
 
 	if (result != FAIL)
 	for (result = CONDITION_FALSE;; ++g.mLoopIteration)
 	{
-		auto enum_result = CallEnumerator(enumerator, var_param, var_count, true);
+		ResultType enum_result;
+		if (native_enum && native_enum->HasOwnProps())
+			native_enum = nullptr; // The body of the loop defined a property, such as Call, which must now be respected.
+		if (native_enum || direct_get_item)
+		{
+			for (int i = 0; i < var_count; ++i)
+				if (var_param[i]->symbol == SYM_OBJECT)
+					((VarRef *)var_param[i]->object)->Uninitialize(VAR_NEVER_FREE); // Same as CallEnumerator().
+			// The bounds are checked by the callback on each iteration, so it is safe for the body
+			// of the loop to modify the Array or Map (with the same results as IndexEnumerator).
+			enum_result = direct_get_item
+				? (direct_obj->*direct_get_item)(++direct_index, native_var[0], native_var[1], var_count)
+				: native_enum->Next(native_var[0], native_var[1]);
+		}
+		else
+			enum_result = CallEnumerator(enumerator, var_param, var_count, true);
 		if (enum_result == FAIL || enum_result == EARLY_EXIT)
 		{
 			result = enum_result;
@@ -11043,7 +11873,10 @@ ResultType Line::PerformLoopFor(ResultToken *aResultToken, Line *&aJumpToLine, L
 		PERFORMLOOP_EXECUTE_BODY
 		PERFORMLOOP_EVALUATE_UNTIL
 	} // for()
-	enumerator->Release();
+	if (enumerator)
+		enumerator->Release();
+	else
+		direct_obj->Release();
 	for (int i = 0; i < var_count; ++i)
 	{
 		if (mArg[i].type == ARG_TYPE_OUTPUT_VAR)
@@ -12271,63 +13104,73 @@ ResultType Script::PreparseVarRefs()
 		
 		mCurrLine = line; // For error-reporting.
 
-		for (int a = 0; a < line->mArgc; ++a)
+		if (!PreparseVarRefs(line))
+			return FAIL;
+	}
+	return OK;
+}
+
+
+
+ResultType Script::PreparseVarRefs(Line *aLine)
+// Resolves the read references in each of aLine's args.  Caller must set g->CurrentFunc.
+{
+	for (int a = 0; a < aLine->mArgc; ++a)
+	{
+		ArgStruct &arg = aLine->mArg[a];
+		if (!arg.is_expression || !arg.postfix) // Not an expression, or preparsing of its function was deferred.
+			continue;
+		for (ExprTokenType *token = arg.postfix; token->symbol != SYM_INVALID; ++token)
 		{
-			ArgStruct &arg = line->mArg[a];
-			if (!arg.is_expression)
+			if (token->symbol != SYM_VAR // Not a var.
+				|| VARREF_IS_WRITE(token->var_usage)) // Already resolved by ExpressionToPostfix.
 				continue;
-			for (ExprTokenType *token = arg.postfix; token->symbol != SYM_INVALID; ++token)
+			if (token->var_deref->type == DT_FUNCREF)
 			{
-				if (token->symbol != SYM_VAR // Not a var.
-					|| VARREF_IS_WRITE(token->var_usage)) // Already resolved by ExpressionToPostfix.
-					continue;
-				if (token->var_deref->type == DT_FUNCREF)
-				{
-					token->var = token->var_deref->var;
-					continue;
-				}
-				if (  !(token->var = FindOrAddVar(token->var_deref->marker, token->var_deref->length, FINDVAR_FOR_READ))  )
-					return FAIL;
-				if (token->var->IsAlias()) // Upvar.
-					continue;
-				switch (token->var->Type())
-				{
-				case VAR_CONSTANT:
-					// Resolve constants to their values, except in cases like IsSet(SomeClass), or when
-					// the constant is a closure (which may change each time the outer function is called).
-					if (!token->var->IsLocal() && VARREF_IS_READ(token->var_usage) && !token->var->IsUninitialized())
-						token->var->ToToken(*token);
-					continue;
-				case VAR_VIRTUAL:
-					if (VARREF_IS_READ(token->var_usage))
-						++arg.max_alloc; // Reserve a to_free[] slot for it in ExpandExpression().
-					break;
-				default:
-					// Suppress any VarUnset warnings for IsSet(var) so that it can be used to determine if an
-					// optionally-set global variable has been set, such as a class in an optional #Include.
-					// MarkAssignedSomewhere() isn't used for this because PreprocessLocalVars() hasn't been
-					// called yet, and it relies on the attribute being accurate.
-					if (token->var_usage == VARREF_ISSET)
-						token->var->MarkAlreadyWarned();
-					// It's too early to show VarUnset warnings, since not all VARREF_ISSET references have been marked.
-					// The effect of IsSet(v) for suppressing the warning shouldn't be positional since it's feasible for
-					// a check in one function to guard evaluation of a VARREF_READ in some other function.
-				}
+				token->var = token->var_deref->var;
+				continue;
 			}
-			if (arg.type == ARG_TYPE_INPUT_VAR)
+			if (  !(token->var = FindOrAddVar(token->var_deref->marker, token->var_deref->length, FINDVAR_FOR_READ))  )
+				return FAIL;
+			if (token->var->IsAlias()) // Upvar.
+				continue;
+			switch (token->var->Type())
 			{
-				if (arg.postfix->symbol != SYM_VAR || arg.postfix->var->Type() != VAR_NORMAL)
-				{
-					// Can't be ARG_TYPE_INPUT_VAR after all, as VAR_VIRTUAL and VAR_CONSTANT require ExpandExpression
-					// (unless it's a constant which was converted to SYM_OBJECT above).
-					arg.type = ARG_TYPE_NORMAL;
-				}
-				else
-				{
-					// This arg can be optimized by avoiding ExpandExpression.
-					arg.deref = (DerefType *)arg.postfix->var;
-					arg.is_expression = false;
-				}
+			case VAR_CONSTANT:
+				// Resolve constants to their values, except in cases like IsSet(SomeClass), or when
+				// the constant is a closure (which may change each time the outer function is called).
+				if (!token->var->IsLocal() && VARREF_IS_READ(token->var_usage) && !token->var->IsUninitialized())
+					token->var->ToToken(*token);
+				continue;
+			case VAR_VIRTUAL:
+				if (VARREF_IS_READ(token->var_usage))
+					++arg.max_alloc; // Reserve a to_free[] slot for it in ExpandExpression().
+				break;
+			default:
+				// Suppress any VarUnset warnings for IsSet(var) so that it can be used to determine if an
+				// optionally-set global variable has been set, such as a class in an optional #Include.
+				// MarkAssignedSomewhere() isn't used for this because PreprocessLocalVars() hasn't been
+				// called yet, and it relies on the attribute being accurate.
+				if (token->var_usage == VARREF_ISSET)
+					token->var->MarkAlreadyWarned();
+				// It's too early to show VarUnset warnings, since not all VARREF_ISSET references have been marked.
+				// The effect of IsSet(v) for suppressing the warning shouldn't be positional since it's feasible for
+				// a check in one function to guard evaluation of a VARREF_READ in some other function.
+			}
+		}
+		if (arg.type == ARG_TYPE_INPUT_VAR)
+		{
+			if (arg.postfix->symbol != SYM_VAR || arg.postfix->var->Type() != VAR_NORMAL)
+			{
+				// Can't be ARG_TYPE_INPUT_VAR after all, as VAR_VIRTUAL and VAR_CONSTANT require ExpandExpression
+				// (unless it's a constant which was converted to SYM_OBJECT above).
+				arg.type = ARG_TYPE_NORMAL;
+			}
+			else
+			{
+				// This arg can be optimized by avoiding ExpandExpression.
+				arg.deref = (DerefType *)arg.postfix->var;
+				arg.is_expression = false;
 			}
 		}
 	}
@@ -12422,6 +13265,8 @@ LPTSTR Script::ListKeyHistory(LPTSTR aBuf, int aBufSize) // aBufSize should be a
 		//"\r\nInterruptible?: %s"
 		_T("\r\nInterrupted threads: %d%s")
 		_T("\r\nPaused threads: %d of %d (%d layers)")
+		_T("\r\nMessage checks: %Iu (%Iu peeks)")
+		_T("\r\nConstant folds: %u (%u dead branches removed)")
 		_T("\r\nModifiers (GetKeyState() now) = %s")
 		_T("\r\n")
 		, win_title
@@ -12434,6 +13279,8 @@ LPTSTR Script::ListKeyHistory(LPTSTR aBuf, int aBufSize) // aBufSize should be a
 		, g_nThreads > 1 ? _T(" (preempted: they will resume when the current thread finishes)") : _T("")
 		, g_nPausedThreads - (g_array[0].IsPaused && !mAutoExecSectionIsRunning)  // Historically thread #0 isn't counted as a paused thread unless the auto-exec section is running but paused.
 		, g_nThreads, g_nLayersNeedingTimer
+		, mPeekCheckCount, mPeekCount
+		, mConstantFoldCount, mDeadBranchCount
 		, ModifiersLRToText(GetModifierLRState(true), LRtext));
 	GetHookStatus(aBuf, BUF_SPACE_REMAINING);
 	aBuf += _tcslen(aBuf); // Adjust for what GetHookStatus() wrote to the buffer.
@@ -206,6 +206,7 @@ enum CommandIDs {CONTROL_ID_FIRST = IDCANCEL + 1
 #define ERR_PROPERTY_READONLY _T("Property is read-only.")
 #define ERR_NO_PROCESS _T("Target process not found.")
 #define ERR_NO_WINDOW _T("Target window not found.")
+#define ERR_WINCRITERIA_PARAMS _T("WinText, ExcludeTitle and ExcludeText must be blank when WinTitle is a WinCriteria.")
 #define ERR_NO_CONTROL _T("Target control not found.")
 #define ERR_NO_STATUSBAR _T("No StatusBar.")
 #define ERR_WINDOW_HAS_NO_MENU _T("Non-existent or unsupported menu.")
@@ -389,6 +390,9 @@ struct ArgStruct
 	DerefType *deref;  // Will hold a NULL-terminated array of operands/word-operators pre-parsed by ParseDerefs()/ParseOperands().
 	ExprTokenType *postfix;  // An array of tokens in postfix order.
 	int max_stack, max_alloc;
+#ifdef CONFIG_EXPR_ALLOC_STATS
+	struct { UINT allocs, copies, moves; } stats; // Maintained by ExpandExpression().
+#endif
 };
 
 enum FuncDefType : UCHAR
@@ -561,6 +565,31 @@ struct CatchStatementArgs
 };
 
 
+// Built by Script::PreparseSwitchTable() for a Switch whose case values are all constant strings
+// or integers, so that the matching case can be found without comparing each value in turn.
+#define SWITCH_TABLE_MIN_CASES 8
+struct SwitchCaseTable
+{
+	struct Entry
+	{
+		LPCTSTR str; // The value as a string (for integers, formatted as decimal).
+		__int64 value; // The value, if is_int.
+		Line *case_line;
+		bool is_int;
+	};
+	Entry *entry;
+	int *int_index, *sensitive_index, *insensitive_index; // Open addressing; -1 indicates an empty slot.  insensitive_index may be null.
+	size_t index_mask; // Capacity of each index, minus 1.
+	Line *default_case;
+	bool has_numeric_string; // Numeric comparison can't use the index, since "1" and "01" would be equal.
+
+	bool Find(ExprTokenType &aSwitch, SymbolType aSwitchIsNumeric, StringCaseSenseType aStringCaseSense, Line *&aCaseLine);
+	// Return the slot containing the index of the matching entry, or the empty slot where it would go.
+	int *IntSlot(__int64 aValue);
+	int *StringSlot(LPCTSTR aStr, bool aInsensitive);
+};
+
+
 typedef UCHAR ArgCountType;
 #define MAX_ARGS 20   // Maximum number of args used by any command.
 
@@ -874,6 +903,7 @@ public:
 	ResultType ExpressionToPostfix(ArgStruct &aArg);
 	ResultType ExpressionToPostfix(ArgStruct &aArg, ExprTokenType *&aInfix);
 	ResultType FinalizeExpression(ArgStruct &aArg);
+	void FoldConstants(ArgStruct &aArg);
 
 	static bool FileIsFilteredOut(LoopFilesStruct &aCurrentFile, FileLoopModeType aFileLoopMode);
 
@@ -1541,6 +1571,10 @@ public:
 	// Keep small members adjacent to each other to save space and improve perf. due to byte alignment:
 	FuncDefType mIsFuncExpression; // Whether this function was defined *within* an expression and is therefore allowed under a control flow statement.
 	bool mIsStatic = false; // Whether the "static" keyword was used with a function (not method); this prevents a nested function from becoming a closure.
+#define FUNC_PREPARSED			0
+#define FUNC_PREPARSE_DEFERRED	1 // The body is preparsed on first call; see Script::PreparseDeferredFunc().
+#define FUNC_PREPARSE_FAILED	2 // Preparsing failed or is in progress.
+	UCHAR mPreparseState = FUNC_PREPARSED;
 #define VAR_DECLARE_GLOBAL (VAR_DECLARED | VAR_GLOBAL)
 #define VAR_DECLARE_LOCAL  (VAR_DECLARED | VAR_LOCAL)
 #define VAR_DECLARE_STATIC (VAR_DECLARED | VAR_LOCAL | VAR_LOCAL_STATIC)
@@ -1832,6 +1866,128 @@ public:
 	bool ArgIsOutputVar(int aArg) override { return true; }
 	bool Call(ResultToken &aResultToken, ExprTokenType *aParam[], int aParamCount) override;
 	virtual ResultType Next(Var *, Var *) = 0;
+
+	// Returns aEnum if Next() can be called directly, bypassing Invoke() and Call().
+	// This is consistent with the shortcut taken by Func::Invoke().
+	static EnumBase *ToNative(IObject *aEnum)
+	{
+		auto e = dynamic_cast<EnumBase *>(aEnum);
+		return e && !e->HasOwnProps() ? e : nullptr;
+	}
+	// The number of values produced by this enumerator when used as the source for an adapter.
+	int SourceVarCount() { return mParamCount < 1 ? 1 : mParamCount > 2 ? 2 : mParamCount; }
+
+	enum MemberID
+	{
+		M_Map,
+		M_Filter,
+		M_Take,
+		M_Skip,
+		M_Zip,
+		M_Chain
+	};
+	static ObjectMember sMembers[];
+	void Invoke(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType *aParam[], int aParamCount);
+};
+
+
+// Retrieves items from an enumerator on behalf of native code.  Native enumerators are called
+// directly; any other enumerator is called via Invoke() using VarRefs allocated only once.
+class EnumSource
+{
+	IObject *mEnum = nullptr;
+	EnumBase *mNative = nullptr;
+	VarRef *mVar[2] {};
+	int mVarCount = 0;
+public:
+	void Init(IObject *aEnum, int aVarCount);
+	ResultType Init(ExprTokenType &aEnumerable, int aVarCount);
+	ResultType Next(Var *aVar0, Var *aVar1);
+	~EnumSource();
+};
+
+
+// Lazy adapters returned by Enumerator methods.  Each pulls one item at a time from its source,
+// so composing them does not materialize intermediate arrays.
+class DECLSPEC_NOVTABLE EnumAdapter : public EnumBase
+{
+protected:
+	EnumSource mSource;
+	EnumAdapter(IObject *aSource, int aVarCount)
+	{
+		mSource.Init(aSource, aVarCount);
+		mParamCount = aVarCount;
+	}
+};
+
+class MapEnum : public EnumAdapter
+{
+	IObject *mFunc;
+	Var mItem[2];
+	int mSourceVarCount;
+public:
+	MapEnum(IObject *aSource, int aSourceVarCount, IObject *aFunc)
+		: EnumAdapter(aSource, aSourceVarCount), mFunc(aFunc), mSourceVarCount(aSourceVarCount)
+	{
+		mFunc->AddRef();
+		mParamCount = 1;
+	}
+	~MapEnum();
+	ResultType Next(Var *, Var *) override;
+};
+
+class FilterEnum : public EnumAdapter
+{
+	IObject *mFunc;
+	Var mItem[2];
+public:
+	FilterEnum(IObject *aSource, int aVarCount, IObject *aFunc) : EnumAdapter(aSource, aVarCount), mFunc(aFunc)
+	{
+		mFunc->AddRef();
+	}
+	~FilterEnum();
+	ResultType Next(Var *, Var *) override;
+};
+
+class TakeSkipEnum : public EnumAdapter
+{
+	__int64 mCount; // Number of items remaining to take, or to skip.
+	bool mSkip;
+public:
+	TakeSkipEnum(IObject *aSource, int aVarCount, __int64 aCount, bool aSkip)
+		: EnumAdapter(aSource, aVarCount), mCount(aCount), mSkip(aSkip) {}
+	ResultType Next(Var *, Var *) override;
+};
+
+class ZipEnum : public EnumAdapter
+{
+	EnumSource mOther;
+public:
+	ZipEnum(IObject *aSource) : EnumAdapter(aSource, 1) { mParamCount = 2; }
+	ResultType Init(ExprTokenType &aOther) { return mOther.Init(aOther, 1); }
+	ResultType Next(Var *, Var *) override;
+};
+
+class ChainEnum : public EnumAdapter
+{
+	EnumSource mOther;
+	bool mSourceDone = false;
+public:
+	ChainEnum(IObject *aSource, int aVarCount) : EnumAdapter(aSource, aVarCount) {}
+	ResultType Init(ExprTokenType &aOther) { return mOther.Init(aOther, mParamCount); }
+	ResultType Next(Var *, Var *) override;
+};
+
+class RangeEnum : public EnumBase
+{
+	__int64 mNext, mStop, mStep, mIndex = 0;
+	bool mDone = false;
+public:
+	RangeEnum(__int64 aStart, __int64 aStop, __int64 aStep) : mNext(aStart), mStop(aStop), mStep(aStep)
+	{
+		mParamCount = 1; // Two variables are permitted (index, value), but only the value is passed on to adapters.
+	}
+	ResultType Next(Var *, Var *) override;
 };
 
 
@@ -1857,6 +2013,10 @@ public:
 	ResultType Next(Var *, Var *) override;
 };
 
+// Returns the callback which Array or Map's __Enum would pass to IndexEnumerator, if aEnumerable
+// is an Array or Map which hasn't overridden __Enum.  This allows the items to be retrieved directly.
+IndexEnumerator::Callback GetDirectEnumerator(IObject *aEnumerable, Object *&aObject);
+
 
 
 class ScriptTimer
@@ -2892,6 +3052,8 @@ private:
 	Line *PreparseCommands(Line *aStartingLine);
 	ResultType PreparseCatchVar(Line *aLine);
 	ResultType PreparseCatchClass(Line *aLine);
+	void PreparseSwitchTable(Line *aLine);
+	void RemoveDeadBranches();
 	bool IsLabelTarget(Line *aLine);
 
 public:
@@ -2933,12 +3095,21 @@ public:
 	void PrintErrorStdOut(LPCTSTR aErrorText, LPCTSTR aExtraInfo, FileIndexType aFileIndex, LineNumberType aLineNumber);
 #ifndef AUTOHOTKEYSC
 	bool mValidateThenExit;
+	bool mLazyParse; // Defer preparsing of eligible function bodies until each function is first called.
 	LPTSTR mCmdLineInclude;
 #endif
 
 	int mUninterruptedLineCountMax; // 32-bit for performance (since huge values seem unnecessary here).
 	int mUninterruptibleTime;
 	DWORD mLastPeekTime;
+	volatile bool mPeekDue; // Set via mPeekTimer to tell ExecUntil() it's time to check for messages.
+	HANDLE mPeekTimer; // A waitable timer, which mPeekWait waits for on a thread pool thread.
+	PTP_WAIT mPeekWait;
+	DWORD mPeekTimerResolution; // The shortest interval mPeekTimer can reliably wait, or UINT_MAX if it couldn't be created.
+	UINT_PTR mPeekCheckCount, mPeekCount; // How often ExecUntil() took the slow path, and how often it actually peeked.
+	UINT mConstantFoldCount, mDeadBranchCount; // Operations folded into constants and If statements removed at load time.
+	void PeekIfDue();
+	void CreatePeekTimer();
 
 	CStringW mRunAsUser, mRunAsPass, mRunAsDomain;
 
@@ -3100,6 +3271,10 @@ public:
 	ResultType PreprocessLocalVars(FuncList &aFuncs);
 	ResultType PreprocessLocalVars(UserFunc &aFunc);
 	ResultType PreparseVarRefs();
+	ResultType PreparseVarRefs(Line *aLine);
+	ResultType PreparseFuncExpressions(UserFunc &aFunc);
+	bool CanDeferPreparse(UserFunc &aFunc);
+	ResultType PreparseDeferredFunc(UserFunc &aFunc);
 	void CountNestedFuncRefs(UserFunc &aWithin, LPCTSTR aFuncName);
 
 	ResultType ThrowRuntimeException(LPCTSTR aErrorText, LPCTSTR aExtraInfo, Line *aLine, ResultType aErrorType, Object *aPrototype = nullptr);
@@ -3272,6 +3447,14 @@ BIF_DECL(Op_Object);
 BIF_DECL(Op_Array);
 
 BIF_DECL(BIF_ObjAddRefRelease);
+BIF_DECL(BIF_ObjAllocSnapshot);
+BIF_DECL(BIF_Benchmark);
+BIF_DECL(BIF_HookReplay);
+BIF_DECL(BIF_SyntheticWindows);
+#ifdef CONFIG_DEBUGGER
+BIF_DECL(BIF_CallProfileWrite);
+BIF_DECL(BIF_SampleProfileWrite);
+#endif
 BIF_DECL(BIF_ObjBindMethod);
 BIF_DECL(BIF_ObjPtr);
 // Built-ins also available as methods -- these are available as functions for use primarily by overridden methods (i.e. where using the built-in methods isn't possible as they're no longer accessible).
@@ -3305,6 +3488,7 @@ BIF_DECL(BIF_ComObjQuery);
 BIF_DECL(BIF_Click);
 BIF_DECL(BIF_Reg);
 BIF_DECL(BIF_Random);
+BIF_DECL(BIF_Range);
 BIF_DECL(BIF_Sound);
 BIF_DECL(BIF_SplitPath);
 BIF_DECL(BIF_CaretGetPos);
@@ -3354,6 +3538,10 @@ void PauseCurrentThread();
 void ToggleSuspendState();
 
 LPCTSTR RegExMatch(LPCTSTR aHaystack, LPCTSTR aNeedleRegEx);
+struct CompiledRegEx;
+CompiledRegEx *RegExCompile(LPCTSTR aNeedleRegEx);
+void RegExFree(CompiledRegEx *aRegEx);
+LPCTSTR RegExMatch(LPCTSTR aHaystack, CompiledRegEx *aRegEx);
 FResult SetWorkingDir(LPCTSTR aNewDir);
 void UpdateWorkingDir(LPCTSTR aNewDir = NULL);
 LPTSTR GetWorkingDir();
@@ -3369,6 +3557,8 @@ ResultType DetermineTargetWindow(HWND &aWindow, ResultToken &aResultToken, ExprT
 #define WINTITLE_PARAMETERS aWinTitle, aWinText, aExcludeTitle, aExcludeText
 FResult DetermineTargetHwnd(HWND &aWindow, bool &aDetermined, ExprTokenType &aToken);
 FResult DetermineTargetWindow(HWND &aWindow, WINTITLE_PARAMETERS_DECL, bool aFindLastMatch = false);
+class WinCriteria;
+FResult DetermineWinCriteria(WinCriteria *&aCriteria, WINTITLE_PARAMETERS_DECL);
 #define CONTROL_PARAMETERS_DECL ExprTokenType &aControlSpec, WINTITLE_PARAMETERS_DECL
 #define CONTROL_PARAMETERS_DECL_OPT ExprTokenType *aControlSpec, WINTITLE_PARAMETERS_DECL
 #define CONTROL_PARAMETERS aControlSpec, WINTITLE_PARAMETERS
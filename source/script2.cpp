@@ -239,6 +239,16 @@ LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT iMsg, WPARAM wParam, LPARAM lPar
 		}
 		return 0;
 
+	case AHK_HOOK_EVENTS:
+	{
+		// A message pump other than MsgSleep() is running.  Handle the next queued event as
+		// though it had been posted to this window.
+		MSG msg;
+		if (GetHookMessage(msg))
+			return MainWindowProc(hWnd, msg.message, msg.wParam, msg.lParam);
+		return 0;
+	}
+
 	case WM_HOTKEY: // As a result of this app having previously called RegisterHotkey().
 	case AHK_HOOK_HOTKEY:  // Sent from this app's keyboard or mouse hook.
 	case AHK_HOTSTRING: // Added for v1.0.36.02 so that hotstrings work even while an InputBox or other non-standard msg pump is running.
@@ -2585,6 +2595,7 @@ bif_impl void Critical(optl<StrArg> aSetting, int &aRetVal)
 	if (g->ThreadIsCritical) // Critical has been turned on. (For simplicity even if it was already on, the following is done.)
 	{
 		g->PeekFrequency = peek_frequency_when_critical_is_on;
+		g_script.mPeekDue = true; // Apply the new frequency immediately, in case it's lower.
 		g->AllowThreadToBeInterrupted = false;
 		// Ensure uninterruptibility never times out.  IsInterruptible() relies on this to avoid the
 		// need to check g->ThreadIsCritical, which in turn allows global_maximize_interruptibility()
@@ -2601,6 +2612,7 @@ bif_impl void Critical(optl<StrArg> aSetting, int &aRetVal)
 		// any "Thread Interrupt" settings.
 		g->PeekFrequency = DEFAULT_PEEK_FREQUENCY;
 		g->AllowThreadToBeInterrupted = true;
+		g_script.mPeekDue = true; // As above.
 	}
 	// The thread's interruptibility has been explicitly set; so the script is now in charge of
 	// managing this thread's interruptibility.
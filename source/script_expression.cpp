@@ -72,6 +72,22 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 	// "in scope" in case of early "goto" (goto substantially boosts performance and reduces code size here).
 	ExprTokenType **to_free = (ExprTokenType **)_alloca(mArg[aArgIndex].max_alloc * sizeof(ExprTokenType *));
 	int to_free_count = 0; // The actual number of items in use in the above array.
+	// A string token in to_free[] owns its memory, which can therefore be handed on to the next operator,
+	// a variable or the caller instead of being copied.  owned_index() returns the token's index in
+	// to_free[] or -1 if not owned; the search is short since operands were usually pushed most recently.
+	// disown() is called after the memory has been transferred elsewhere.
+	auto owned_index = [&](ExprTokenType &aToken) -> int {
+		if (aToken.symbol == SYM_STRING)
+			for (int k = to_free_count; k--; )
+				if (to_free[k] == &aToken)
+					return k;
+		return -1;
+	};
+	auto disown = [&](int aIndex) {
+		--to_free_count;
+		memmove(to_free + aIndex, to_free + aIndex + 1, (to_free_count - aIndex) * sizeof(ExprTokenType *));
+	};
+	int owned;
 	LPTSTR result_to_return = _T(""); // By contrast, NULL is used to tell the caller to abort the current thread.
 	LPCTSTR error_msg = ERR_EXPR_EVAL, error_info = _T("");
 	ExprTokenType *error_value;
@@ -106,6 +122,11 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 	#define EXPR_SMALL_MEM_LIMIT 4097 // The maximum size allowed for an item to qualify for alloca.
 	#define EXPR_ALLOCA_LIMIT 40000  // The maximum amount of alloca memory for all items.  v1.0.45: An extra precaution against stack stress in extreme/theoretical cases.
 	#define EXPR_IS_DONE (!stack_count && this_postfix[1].symbol == SYM_INVALID) // True if we've used up the last of the operators & operands.  Non-zero stack_count combined with SYM_INVALID would indicate an error (an exception will be thrown later, so don't take any shortcuts).
+#ifdef CONFIG_EXPR_ALLOC_STATS
+	#define EXPR_STAT(name) (++mArg[aArgIndex].stats.name)
+#else
+	#define EXPR_STAT(name)
+#endif
 
 	// For each item in the postfix array: if it's an operand, push it onto stack; if it's an operator or
 	// function call, evaluate it and push its result onto the stack.  SYM_INVALID is the special symbol
@@ -490,6 +511,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 					// AcceptNewMem() will shrink the memory for us, via _expand(), if there's a lot of
 					// extra/unused space in it.
 					internal_output_var->AcceptNewMem(result_token.mem_to_free, result_token.marker_length);
+					EXPR_STAT(moves);
 				}
 				else
 				{
@@ -500,6 +522,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 					if (result == sDerefBuf && result_length >= MAX_ALLOC_SIMPLE) // Result is in their buffer and it's longer than what can fit in a SimpleHeap variable (avoids wasting SimpleHeap memory).
 					{
 						internal_output_var->AcceptNewMem(result, result_length);
+						EXPR_STAT(moves);
 						NULLIFY_S_DEREF_BUF // Force any UDFs called subsequently by us to create a new deref buffer because this one was just taken over by a variable.
 					}
 					else
@@ -509,6 +532,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 						// also avoids the possibility of needing to expand that buffer).
 						if (!internal_output_var->Assign(result, result_length)) // Assign() contains an optimization that avoids actually doing the mem-copying if output_var is being assigned to itself (which can happen in cases like RegExMatch()).
 							goto abort;
+						EXPR_STAT(copies);
 					}
 				}
 				if (done)
@@ -535,6 +559,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 					// Return this memory block to our caller.  This is handled here rather than
 					// at a later stage in order to avoid an unnecessary _tcslen() call.
 					aResultToken->AcceptMem(result_to_return = result, result_length);
+					EXPR_STAT(moves);
 					goto normal_end_skip_output_var;
 				}
 				// Mark it to be freed at the time we return.
@@ -616,6 +641,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 				// So now we know result isn't an empty string, which in turn ensures that size > 1 and length > 0,
 				// which might be relied upon by things further below.
 				result_size = result_length + 1;
+				EXPR_STAT(copies);
 				// Must cast to int to avoid loss of negative values:
 				if (result_size <= aDerefBufSize - (target - aDerefBuf)) // There is room at the end of our deref buf, so use it.
 				{
@@ -640,6 +666,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 					//   return values are usually small, such as numbers).
 					if (  !(this_token.marker = tmalloc(result_size))  )
 						goto outofmem;
+					EXPR_STAT(allocs);
 					tmemcpy(this_token.marker, result, result_length); // Benches slightly faster than strcpy().
 					to_free[to_free_count++] = &this_token; // A slot was reserved for this SYM_FUNC.
 				}
@@ -921,7 +948,15 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 				switch(this_token.symbol)
 				{
 				case SYM_ASSIGN: // Listed first for performance (it's probably the most common because things like ++ and += aren't expressions when they're by themselves on a line).
-					if (!left.var->Assign(right)) // left.var can be VAR_VIRTUAL in this case.
+					if ((owned = owned_index(right)) >= 0 && left.var->Type() == VAR_NORMAL)
+					{
+						// right is a temporary string such as a function's result or the result of a long
+						// concat, so give its memory to the variable rather than copying it.
+						left.var->AcceptNewMem(right.marker, (VarSizeType)right.marker_length);
+						disown(owned);
+						EXPR_STAT(moves);
+					}
+					else if (!left.var->Assign(right)) // left.var can be VAR_VIRTUAL in this case.
 						goto abort;
 					if (left.var->Type() != VAR_NORMAL // VAR_VIRTUAL should not yield SYM_VAR (as some sections of the code wouldn't handle it correctly).
 						|| right.symbol == SYM_MISSING // Subsequent operators/calls (confirmed at load-time as being able to handle `unset`) need SYM_MISSING,
@@ -1041,6 +1076,23 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 					// Otherwise, fall back to the other concat methods:
 					result_size = right_length + left_length + 1;
 
+					if ((owned = owned_index(left)) >= 0)
+					{
+						// left is a temporary string owned by this expression, such as a function's result or
+						// a prior concat which was too large for the deref buffer, so append to it in place rather
+						// than copying both operands into new memory.  A chain like f() . a . b therefore copies
+						// f()'s result at most once per realloc() that can't be done in place.  The result takes
+						// over left's slot in to_free[], and is handed on to any subsequent assignment.
+						if (  !(this_token.marker = (LPTSTR)realloc(left.marker, result_size * sizeof(TCHAR)))  )
+							goto outofmem; // left.marker is still valid and will be freed.
+						tmemcpy(this_token.marker + left_length, right_string, right_length + 1); // +1 to include its zero terminator.
+						this_token.marker_length = result_size - 1;
+						to_free[owned] = &this_token;
+						EXPR_STAT(moves);
+						result_symbol = SYM_STRING;
+						break;
+					}
+
 					if (sym_assign_var)  // Fix for v1.0.48: These 2 lines were added, and they must take
 						temp_var = NULL; // precendence over the other checks below to allow an expression like the following to work: var := var2 .= "abc"
 					else if (output_var && EXPR_IS_DONE) // i.e. this is ACT_ASSIGNEXPR and we're at the final operator, a concat.
@@ -1148,8 +1200,10 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 						// See the nearly identical section higher above for comments:
 						if (  !(this_token.marker = tmalloc(result_size))  )
 							goto outofmem;
+						EXPR_STAT(allocs);
 						to_free[to_free_count++] = &this_token; // A slot was reserved for this SYM_CONCAT.
 					}
+					EXPR_STAT(copies);
 					if (left_length)
 						tmemcpy(this_token.marker, left_string, left_length);  // Not +1 because don't need the zero terminator.
 					tmemcpy(this_token.marker + left_length, right_string, right_length + 1); // +1 to include its zero terminator.
@@ -1353,6 +1407,14 @@ push_this_token:
 
 	if (output_var)
 	{
+		if ((owned = owned_index(result_token)) >= 0 && output_var->Type() == VAR_NORMAL)
+		{
+			// The result is a temporary string owned by this expression, so give it to the variable.
+			output_var->AcceptNewMem(result_token.marker, (VarSizeType)result_token.marker_length);
+			disown(owned);
+			EXPR_STAT(moves);
+			goto normal_end_skip_output_var;
+		}
 		// v1.0.45: Take a shortcut, which in the case of SYM_STRING/OPERAND/VAR avoids one memcpy
 		// (into the deref buffer).  In some cases, this also saves from having to expand the deref buffer.
 		if (!output_var->Assign(result_token))
@@ -1397,11 +1459,12 @@ push_this_token:
 			//  - Return a static or global variable's string directly.
 			break;
 		case SYM_STRING:
-			if (to_free_count && to_free[to_free_count - 1] == &result_token)
+			if ((owned = owned_index(result_token)) >= 0)
 			{
 				// Pass this mem item back to caller instead of freeing it when we return.
 				aResultToken->AcceptMem(result_to_return = result_token.marker, result_token.marker_length);
-				--to_free_count;
+				disown(owned);
+				EXPR_STAT(moves);
 				goto normal_end_skip_output_var;
 			}
 		}
@@ -1842,6 +1905,12 @@ bool UserFunc::Call(ResultToken &aResultToken, ExprTokenType *aParam[], int aPar
 	if (!Func::Call(aResultToken, aParam, aParamCount))
 		return false;
 
+	if (mPreparseState != FUNC_PREPARSED && !g_script.PreparseDeferredFunc(*this)) // Not called yet with /LazyParse.
+	{
+		aResultToken.SetExitResult(FAIL);
+		return false;
+	}
+
 		UDFCallInfo recurse(this);
 
 		int j, count_of_actuals_that_have_formals;
@@ -7,6 +7,8 @@
 #include "script_object.h"
 #include "script_func_impl.h"
 #include "input_object.h"
+#include "win_criteria.h"
+#include "profiler.h"
 
 #include <errno.h> // For ERANGE.
 #include <initializer_list>
@@ -62,6 +64,8 @@ Object *Object::Create()
 {
 	Object *obj = new Object();
 	obj->SetBase(Object::sPrototype);
+	if (AllocProfiler::sEnabled)
+		AllocProfiler::Created(obj, Object::sPrototype, sizeof(Object));
 	return obj;
 }
 
@@ -145,6 +149,8 @@ Map *Map::Create(ExprTokenType *aParam[], int aParamCount)
 
 	Map *map = new Map();
 	map->SetBase(Map::sPrototype);
+	if (AllocProfiler::sEnabled)
+		AllocProfiler::Created(map, Map::sPrototype, sizeof(Map));
 	if (aParamCount && !map->SetItems(aParam, aParamCount))
 	{
 		// Out of memory.
@@ -243,48 +249,68 @@ Map *Map::CloneTo(Map &obj)
 {
 	Object::CloneTo(obj);
 
-	if (!obj.SetInternalCapacity(mCount))
+	obj.mFlags = mFlags;
+	if (!mCount)
+		return &obj;
+
+	// Rather than copying each item, share mItem with the clone until one of them is modified.
+	// This makes a defensive copy of a large Map cheap if neither copy is modified, and otherwise
+	// only postpones the cost.
+	if (!mShared)
 	{
-		obj.Release();
-		return NULL;
+		if (  !(mShared = (ULONG *)malloc(sizeof(ULONG)))  )
+		{
+			obj.Release();
+			return NULL;
+		}
+		*mShared = 1;
 	}
-
-	int failure_count = 0; // See Object::CloneT() for comments.
-	index_t i;
-
-	obj.mFlags = mFlags;
+	++*mShared;
+	obj.mShared = mShared;
+	obj.mItem = mItem;
 	obj.mCount = mCount;
+	obj.mCapacity = mCapacity;
 	obj.mKeyOffsetObject = mKeyOffsetObject;
 	obj.mKeyOffsetString = mKeyOffsetString;
-	if (obj.mKeyOffsetObject < 0) // Currently might always evaluate to false.
+	return &obj;
+}
+
+bool Map::Unshare(index_t aCapacity)
+// Gives this Map its own copy of mItem, which is shared with one or more clones.
+// Caller must ensure aCapacity >= mCount.
+{
+	ASSERT(mShared && aCapacity >= mCount);
+	if (*mShared == 1) // The other Maps have since made their own copies or been deleted.
 	{
-		obj.mKeyOffsetObject = 0; // aStartOffset excluded all integer and some or all object keys.
-		if (obj.mKeyOffsetString < 0)
-			obj.mKeyOffsetString = 0; // aStartOffset also excluded some string keys.
+		free(mShared);
+		mShared = NULL;
+		return true;
 	}
-	//else no need to check mKeyOffsetString since it should always be >= mKeyOffsetObject.
+
+	Pair *item = (Pair *)malloc(aCapacity * sizeof(Pair));
+	if (!item)
+		return false;
+
+	int failure_count = 0; // See Object::CloneTo() for comments.
+	index_t i;
 
 	for (i = 0; i < mCount; ++i)
 	{
-		Pair &dst = obj.mItem[i];
+		Pair &dst = item[i];
 		Pair &src = mItem[i];
 
 		// Copy key.
-		if (i >= obj.mKeyOffsetString)
+		if (i >= mKeyOffsetString)
 		{
 			dst.key_c = src.key_c;
 			if ( !(dst.key.s = _tcsdup(src.key.s)) )
-			{
-				// Key allocation failed. At this point, all int and object keys
-				// have been set and values for previous items have been copied.
 				++failure_count;
-			}
 		}
 		else 
 		{
 			// Copy whole key; search "(IntKeyType)(INT_PTR)" for comments.
 			dst.key = src.key;
-			if (i >= obj.mKeyOffsetObject)
+			if (i >= mKeyOffsetObject)
 				dst.key.p->AddRef();
 		}
 
@@ -294,10 +320,24 @@ Map *Map::CloneTo(Map &obj)
 	}
 	if (failure_count)
 	{
-		obj.Release();
-		return NULL;
+		// Discard the copy and leave mItem shared.  Since mItem still holds a reference to
+		// each object, this can't cause re-entry via __delete.
+		for (i = 0; i < mCount; ++i)
+		{
+			item[i].Free();
+			if (i >= mKeyOffsetString)
+				free(item[i].key.s);
+			else if (i >= mKeyOffsetObject)
+				item[i].key.p->Release();
+		}
+		free(item);
+		return false;
 	}
-	return &obj;
+	--*mShared;
+	mShared = NULL;
+	mItem = item;
+	mCapacity = aCapacity;
+	return true;
 }
 
 
@@ -524,6 +564,8 @@ void Object::CallNestedDelete()
 
 Object::~Object()
 {
+	if (AllocProfiler::sEnabled)
+		AllocProfiler::Deleted(this);
 	if (mNested)
 	{
 		// Nested objects have been "destructed" but not actually deleted yet.
@@ -542,6 +584,21 @@ Object::~Object()
 
 void Map::Clear()
 {
+	if (mShared)
+	{
+		if (*mShared > 1)
+		{
+			// Leave the items to the other Maps which share them.
+			--*mShared;
+			mShared = NULL;
+			mItem = NULL;
+			mCount = mCapacity = 0;
+			mKeyOffsetObject = mKeyOffsetString = 0;
+			return;
+		}
+		free(mShared);
+		mShared = NULL;
+	}
 	while (mCount)
 	{
 		--mCount;
@@ -1363,6 +1420,12 @@ void Map::Delete(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType *
 		// removed from this[arg], but there wasn't one.
 		_o_return_unset;
 	}
+	if (mShared)
+	{
+		if (!Unshare())
+			_o_throw_oom;
+		item = mItem + pos;
+	}
 	// Set return value to the removed item.
 	item->ReturnMove(aResultToken);
 	// Copy item to temporary memory so that Free() and Release() can be postponed,
@@ -1547,6 +1610,8 @@ void Object::Clone(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType
 	auto clone = new Object();
 	if (!CloneTo(*clone))
 		_o_throw_oom;	
+	if (AllocProfiler::sEnabled)
+		AllocProfiler::Created(clone, mBase, sizeof(Object));
 	_o_return(clone);
 }
 
@@ -1555,6 +1620,8 @@ void Map::Clone(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType *a
 	auto clone = new Map();
 	if (!CloneTo(*clone))
 		_o_throw_oom;
+	if (AllocProfiler::sEnabled)
+		AllocProfiler::Created(clone, mBase, sizeof(Map));
 	_o_return(clone);
 }
 
@@ -1853,6 +1920,8 @@ ResultType Object::New(ResultToken &aResultToken, ExprTokenType *aParam[], int a
 		Release();
 		return FAIL;
 	}
+	if (AllocProfiler::sEnabled)
+		AllocProfiler::SetClass(this, proto);
 	if (auto si = proto->GetStructInfo()) // Typed properties are defined.
 	{
 		if (!mData && si->size)
@@ -2247,6 +2316,8 @@ TypedProperty::~TypedProperty()
 
 ResultType Array::SetCapacity(index_t aNewCapacity)
 {
+	if (!Unshare())
+		return FAIL;
 	if (mLength > aNewCapacity)
 		RemoveAt(aNewCapacity, mLength - aNewCapacity);
 	auto new_item = (Variant *)realloc(mItem, sizeof(Variant) * aNewCapacity);
@@ -2258,7 +2329,10 @@ ResultType Array::SetCapacity(index_t aNewCapacity)
 }
 
 ResultType Array::EnsureCapacity(index_t aRequired)
+// Also ensures mItem isn't shared, since callers are about to modify it.
 {
+	if (!Unshare())
+		return FAIL;
 	if (mCapacity >= aRequired)
 		return OK;
 	// Simple doubling of previous capacity, if that's enough, seems adequate.
@@ -2300,8 +2374,10 @@ template ResultType Array::InsertAt(index_t, ExprTokenType *[], index_t);
 template ResultType Array::InsertAt(index_t, ExprTokenType [], index_t);
 
 void Array::RemoveAt(index_t aIndex, index_t aCount)
+// Caller must ensure mItem isn't shared.
 {
 	ASSERT(aIndex + aCount <= mLength);
+	ASSERT(!mShared);
 
 	for (index_t i = 0; i < aCount; ++i)
 	{
@@ -2316,6 +2392,8 @@ void Array::RemoveAt(index_t aIndex, index_t aCount)
 
 ResultType Array::SetLength(index_t aNewLength)
 {
+	if (!Unshare())
+		return FAIL;
 	if (mLength > aNewLength)
 	{
 		RemoveAt(aNewLength, mLength - aNewLength);
@@ -2333,14 +2411,60 @@ ResultType Array::SetLength(index_t aNewLength)
 
 Array::~Array()
 {
+	if (mShared)
+	{
+		if (*mShared > 1)
+		{
+			--*mShared; // Leave the items to the other Arrays which share them.
+			return;
+		}
+		free(mShared);
+		mShared = nullptr;
+	}
 	RemoveAt(0, mLength);
 	free(mItem);
 }
 
+ResultType Array::Unshare(index_t aCapacity)
+// Gives this Array its own copy of mItem, which is shared with one or more clones.
+// Caller must ensure aCapacity >= mLength.
+{
+	ASSERT(mShared && aCapacity >= mLength);
+	if (*mShared == 1) // The other Arrays have since made their own copies or been deleted.
+	{
+		free(mShared);
+		mShared = nullptr;
+		return OK;
+	}
+	auto item = (Variant *)malloc(sizeof(Variant) * aCapacity);
+	if (!item)
+		return FAIL;
+	index_t i;
+	for (i = 0; i < mLength; ++i)
+		if (!item[i].InitCopy(mItem[i]))
+			break;
+	if (i < mLength)
+	{
+		// Discard the partial copy and leave mItem shared.  Since mItem still holds a reference
+		// to each object, this can't cause re-entry via __delete.
+		for (index_t j = 0; j <= i; ++j) // Include the item which failed, since it may hold an empty String.
+			item[j].Free();
+		free(item);
+		return FAIL;
+	}
+	--*mShared;
+	mShared = nullptr;
+	mItem = item;
+	mCapacity = aCapacity;
+	return OK;
+}
+
 Array *Array::Create(ExprTokenType *aValue[], index_t aCount)
 {
 	auto arr = new Array();
 	arr->SetBase(Array::sPrototype);
+	if (AllocProfiler::sEnabled)
+		AllocProfiler::Created(arr, Array::sPrototype, sizeof(Array));
 	if (!aCount || arr->InsertAt(0, aValue, aCount))
 		return arr;
 	arr->Release();
@@ -2352,20 +2476,25 @@ Array *Array::Clone()
 	auto arr = new Array();
 	if (!CloneTo(*arr))
 		return nullptr; // CloneTo() released arr.
-	if (!arr->SetCapacity(mCapacity))
-		return nullptr;
-	for (index_t i = 0; i < mLength; ++i)
+	if (AllocProfiler::sEnabled)
+		AllocProfiler::Created(arr, mBase, sizeof(Array));
+	if (!mLength)
+		return arr;
+	// Rather than copying each item, share mItem with the clone until one of them is modified.
+	if (!mShared)
 	{
-		auto &new_item = arr->mItem[arr->mLength++];
-		new_item.Minit();
-		ExprTokenType value;
-		mItem[i].ToToken(value);
-		if (!new_item.Assign(value))
+		if (  !(mShared = (ULONG *)malloc(sizeof(ULONG)))  )
 		{
 			arr->Release();
 			return nullptr;
 		}
+		*mShared = 1;
 	}
+	++*mShared;
+	arr->mShared = mShared;
+	arr->mItem = mItem;
+	arr->mLength = mLength;
+	arr->mCapacity = mCapacity;
 	return arr;
 }
 
@@ -2404,6 +2533,8 @@ void Array::Invoke(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType
 		auto index = ParamToZeroIndex(*aParam[IS_INVOKE_SET ? 1 : 0]);
 		if (index >= mLength)
 			_o_throw(ERR_INVALID_INDEX, *aParam[IS_INVOKE_SET ? 1 : 0], ErrorPrototype::Index);
+		if (IS_INVOKE_SET && !Unshare())
+			_o_throw_oom;
 		auto &item = mItem[index];
 		if (IS_INVOKE_SET)
 		{
@@ -2487,6 +2618,8 @@ void Array::Invoke(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType
 		}
 		if (index + count > mLength)
 			_o_throw_param(1);
+		if (!Unshare())
+			_o_throw_oom;
 
 		if (return_it) // Remove-and-return mode.
 		{
@@ -2510,6 +2643,8 @@ void Array::Invoke(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType
 		auto index = ParamToZeroIndex(*aParam[0]);
 		if (index >= mLength)
 			_o_throw_param(0);
+		if (!Unshare())
+			_o_throw_oom;
 		mItem[index].ReturnMove(aResultToken);
 		mItem[index].AssignMissing();
 		_o_return_retval;
@@ -2601,6 +2736,317 @@ ResultType IndexEnumerator::Next(Var *var0, Var *var1)
 }
 
 
+IndexEnumerator::Callback GetDirectEnumerator(IObject *aEnumerable, Object *&aObject)
+{
+	IndexEnumerator::Callback get_item;
+	ObjectMethod bim;
+	int mid;
+	if (auto arr = dynamic_cast<Array *>(aEnumerable))
+	{
+		aObject = arr;
+		bim = static_cast<ObjectMethod>(&Array::Invoke);
+		mid = Array::M___Enum;
+		get_item = static_cast<IndexEnumerator::Callback>(&Array::GetEnumItem);
+	}
+	else if (auto map = dynamic_cast<Map *>(aEnumerable))
+	{
+		aObject = map;
+		bim = static_cast<ObjectMethod>(&Map::__Enum);
+		mid = 0;
+		get_item = static_cast<IndexEnumerator::Callback>(&Map::GetEnumItem);
+	}
+	else
+		return nullptr;
+	// __Enum might have been redefined by a subclass, the instance or even the prototype itself,
+	// so verify that the method which would be called is the original built-in one.
+	auto method = dynamic_cast<BuiltInMethod *>(aObject->GetMethod(_T("__Enum")));
+	if (!method || method->mBIM != bim || method->mMID != mid)
+		return nullptr;
+	return get_item;
+}
+
+
+ObjectMember EnumBase::sMembers[] =
+{
+	Object_Method(Chain, 1, 1),
+	Object_Method(Filter, 1, 1),
+	Object_Method(Map, 1, 1),
+	Object_Method(Skip, 1, 1),
+	Object_Method(Take, 1, 1),
+	Object_Method(Zip, 1, 1)
+};
+
+void EnumBase::Invoke(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType *aParam[], int aParamCount)
+{
+	int var_count = SourceVarCount();
+	switch (aID)
+	{
+	case M_Map:
+	case M_Filter:
+	{
+		auto func = ParamIndexToObject(0);
+		if (!func)
+			_o_throw_param(0);
+		if (!ValidateFunctor(func, var_count, aResultToken))
+			return;
+		if (aID == M_Map)
+			_o_return(new MapEnum(this, var_count, func));
+		_o_return(new FilterEnum(this, var_count, func));
+	}
+
+	case M_Take:
+	case M_Skip:
+	{
+		Throw_if_Param_NaN(0);
+		auto count = ParamIndexToInt64(0);
+		if (count < 0)
+			_o_throw_param(0);
+		_o_return(new TakeSkipEnum(this, var_count, count, aID == M_Skip));
+	}
+
+	case M_Zip:
+	{
+		auto e = new ZipEnum(this);
+		auto result = e->Init(*aParam[0]);
+		if (result != OK)
+		{
+			e->Release();
+			aResultToken.SetExitResult(result);
+			return;
+		}
+		_o_return(e);
+	}
+
+	case M_Chain:
+	{
+		auto e = new ChainEnum(this, var_count);
+		auto result = e->Init(*aParam[0]);
+		if (result != OK)
+		{
+			e->Release();
+			aResultToken.SetExitResult(result);
+			return;
+		}
+		_o_return(e);
+	}
+	}
+}
+
+
+BIF_DECL(BIF_Range)
+{
+	// Range(Stop) is equivalent to Range(1, Stop).
+	for (int i = 0; i < aParamCount; ++i)
+		if (!ParamIndexIsOmitted(i))
+			Throw_if_Param_NaN(i);
+	__int64 start = 1, stop, step = ParamIndexToOptionalInt64(2, 1);
+	if (aParamCount > 1 && !ParamIndexIsOmitted(1))
+	{
+		start = ParamIndexToOptionalInt64(0, 1);
+		stop = ParamIndexToInt64(1);
+	}
+	else if (!ParamIndexIsOmitted(0))
+		stop = ParamIndexToInt64(0);
+	else
+		_f_throw_param(0);
+	if (!step)
+		_f_throw_param(2);
+	_f_return(new RangeEnum(start, stop, step));
+}
+
+
+void EnumSource::Init(IObject *aEnum, int aVarCount)
+{
+	aEnum->AddRef();
+	mEnum = aEnum;
+	mNative = EnumBase::ToNative(aEnum);
+	mVarCount = aVarCount;
+}
+
+ResultType EnumSource::Init(ExprTokenType &aEnumerable, int aVarCount)
+{
+	auto result = GetEnumerator(mEnum, aEnumerable, aVarCount, true);
+	if (result != OK)
+	{
+		mEnum = nullptr;
+		return result;
+	}
+	mNative = EnumBase::ToNative(mEnum);
+	mVarCount = aVarCount;
+	return OK;
+}
+
+EnumSource::~EnumSource()
+{
+	if (mEnum)
+		mEnum->Release();
+	for (int i = 0; i < _countof(mVar); ++i)
+		if (mVar[i])
+			mVar[i]->Release();
+}
+
+ResultType EnumSource::Next(Var *aVar0, Var *aVar1)
+{
+	if (mNative)
+		return mNative->Next(aVar0, aVar1);
+	// Reuse the same VarRefs for each item, so that the only per-item cost beyond the call
+	// itself is copying each value into the caller's variables.
+	ExprTokenType tvar[2], *param[2];
+	for (int i = 0; i < mVarCount; ++i)
+	{
+		if (!mVar[i])
+			mVar[i] = new VarRef();
+		tvar[i].SetValue(mVar[i]);
+		param[i] = &tvar[i];
+	}
+	auto result = CallEnumerator(mEnum, param, mVarCount, true);
+	if (result == CONDITION_TRUE)
+	{
+		if (aVar0)
+			aVar0->Assign(*mVar[0]);
+		if (aVar1 && mVarCount > 1)
+			aVar1->Assign(*mVar[1]);
+	}
+	return result;
+}
+
+
+MapEnum::~MapEnum()
+{
+	mFunc->Release();
+	for (int i = 0; i < _countof(mItem); ++i)
+		mItem[i].Free(VAR_ALWAYS_FREE | VAR_CLEAR_ALIASES);
+}
+
+ResultType MapEnum::Next(Var *aVar0, Var *aVar1)
+{
+	auto result = mSource.Next(&mItem[0], mSourceVarCount > 1 ? &mItem[1] : nullptr);
+	if (result != CONDITION_TRUE)
+		return result;
+	ExprTokenType value[2], *param[] = { value, value + 1 };
+	for (int i = 0; i < mSourceVarCount; ++i)
+		mItem[i].ToTokenSkipAddRef(value[i]);
+	FuncResult result_token;
+	result = mFunc->Invoke(result_token, IT_CALL, nullptr, ExprTokenType(mFunc), param, mSourceVarCount);
+	if (result == FAIL || result == EARLY_EXIT)
+		return result;
+	if (aVar0)
+	{
+		if (result_token.mem_to_free) // Transfer ownership of the new string rather than copying it.
+		{
+			ASSERT(result_token.symbol == SYM_STRING && result_token.mem_to_free == result_token.marker);
+			aVar0->AcceptNewMem(result_token.mem_to_free, result_token.marker_length);
+			return CONDITION_TRUE;
+		}
+		aVar0->Assign(result_token);
+	}
+	result_token.Free();
+	return CONDITION_TRUE;
+}
+
+
+FilterEnum::~FilterEnum()
+{
+	mFunc->Release();
+	for (int i = 0; i < _countof(mItem); ++i)
+		mItem[i].Free(VAR_ALWAYS_FREE | VAR_CLEAR_ALIASES);
+}
+
+ResultType FilterEnum::Next(Var *aVar0, Var *aVar1)
+{
+	ExprTokenType value[2], *param[] = { value, value + 1 };
+	for (;;)
+	{
+		auto result = mSource.Next(&mItem[0], mParamCount > 1 ? &mItem[1] : nullptr);
+		if (result != CONDITION_TRUE)
+			return result;
+		for (int i = 0; i < mParamCount; ++i)
+			mItem[i].ToTokenSkipAddRef(value[i]);
+		FuncResult result_token;
+		result = mFunc->Invoke(result_token, IT_CALL, nullptr, ExprTokenType(mFunc), param, mParamCount);
+		if (result == FAIL || result == EARLY_EXIT)
+			return result;
+		bool matched = TokenToBOOL(result_token);
+		result_token.Free();
+		if (matched)
+			break;
+	}
+	if (aVar0)
+		aVar0->Assign(mItem[0]);
+	if (aVar1 && mParamCount > 1)
+		aVar1->Assign(mItem[1]);
+	return CONDITION_TRUE;
+}
+
+
+ResultType TakeSkipEnum::Next(Var *aVar0, Var *aVar1)
+{
+	if (mSkip)
+	{
+		for ( ; mCount > 0; --mCount)
+		{
+			auto result = mSource.Next(nullptr, nullptr);
+			if (result != CONDITION_TRUE)
+				return result;
+		}
+		return mSource.Next(aVar0, aVar1);
+	}
+	if (mCount <= 0)
+		return CONDITION_FALSE;
+	--mCount;
+	return mSource.Next(aVar0, aVar1);
+}
+
+
+ResultType ZipEnum::Next(Var *aVar0, Var *aVar1)
+{
+	auto result = mSource.Next(aVar0, nullptr);
+	if (result != CONDITION_TRUE)
+		return result;
+	return mOther.Next(aVar1, nullptr);
+}
+
+
+ResultType ChainEnum::Next(Var *aVar0, Var *aVar1)
+{
+	if (!mSourceDone)
+	{
+		auto result = mSource.Next(aVar0, aVar1);
+		if (result != CONDITION_FALSE)
+			return result;
+		mSourceDone = true;
+	}
+	return mOther.Next(aVar0, aVar1);
+}
+
+
+ResultType RangeEnum::Next(Var *aVar0, Var *aVar1)
+{
+	if (mDone || (mStep > 0 ? mNext > mStop : mNext < mStop))
+		return CONDITION_FALSE;
+	++mIndex;
+	if (aVar1)
+	{
+		// Put the index first, only when there are two parameters (consistent with Array).
+		if (aVar0)
+			aVar0->Assign(mIndex);
+		aVar0 = aVar1;
+	}
+	if (aVar0)
+		aVar0->Assign(mNext);
+	// Compare the distance to mStop before stepping, since mNext + mStep may overflow near
+	// the limits.  Unsigned arithmetic is used because the distance may exceed _I64_MAX.
+	unsigned __int64 remaining = mStep > 0 ? (unsigned __int64)mStop - (unsigned __int64)mNext
+		: (unsigned __int64)mNext - (unsigned __int64)mStop;
+	unsigned __int64 step = mStep > 0 ? (unsigned __int64)mStep : 0 - (unsigned __int64)mStep;
+	if (remaining < step)
+		mDone = true;
+	else
+		mNext += mStep;
+	return CONDITION_TRUE;
+}
+
+
 ResultType Object::GetEnumProp(UINT &aIndex, Var *aName, Var *aVal, int aVarCount)
 {
 	for  ( ; aIndex < mFields.Length(); ++aIndex)
@@ -2914,6 +3360,10 @@ bool Object::SetInternalCapacity(index_t new_capacity)
 bool Map::SetInternalCapacity(index_t new_capacity)
 // Caller *must* ensure new_capacity >= 1 && new_capacity >= mCount.
 {
+	if (mShared && !Unshare(new_capacity))
+		return false;
+	if (new_capacity == mCapacity) // Possibly due to Unshare() above.
+		return true;
 	Pair *new_fields = (Pair *)realloc(mItem, new_capacity * sizeof(Pair));
 	if (!new_fields)
 		return false;
@@ -3539,7 +3989,7 @@ void Object::CreateRootPrototypes()
 		{_T("Func"), &Func::sPrototype, no_ctor, Func::sMembers, _countof(Func::sMembers), {
 			{_T("BoundFunc"), &BoundFunc::sPrototype},
 			{_T("Closure"), &Closure::sPrototype},
-			{_T("Enumerator"), &EnumBase::sPrototype}
+			{_T("Enumerator"), &EnumBase::sPrototype, no_ctor, EnumBase::sMembers, _countof(EnumBase::sMembers)}
 		}},
 		{_T("Gui"), &GuiType::sPrototype, NewObject<GuiType>
 			, GuiType::sMembers, GuiType::sMemberCount},
@@ -3552,7 +4002,9 @@ void Object::CreateRootPrototypes()
 			{_T("MenuBar"), &UserMenu::sBarPrototype, NewObject<UserMenu::Bar>}
 		}},
 		{_T("RegExMatchInfo"), &RegExMatchObject::sPrototype, no_ctor
-			, RegExMatchObject::sMembers, _countof(RegExMatchObject::sMembers)}
+			, RegExMatchObject::sMembers, _countof(RegExMatchObject::sMembers)},
+		{_T("WinCriteria"), &WinCriteria::sPrototype, NewObject<WinCriteria>
+			, WinCriteria::sMembers, WinCriteria::sMemberCount}
 	});
 
 	// Parameter counts are specified for static Call in the following classes
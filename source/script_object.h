@@ -592,6 +592,13 @@ private:
 	Variant *mItem = nullptr;
 	index_t mLength = 0, mCapacity = 0;
 
+	// Clone() shares mItem with the clone rather than copying each item.  mShared points to the
+	// number of Arrays sharing mItem, or is null if mItem belongs to this Array alone.  Anything
+	// which modifies mItem, mLength or mCapacity must first call Unshare().
+	ULONG *mShared = nullptr;
+	ResultType Unshare(index_t aCapacity);
+	ResultType Unshare() { return mShared ? Unshare(mCapacity) : OK; }
+
 	ResultType SetCapacity(index_t aNewCapacity);
 	ResultType EnsureCapacity(index_t aRequired);
 
@@ -682,6 +689,13 @@ class Map : public Object
 	Pair *mItem = nullptr;
 	index_t mCount = 0, mCapacity = 0;
 
+	// Clone() shares mItem with the clone rather than copying each item.  mShared points to the
+	// number of Maps sharing mItem, or is null if mItem belongs to this Map alone.  Anything which
+	// modifies mItem, mCount, mCapacity or the key offsets below must first call Unshare().
+	ULONG *mShared = nullptr;
+	bool Unshare(index_t aCapacity);
+	bool Unshare() { return !mShared || Unshare(mCapacity); }
+
 	// Holds the index of the first key of a given type within mItem.  Must be in the order: int, object, string.
 	// Compared to storing the key-type with each key-value pair, this approach saves 4 bytes per key (excluding
 	// the 8 bytes taken by the two fields below) and speeds up lookups since only the section within mItem
@@ -719,9 +733,9 @@ class Map : public Object
 
 	Map *CloneTo(Map &aTo);
 
+public:
 	ResultType GetEnumItem(UINT &aIndex, Var *, Var *, int);
 
-public:
 	static Map *Create(ExprTokenType *aParam[] = NULL, int aParamCount = 0);
 
 	bool HasItem(ExprTokenType &aKey)
@@ -752,6 +766,8 @@ public:
 
 	bool SetItem(ExprTokenType &aKey, ExprTokenType &aValue)
 	{
+		if (!Unshare())
+			return false;
 		index_t insert_pos;
 		TCHAR buf[MAX_NUMBER_SIZE];
 		SymbolType key_type;
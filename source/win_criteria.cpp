@@ -0,0 +1,109 @@
+#include "stdafx.h" // pre-compiled headers
+#include "defines.h"
+#include "globaldata.h"
+#include "script.h"
+#include "window.h"
+
+#include "script_object.h"
+#include "script_func_impl.h"
+#include "win_criteria.h"
+
+
+ObjectMemberMd WinCriteria::sMembers[] =
+{
+	md_member(WinCriteria, __New, CALL, (In_Opt, String, WinTitle), (In_Opt, String, WinText), (In_Opt, String, ExcludeTitle), (In_Opt, String, ExcludeText)),
+
+	md_property_get(WinCriteria, ExcludeText, String),
+	md_property_get(WinCriteria, ExcludeTitle, String),
+	md_property_get(WinCriteria, WinText, String),
+	md_property_get(WinCriteria, WinTitle, String)
+};
+int WinCriteria::sMemberCount = _countof(sMembers);
+
+Object *WinCriteria::sPrototype;
+
+
+Object *WinCriteria::Create()
+{
+	return new WinCriteria();
+}
+
+
+WinCriteria *WinCriteria::FromToken(ExprTokenType *aToken)
+{
+	return aToken ? dynamic_cast<WinCriteria *>(TokenToObject(*aToken)) : nullptr;
+}
+
+
+void WinCriteria::Free()
+{
+	free(mTitle);
+	free(mText);
+	free(mExcludeTitle);
+	free(mExcludeText);
+	free(mCriterionBuf);
+	mTitle = mText = mExcludeTitle = mExcludeText = mCriterionBuf = nullptr;
+	RegExFree(mTitleRegEx);
+	RegExFree(mClassRegEx);
+	RegExFree(mPathRegEx);
+	RegExFree(mExcludeTitleRegEx);
+	mTitleRegEx = mClassRegEx = mPathRegEx = mExcludeTitleRegEx = nullptr;
+	mRegExCompiled = false;
+	mParsed = false;
+}
+
+
+FResult WinCriteria::__New(optl<StrArg> aWinTitle, optl<StrArg> aWinText, optl<StrArg> aExcludeTitle, optl<StrArg> aExcludeText)
+{
+	// The criteria can't be changed once set, since a thread interrupted during a search might
+	// still be using them.
+	if (mTitle)
+		return FError(ERR_INVALID_USAGE);
+	if (   !(mTitle = _tcsdup(aWinTitle.value_or_empty()))
+		|| !(mText = _tcsdup(aWinText.value_or_empty()))
+		|| !(mExcludeTitle = _tcsdup(aExcludeTitle.value_or_empty()))
+		|| !(mExcludeText = _tcsdup(aExcludeText.value_or_empty()))   )
+		return FR_E_OUTOFMEM;
+
+	// The active window and the Last Found Window are handled by WinExist() and WinActive() before
+	// the criteria are parsed, so leave those to be passed as strings.
+	if (USE_FOREGROUND_WINDOW(mTitle, mText, mExcludeTitle, mExcludeText)
+		|| !(*mTitle || *mText || *mExcludeTitle || *mExcludeText))
+		return OK;
+
+	WindowSearch ws;
+	if (!ws.SetCriteria(*g, mTitle, mText, mExcludeTitle, mExcludeText))
+		return OK; // An ahk_group or ahk_id which doesn't exist yet, so parse again each time.
+	mCriteria = ws.mCriteria;
+	mCriterionTitle = (mCriteria & CRITERION_TITLE) ? ws.mCriterionTitle : _T("");
+	mCriterionTitleLength = (mCriteria & CRITERION_TITLE) ? ws.mCriterionTitleLength : 0;
+	mCriterionClass = (mCriteria & CRITERION_CLASS) ? ws.mCriterionClass : _T("");
+	mCriterionPath = (mCriteria & CRITERION_PATH) ? ws.mCriterionPath : _T("");
+	mCriterionExcludeTitleLength = ws.mCriterionExcludeTitleLength;
+	mCriterionHwnd = (mCriteria & CRITERION_ID) ? ws.mCriterionHwnd : NULL;
+	mCriterionPID = (mCriteria & CRITERION_PID) ? ws.mCriterionPID : 0;
+	mCriterionGroup = (mCriteria & CRITERION_GROUP) ? ws.mCriterionGroup : NULL;
+	// Take ownership of the buffer which the criteria point into, if it was used.
+	mCriterionBuf = ws.mCriterionBuf;
+	ws.mCriterionBuf = NULL;
+	mParsed = true;
+	return OK;
+}
+
+
+void WinCriteria::CompileRegEx()
+// Compiles each pattern which will be matched in RegEx mode.  A pattern which fails to compile
+// is left NULL, so that WindowSearch falls back to RegExMatch(), which treats it as no match.
+{
+	if (mRegExCompiled)
+		return;
+	mRegExCompiled = true;
+	if (*mCriterionTitle)
+		mTitleRegEx = RegExCompile(mCriterionTitle);
+	if (mCriteria & CRITERION_CLASS)
+		mClassRegEx = RegExCompile(mCriterionClass);
+	if (mCriteria & CRITERION_PATH)
+		mPathRegEx = RegExCompile(mCriterionPath);
+	if (*mExcludeTitle)
+		mExcludeTitleRegEx = RegExCompile(mExcludeTitle);
+}
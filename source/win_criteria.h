@@ -0,0 +1,59 @@
+#pragma once
+
+//
+// WinCriteria: A WinTitle, WinText, ExcludeTitle and ExcludeText which are parsed once and can then
+// be passed as the WinTitle parameter of any window function, so that scripts which poll windows
+// in a loop don't parse the "ahk_" criteria on every call.  WindowSearch::SetCriteria() applies
+// the parsed criteria directly, and with SetTitleMatchMode RegEx, the title, class, exe and
+// ExcludeTitle patterns are compiled on first use and kept, rather than being looked up in the
+// shared regex cache for each window.  Criteria which can't be parsed in advance (the active
+// window "A", blank criteria, or an ahk_group or ahk_id which doesn't exist yet) are passed to
+// the window functions as strings each time, so behave the same as before.
+//
+class WinCriteria : public Object
+{
+	LPTSTR mCriterionBuf = nullptr; // The parsed criteria may point into this or mTitle.
+	bool mRegExCompiled = false;
+
+	void Free();
+
+public:
+	LPTSTR mTitle = nullptr, mText = nullptr, mExcludeTitle = nullptr, mExcludeText = nullptr;
+	bool mParsed = false; // If false, the members below aren't valid.
+
+	// The results of WindowSearch::SetCriteria(), aside from those which depend on settings:
+	DWORD mCriteria;
+	LPCTSTR mCriterionTitle, mCriterionClass, mCriterionPath;
+	size_t mCriterionTitleLength, mCriterionExcludeTitleLength;
+	HWND mCriterionHwnd;
+	DWORD mCriterionPID;
+	WinGroup *mCriterionGroup;
+
+	// Compiled by CompileRegEx() for TitleMatchMode RegEx, or NULL if not compiled.
+	CompiledRegEx *mTitleRegEx = nullptr, *mClassRegEx = nullptr, *mPathRegEx = nullptr, *mExcludeTitleRegEx = nullptr;
+
+	static Object *sPrototype;
+	static ObjectMemberMd sMembers[];
+	static int sMemberCount;
+
+	WinCriteria()
+	{
+		SetBase(sPrototype);
+	}
+	~WinCriteria()
+	{
+		Free();
+	}
+
+	static Object *Create();
+	static WinCriteria *FromToken(ExprTokenType *aToken);
+
+	void CompileRegEx();
+
+	FResult __New(optl<StrArg> aWinTitle, optl<StrArg> aWinText, optl<StrArg> aExcludeTitle, optl<StrArg> aExcludeText);
+
+	FResult get_WinTitle(StrRet &aRetVal) { aRetVal.SetTemp(mTitle); return OK; }
+	FResult get_WinText(StrRet &aRetVal) { aRetVal.SetTemp(mText); return OK; }
+	FResult get_ExcludeTitle(StrRet &aRetVal) { aRetVal.SetTemp(mExcludeTitle); return OK; }
+	FResult get_ExcludeText(StrRet &aRetVal) { aRetVal.SetTemp(mExcludeText); return OK; }
+};
@@ -20,6 +20,7 @@ GNU General Public License for more details.
 #include "application.h" // for MsgSleep()
 #include "psapi.h" // for ahk_exe
 #include <dwmapi.h>
+#include "win_criteria.h"
 
 
 HWND WinActivate(global_struct &aSettings, LPTSTR aTitle, LPTSTR aText, LPTSTR aExcludeTitle, LPTSTR aExcludeText
@@ -472,33 +473,29 @@ HWND WinActive(global_struct &aSettings, LPCTSTR aTitle, LPCTSTR aText, LPCTSTR
 
 
 
-HWND WinExist(global_struct &aSettings, LPCTSTR aTitle, LPCTSTR aText, LPCTSTR aExcludeTitle, LPCTSTR aExcludeText
-	, bool aFindLastMatch, bool aUpdateLastUsed, HWND aAlreadyVisited[], int aAlreadyVisitedCount)
-// This function must be kept thread-safe because it may be called (indirectly) by hook thread too.
-// In addition, it must not change the value of anything in aSettings except when aUpdateLastUsed==true.
+HWND WinActive(global_struct &aSettings, WinCriteria &aCriteria, bool aUpdateLastUsed)
+// Same as the other overload, but with criteria which were parsed in advance.  Not thread-safe.
 {
-	HWND target_window;
-	if (USE_FOREGROUND_WINDOW(aTitle, aText, aExcludeTitle, aExcludeText))
-	{
-		// User asked us if the "active" window exists, which is true if it's not a
-		// hidden window or DetectHiddenWindows is ON:
-		SET_TARGET_TO_ALLOWABLE_FOREGROUND(aSettings.DetectHiddenWindows)
-		// Updating LastUsed to be hwnd even if it's NULL seems best for consistency?
-		// UPDATE: No, it's more flexible not to never set it to NULL, because there
-		// will be times when the old value is still useful:
-		UPDATE_AND_RETURN_LAST_USED_WINDOW(target_window);
-	}
+	if (!aCriteria.mParsed) // Includes the "A" and Last Found Window cases handled by the other overload.
+		return WinActive(aSettings, aCriteria.mTitle, aCriteria.mText, aCriteria.mExcludeTitle, aCriteria.mExcludeText
+			, aUpdateLastUsed);
+	HWND fore_win = GetForegroundWindow();
+	if (!fore_win || !aSettings.DetectWindow(fore_win))
+		return NULL;
+	WindowSearch ws;
+	ws.SetCandidate(fore_win);
+	if (ws.SetCriteria(aSettings, aCriteria) && ws.IsMatch())
+		UPDATE_AND_RETURN_LAST_USED_WINDOW(fore_win) // This also does a "return".
+	return NULL;
+}
 
-	if (!(*aTitle || *aText || *aExcludeTitle || *aExcludeText))
-		// User passed no params, so use the window most recently found by WinExist().
-		// It's correct to do this even in this function because it's called by
-		// WINWAITCLOSE specifically to discover if the Last-Used window still exists.
-		return GetValidLastUsedWindow(aSettings);
 
-	WindowSearch ws;
-	if (!ws.SetCriteria(aSettings, aTitle, aText, aExcludeTitle, aExcludeText)) // No match is possible with these criteria.
-		return NULL;
 
+static HWND WinExistSearch(WindowSearch &ws, global_struct &aSettings, bool aFindLastMatch, bool aUpdateLastUsed
+	, HWND aAlreadyVisited[], int aAlreadyVisitedCount)
+// Finds a window matching the criteria previously set for ws, for both overloads of WinExist().
+// This function must be kept thread-safe because it may be called (indirectly) by hook thread too.
+{
 	ws.mFindLastMatch = aFindLastMatch;
 	ws.mAlreadyVisited = aAlreadyVisited;
 	ws.mAlreadyVisitedCount = aAlreadyVisitedCount;
@@ -525,13 +522,59 @@ HWND WinExist(global_struct &aSettings, LPCTSTR aTitle, LPCTSTR aText, LPCTSTR a
 		//else fall through to the section below, since ws.mFoundCount and ws.mFoundParent were set by ws.IsMatch().
 	}
 	else // aWinTitle doesn't start with "ahk_id".  Try to find a matching window.
-		EnumWindows(EnumParentFind, (LPARAM)&ws);
+		WindowSnapshot::Enum(ws, EnumParentFind);
 
 	UPDATE_AND_RETURN_LAST_USED_WINDOW(ws.mFoundParent) // This also does a "return".
 }
 
 
 
+HWND WinExist(global_struct &aSettings, LPCTSTR aTitle, LPCTSTR aText, LPCTSTR aExcludeTitle, LPCTSTR aExcludeText
+	, bool aFindLastMatch, bool aUpdateLastUsed, HWND aAlreadyVisited[], int aAlreadyVisitedCount)
+// This function must be kept thread-safe because it may be called (indirectly) by hook thread too.
+// In addition, it must not change the value of anything in aSettings except when aUpdateLastUsed==true.
+{
+	HWND target_window;
+	if (USE_FOREGROUND_WINDOW(aTitle, aText, aExcludeTitle, aExcludeText))
+	{
+		// User asked us if the "active" window exists, which is true if it's not a
+		// hidden window or DetectHiddenWindows is ON:
+		SET_TARGET_TO_ALLOWABLE_FOREGROUND(aSettings.DetectHiddenWindows)
+		// Updating LastUsed to be hwnd even if it's NULL seems best for consistency?
+		// UPDATE: No, it's more flexible not to never set it to NULL, because there
+		// will be times when the old value is still useful:
+		UPDATE_AND_RETURN_LAST_USED_WINDOW(target_window);
+	}
+
+	if (!(*aTitle || *aText || *aExcludeTitle || *aExcludeText))
+		// User passed no params, so use the window most recently found by WinExist().
+		// It's correct to do this even in this function because it's called by
+		// WINWAITCLOSE specifically to discover if the Last-Used window still exists.
+		return GetValidLastUsedWindow(aSettings);
+
+	WindowSearch ws;
+	if (!ws.SetCriteria(aSettings, aTitle, aText, aExcludeTitle, aExcludeText)) // No match is possible with these criteria.
+		return NULL;
+
+	return WinExistSearch(ws, aSettings, aFindLastMatch, aUpdateLastUsed, aAlreadyVisited, aAlreadyVisitedCount);
+}
+
+
+
+HWND WinExist(global_struct &aSettings, WinCriteria &aCriteria, bool aFindLastMatch, bool aUpdateLastUsed)
+// Same as the other overload, but with criteria which were parsed in advance.  Not thread-safe.
+{
+	if (!aCriteria.mParsed) // Includes the "A" and Last Found Window cases handled by the other overload.
+		return WinExist(aSettings, aCriteria.mTitle, aCriteria.mText, aCriteria.mExcludeTitle, aCriteria.mExcludeText
+			, aFindLastMatch, aUpdateLastUsed);
+	WindowSearch ws;
+	if (!ws.SetCriteria(aSettings, aCriteria)) // No match is possible with these criteria.
+		return NULL;
+	return WinExistSearch(ws, aSettings, aFindLastMatch, aUpdateLastUsed, NULL, 0);
+}
+
+
+
 HWND GetValidLastUsedWindow(global_struct &aSettings)
 // If the last found window is one of the script's own GUI windows, it is considered valid even if
 // DetectHiddenWindows is ON.  Note that this exemption does not apply to things like "IfWinExist,
@@ -561,7 +604,7 @@ BOOL CALLBACK EnumParentFind(HWND aWnd, LPARAM lParam)
 // through every window), it returns TRUE:
 {
 	WindowSearch &ws = *(WindowSearch *)lParam;  // For performance and convenience.
-	if (!ws.mSettings->DetectWindow(aWnd)) // Skip windows the script isn't supposed to detect.
+	if (!WindowSnapshot::DetectWindow(ws, aWnd)) // Skip windows the script isn't supposed to detect.
 		return TRUE;
 	ws.SetCandidate(aWnd);
 	// If this window doesn't match, continue searching for more windows (via TRUE).  Likewise, if
@@ -1375,6 +1418,8 @@ ResultType WindowSearch::SetCriteria(ScriptThreadSettings &aSettings, LPCTSTR aT
 	mCriterionText = aText;
 	mCriterionExcludeText = aExcludeText;
 	mSettings = &aSettings;
+	mUseSnapshot = WindowSnapshot::Available();
+	mCompiled = NULL;
 
 	DWORD orig_criteria = mCriteria, this_criterion = CRITERION_TITLE, next_criterion;
 	LPCTSTR start, end, value, next_value = nullptr;
@@ -1513,12 +1558,50 @@ void WindowSearch::SetCriteria(global_struct &aSettings, WinGroup &aGroup)
 	mCriterionText = _T("");
 	mCriterionExcludeText = _T("");
 	mSettings = &aSettings;
+	mUseSnapshot = WindowSnapshot::Available();
+	mCompiled = NULL;
 	mCriterionGroup = &aGroup;
 	mCriteria = CRITERION_GROUP;
 }
 
 
 
+ResultType WindowSearch::SetCriteria(ScriptThreadSettings &aSettings, WinCriteria &aCriteria)
+// Same as the other overload, but applies criteria which were parsed by WinCriteria::__New().
+// aCriteria must be kept alive and unmodified for the duration of the search.
+{
+	ASSERT(aCriteria.mParsed);
+	// As in the other overload, check ahk_id each time since the window may have been destroyed.
+	if ((aCriteria.mCriteria & CRITERION_ID)
+		&& aCriteria.mCriterionHwnd != HWND_BROADCAST && !IsWindow(aCriteria.mCriterionHwnd))
+		return FAIL;
+	bool exclude_title_became_non_blank = *aCriteria.mExcludeTitle && !*mCriterionExcludeTitle;
+	DWORD orig_criteria = mCriteria;
+	mCriterionExcludeTitle = aCriteria.mExcludeTitle;
+	mCriterionExcludeTitleLength = aCriteria.mCriterionExcludeTitleLength;
+	mCriterionText = aCriteria.mText;
+	mCriterionExcludeText = aCriteria.mExcludeText;
+	mSettings = &aSettings;
+	mUseSnapshot = WindowSnapshot::Available();
+	mCriteria = aCriteria.mCriteria;
+	mCriterionTitle = aCriteria.mCriterionTitle;
+	mCriterionTitleLength = aCriteria.mCriterionTitleLength;
+	mCriterionClass = aCriteria.mCriterionClass;
+	mCriterionPath = aCriteria.mCriterionPath;
+	mCriterionPathIsNameOnly = aSettings.TitleMatchMode != FIND_REGEX && !_tcschr(mCriterionPath, '\\');
+	mCriterionHwnd = aCriteria.mCriterionHwnd;
+	mCriterionPID = aCriteria.mCriterionPID;
+	mCriterionGroup = aCriteria.mCriterionGroup;
+	mCompiled = &aCriteria;
+	if (aSettings.TitleMatchMode == FIND_REGEX)
+		aCriteria.CompileRegEx();
+	if (mCriteria != orig_criteria || exclude_title_became_non_blank)
+		UpdateCandidateAttributes();
+	return OK;
+}
+
+
+
 void WindowSearch::UpdateCandidateAttributes()
 // This function must be kept thread-safe because it may be called (indirectly) by hook thread too.
 {
@@ -1527,6 +1610,11 @@ void WindowSearch::UpdateCandidateAttributes()
 	// are not yet initialized:
 	if (!mCandidateParent || !mCriteria)
 		return;
+	if (mUseSnapshot) // Only the main thread uses the snapshot, so this remains thread-safe.
+	{
+		WindowSnapshot::GetAttributes(*this);
+		return;
+	}
 	if ((mCriteria & CRITERION_TITLE) || *mCriterionExcludeTitle) // Need the window's title in both these cases.
 		if (!GetWindowText(mCandidateParent, mCandidateTitle, _countof(mCandidateTitle)))
 			*mCandidateTitle = '\0'; // Failure or blank title is okay.
@@ -1574,7 +1662,8 @@ HWND WindowSearch::IsMatch(bool aInvert)
 				return NULL;
 			break;
 		case FIND_REGEX:
-			if (!RegExMatch(mCandidateTitle, mCriterionTitle))
+			if (!(mCompiled && mCompiled->mTitleRegEx ? RegExMatch(mCandidateTitle, mCompiled->mTitleRegEx)
+				: RegExMatch(mCandidateTitle, mCriterionTitle)))
 				return NULL;
 			break;
 		default: // Exact match.
@@ -1588,7 +1677,8 @@ HWND WindowSearch::IsMatch(bool aInvert)
 	{
 		if (mSettings->TitleMatchMode == FIND_REGEX)
 		{
-			if (!RegExMatch(mCandidateClass, mCriterionClass))
+			if (!(mCompiled && mCompiled->mClassRegEx ? RegExMatch(mCandidateClass, mCompiled->mClassRegEx)
+				: RegExMatch(mCandidateClass, mCriterionClass)))
 				return NULL;
 		}
 		else // For backward compatibility, all other modes use exact-match for Class.
@@ -1606,7 +1696,8 @@ HWND WindowSearch::IsMatch(bool aInvert)
 	{
 		if (mSettings->TitleMatchMode == FIND_REGEX)
 		{
-			if (!RegExMatch(mCandidatePath, mCriterionPath))
+			if (!(mCompiled && mCompiled->mPathRegEx ? RegExMatch(mCandidatePath, mCompiled->mPathRegEx)
+				: RegExMatch(mCandidatePath, mCriterionPath)))
 				return NULL;
 		}
 		else
@@ -1649,7 +1740,8 @@ HWND WindowSearch::IsMatch(bool aInvert)
 				return NULL;
 			break;
 		case FIND_REGEX:
-			if (RegExMatch(mCandidateTitle, mCriterionExcludeTitle))
+			if (mCompiled && mCompiled->mExcludeTitleRegEx ? RegExMatch(mCandidateTitle, mCompiled->mExcludeTitleRegEx)
+				: RegExMatch(mCandidateTitle, mCriterionExcludeTitle))
 				return NULL;
 			break;
 		default: // Exact match.
@@ -1706,6 +1798,336 @@ HWND WindowSearch::IsMatch(bool aInvert)
 
 
 
+#ifndef EVENT_OBJECT_CLOAKED // Defined by the SDK only for _WIN32_WINNT >= 0x0602.
+#define EVENT_OBJECT_CLOAKED 0x8017
+#define EVENT_OBJECT_UNCLOAKED 0x8018
+#endif
+
+bool WinEventHook::Install(WINEVENTPROC aProc, UINT aEvents)
+// Installs hooks for the events indicated by aEvents, a combination of the EVENTS_ flags.
+// Returns true if all of the hooks were installed.  Must not be called again before Remove().
+{
+	// Separate hooks are used to avoid receiving the very frequent EVENT_OBJECT_LOCATIONCHANGE,
+	// which lies between EVENT_OBJECT_HIDE and EVENT_OBJECT_NAMECHANGE, and the other object
+	// events between EVENT_OBJECT_NAMECHANGE and EVENT_OBJECT_CLOAKED.  Each set of events is
+	// covered by the first range whose flags are all requested, so adjacent ranges share a hook.
+	static const struct { UINT events; DWORD min, max; } sEventRange[] = {
+		{EVENTS_FOREGROUND, EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND},
+		{EVENTS_CREATE_DESTROY | EVENTS_SHOW_HIDE, EVENT_OBJECT_CREATE, EVENT_OBJECT_HIDE},
+		{EVENTS_CREATE_DESTROY, EVENT_OBJECT_CREATE, EVENT_OBJECT_DESTROY},
+		{EVENTS_SHOW_HIDE, EVENT_OBJECT_SHOW, EVENT_OBJECT_HIDE},
+		{EVENTS_NAMECHANGE, EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE},
+		{EVENTS_CLOAK, EVENT_OBJECT_CLOAKED, EVENT_OBJECT_UNCLOAKED} // Cloaked windows are treated as hidden.
+	};
+	mCount = 0;
+	for (int i = 0; i < _countof(sEventRange); ++i)
+	{
+		if ((aEvents & sEventRange[i].events) != sEventRange[i].events)
+			continue;
+		aEvents &= ~sEventRange[i].events;
+		if (   !(mHook[mCount] = SetWinEventHook(sEventRange[i].min, sEventRange[i].max, NULL
+			, aProc, 0, 0, WINEVENT_OUTOFCONTEXT))   )
+		{
+			Remove();
+			return false;
+		}
+		++mCount;
+	}
+	return true;
+}
+
+
+void WinEventHook::Remove()
+{
+	while (mCount > 0)
+		UnhookWinEvent(mHook[--mCount]);
+}
+
+
+
+static BOOL LiveEnum(WNDENUMPROC aCallback, LPARAM lParam) { return EnumWindows(aCallback, lParam); }
+static bool LiveExists(HWND aWnd) { return IsWindow(aWnd); }
+static bool LiveIsVisible(HWND aWnd) { return IsWindowVisible(aWnd) && !IsWindowCloaked(aWnd); }
+static int LiveGetTitle(HWND aWnd, LPTSTR aBuf, int aBufSize) { return GetWindowText(aWnd, aBuf, aBufSize); }
+static int LiveGetClass(HWND aWnd, LPTSTR aBuf, int aBufSize) { return GetClassName(aWnd, aBuf, aBufSize); }
+static DWORD LiveGetPID(HWND aWnd)
+{
+	DWORD pid = 0;
+	GetWindowThreadProcessId(aWnd, &pid);
+	return pid;
+}
+static DWORD LiveGetPath(DWORD aPID, LPTSTR aBuf, DWORD aBufSize) { return GetProcessName(aPID, aBuf, aBufSize, false); }
+
+WindowSource WindowSnapshot::sLiveSource = {
+	LiveEnum, LiveExists, LiveIsVisible, LiveGetTitle, LiveGetClass, LiveGetPID, LiveGetPath
+};
+WindowSource *WindowSnapshot::sSource = &WindowSnapshot::sLiveSource;
+WindowSnapshot::Item *WindowSnapshot::sItem = NULL;
+size_t WindowSnapshot::sItemCount = 0, WindowSnapshot::sItemCapacity = 0;
+WinEventHook WindowSnapshot::sEventHook;
+DWORD WindowSnapshot::sLastUsed;
+
+
+static inline size_t HwndHash(HWND aWnd)
+{
+	// Handles are usually even, so discard the low bit before mixing.
+	return (size_t)(((UINT_PTR)aWnd >> 1) * (UINT_PTR)Exp32or64(0x9E3779B1, 0x9E3779B97F4A7C15));
+}
+
+
+WindowSnapshot::Item *WindowSnapshot::Find(HWND aWnd)
+// Returns the item for aWnd, or the empty slot where it should be inserted.
+// Caller must ensure the table has been allocated.
+{
+	size_t mask = sItemCapacity - 1;
+	size_t i = HwndHash(aWnd) & mask;
+	while (sItem[i].hwnd && sItem[i].hwnd != aWnd)
+		i = (i + 1) & mask;
+	return sItem + i;
+}
+
+
+WindowSnapshot::Item *WindowSnapshot::Add(HWND aWnd)
+// Returns the item for aWnd, adding it if necessary, or NULL if out of memory.
+{
+	if (sItemCount >= sItemCapacity / 2 && !Expand()) // Keep the table at most half full.
+		return NULL;
+	auto item = Find(aWnd);
+	if (!item->hwnd)
+	{
+		item->hwnd = aWnd;
+		item->valid = 0;
+		++sItemCount;
+	}
+	return item;
+}
+
+
+bool WindowSnapshot::Expand()
+{
+	size_t new_capacity = sItemCapacity ? sItemCapacity * 2 : 512;
+	auto new_item = (Item *)calloc(new_capacity, sizeof(Item));
+	if (!new_item)
+		return false;
+	auto old_item = sItem;
+	auto old_capacity = sItemCapacity;
+	sItem = new_item;
+	sItemCapacity = new_capacity;
+	for (size_t i = 0; i < old_capacity; ++i)
+		if (old_item[i].hwnd)
+			*Find(old_item[i].hwnd) = old_item[i];
+	free(old_item);
+	return true;
+}
+
+
+void WindowSnapshot::Remove(Item *aItem)
+{
+	if (aItem->valid & HAVE_CLASS) free(aItem->class_name);
+	if (aItem->valid & HAVE_PATH) free(aItem->path);
+	// Backward-shift deletion keeps each probe sequence unbroken without the need for tombstones.
+	size_t mask = sItemCapacity - 1;
+	size_t i = aItem - sItem, j = i;
+	for (;;)
+	{
+		j = (j + 1) & mask;
+		if (!sItem[j].hwnd)
+			break;
+		size_t k = HwndHash(sItem[j].hwnd) & mask; // The slot where this item would ideally be.
+		// Move the item into the hole unless its ideal slot lies cyclically within (i, j].
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		sItem[i] = sItem[j];
+		i = j;
+	}
+	sItem[i].hwnd = NULL;
+	--sItemCount;
+}
+
+
+void WindowSnapshot::Store(Item *aItem, UCHAR aFlag, LPTSTR &aCopy, LPCTSTR aValue)
+{
+	if (aCopy = _tcsdup(aValue))
+		aItem->valid |= aFlag;
+	//else leave it to be retrieved again next time.
+}
+
+
+void WindowSnapshot::Clear()
+{
+	for (size_t i = 0; i < sItemCapacity; ++i)
+		if (sItem[i].hwnd)
+		{
+			if (sItem[i].valid & HAVE_CLASS) free(sItem[i].class_name);
+			if (sItem[i].valid & HAVE_PATH) free(sItem[i].path);
+			sItem[i].hwnd = NULL;
+		}
+	sItemCount = 0;
+}
+
+
+bool WindowSnapshot::Start()
+{
+	// Only destruction invalidates the cache; other events would just wake the thread for nothing.
+	if (!sEventHook.Install(WinEventProc, WinEventHook::EVENTS_CREATE_DESTROY))
+		return false;
+	if (!SetTimer(g_hWnd, TIMER_ID_WINDOW_SNAPSHOT, WINDOW_SNAPSHOT_IDLE_TIMEOUT, IdleTimeout))
+	{
+		sEventHook.Remove(); // Don't leave it installed indefinitely.
+		return false;
+	}
+	return true;
+}
+
+
+void WindowSnapshot::Stop()
+// Removes the hook and discards the cache, since changes are no longer tracked.
+{
+	KillTimer(g_hWnd, TIMER_ID_WINDOW_SNAPSHOT);
+	sEventHook.Remove();
+	Clear();
+}
+
+
+VOID CALLBACK WindowSnapshot::IdleTimeout(HWND hWnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime)
+{
+	if (GetTickCount() - sLastUsed >= WINDOW_SNAPSHOT_IDLE_TIMEOUT)
+		Stop();
+}
+
+
+void CALLBACK WindowSnapshot::WinEventProc(HWINEVENTHOOK aHook, DWORD aEvent, HWND aHwnd, LONG aObjectID
+	, LONG aChildID, DWORD aEventThread, DWORD aEventTime)
+{
+	if (aObjectID != OBJID_WINDOW || aChildID != CHILDID_SELF || !aHwnd || !sItemCount)
+		return;
+	// Otherwise, the window was destroyed, or it was created and its handle was previously
+	// used by a window whose destruction wasn't seen.
+	auto item = Find(aHwnd);
+	if (item->hwnd)
+		Remove(item);
+}
+
+
+bool WindowSnapshot::Available()
+// Returns true if window searches by the current thread should retrieve attributes via the snapshot.
+{
+	if (GetCurrentThreadId() != g_MainThreadID) // The hook thread doesn't use the snapshot.
+		return false;
+	if (!sItem && !Expand())
+		return false;
+	sLastUsed = GetTickCount();
+	return sEventHook.IsInstalled() || sSource != &sLiveSource || Start();
+}
+
+
+BOOL WindowSnapshot::Enum(WindowSearch &aSearch, WNDENUMPROC aCallback)
+// Calls aCallback for each top-level window, as with EnumWindows(aCallback, (LPARAM)&aSearch).
+{
+	return aSearch.mUseSnapshot ? sSource->Enum(aCallback, (LPARAM)&aSearch) : EnumWindows(aCallback, (LPARAM)&aSearch);
+}
+
+
+bool WindowSnapshot::DetectWindow(WindowSearch &aSearch, HWND aWnd)
+{
+	if (!aSearch.mUseSnapshot)
+		return aSearch.mSettings->DetectWindow(aWnd);
+	return aSearch.mSettings->DetectHiddenWindows || sSource->IsVisible(aWnd);
+}
+
+
+static void SetCandidatePath(WindowSearch &aSearch, LPCTSTR aPath)
+{
+	// The full path is cached, so derive the name from it when that's all that is required.
+	LPCTSTR name;
+	if (aSearch.mCriterionPathIsNameOnly && (name = _tcsrchr(aPath, '\\')))
+		aPath = name + 1;
+	tcslcpy(aSearch.mCandidatePath, aPath, _countof(aSearch.mCandidatePath));
+}
+
+
+void WindowSnapshot::GetAttributes(WindowSearch &aSearch)
+// Retrieves the attributes of aSearch.mCandidateParent which are required by its criteria, from
+// the cache if possible.  Any which aren't cached are retrieved from the source and then cached.
+// Retrieving the title might dispatch WinEvents, so no Item pointer is retained across calls to
+// the source.
+{
+	HWND hwnd = aSearch.mCandidateParent;
+	// The title is always retrieved from the source, since it isn't cached.
+	if ((aSearch.mCriteria & CRITERION_TITLE) || *aSearch.mCriterionExcludeTitle)
+		if (!sSource->GetTitle(hwnd, aSearch.mCandidateTitle, _countof(aSearch.mCandidateTitle)))
+			*aSearch.mCandidateTitle = '\0'; // Failure or blank title is okay.
+	UCHAR wanted = 0;
+	if (aSearch.mCriteria & CRITERION_CLASS)
+		wanted |= HAVE_CLASS;
+	if (aSearch.mCriteria & CRITERION_PATH)
+		wanted |= HAVE_PATH | HAVE_PID; // The path is retrieved via the PID.
+	if (aSearch.mCriteria & CRITERION_PID)
+		wanted |= HAVE_PID;
+	if (!wanted)
+		return;
+
+	TCHAR path[MAX_PATH];
+	DWORD pid = 0;
+	auto item = Find(hwnd);
+	UCHAR have = item->hwnd ? item->valid & wanted : 0;
+	if (have & HAVE_PID)
+		pid = item->pid;
+	if (have & HAVE_CLASS)
+		tmemcpy(aSearch.mCandidateClass, item->class_name, _tcslen(item->class_name) + 1);
+	if (have & HAVE_PATH)
+		SetCandidatePath(aSearch, item->path);
+
+	UCHAR missing = wanted & ~have;
+	if (missing)
+	{
+		if (missing & HAVE_PID)
+			pid = sSource->GetPID(hwnd);
+		if (missing & HAVE_CLASS)
+			if (!sSource->GetClass(hwnd, aSearch.mCandidateClass, _countof(aSearch.mCandidateClass)))
+				*aSearch.mCandidateClass = '\0';
+		if (missing & HAVE_PATH)
+		{
+			if (!sSource->GetPath(pid, path, _countof(path)))
+				*path = '\0';
+			SetCandidatePath(aSearch, path);
+		}
+		// Cache what was retrieved.  A window is added only if it still exists, since otherwise
+		// the event which would remove it might already have been delivered.
+		item = Find(hwnd);
+		if (item->hwnd || sSource->Exists(hwnd) && (item = Add(hwnd)))
+		{
+			if (missing & HAVE_PID)
+			{
+				item->pid = pid;
+				item->valid |= HAVE_PID;
+			}
+			if (missing & HAVE_CLASS)
+				Store(item, HAVE_CLASS, item->class_name, aSearch.mCandidateClass);
+			if (missing & HAVE_PATH)
+				Store(item, HAVE_PATH, item->path, path);
+		}
+	}
+
+	if (aSearch.mCriteria & CRITERION_PID)
+		aSearch.mCandidatePID = pid;
+}
+
+
+void WindowSnapshot::SetSource(WindowSource *aSource)
+// Replaces the source of window attributes for the main thread, or restores the live source if
+// aSource is NULL.  Any attributes cached from the previous source are discarded.
+{
+	Clear();
+	sSource = aSource ? aSource : &sLiveSource;
+}
+
+
+
+///////////////////////////////////////////////////////////////////
+
+
+
 void DialogPrep()
 // Having it as a function vs. macro should reduce code size due to expansion of macros inside.
 {
@@ -79,6 +79,98 @@ inline bool IsTextMatch(LPCTSTR aHaystack, LPCTSTR aNeedle)
 #define CRITERION_GROUP 0x10
 #define CRITERION_PATH	0x20
 
+// The functions through which WindowSnapshot retrieves information about top-level windows.
+// sLiveSource calls the corresponding Windows API functions, but another source can be substituted
+// so that window searches can be tested and benchmarked against a synthetic set of windows.
+struct WindowSource
+{
+	BOOL (*Enum)(WNDENUMPROC aCallback, LPARAM lParam); // Top-level windows in Z-order, like EnumWindows().
+	bool (*Exists)(HWND aWnd);
+	bool (*IsVisible)(HWND aWnd); // Visible and not cloaked.
+	int (*GetTitle)(HWND aWnd, LPTSTR aBuf, int aBufSize);
+	int (*GetClass)(HWND aWnd, LPTSTR aBuf, int aBufSize);
+	DWORD (*GetPID)(HWND aWnd);
+	DWORD (*GetPath)(DWORD aPID, LPTSTR aBuf, DWORD aBufSize); // Full path of the process's executable.
+};
+
+class WindowSearch;
+class WinCriteria;
+
+// A set of out-of-context WinEvent hooks for the events which can change the outcome of a search
+// for top-level windows: activation, creation, destruction, showing, hiding, renaming and cloaking.
+// The caller passes a combination of the EVENTS_ flags, so that it isn't woken for events it doesn't
+// need.  The events are delivered to the callback on the thread which called Install(), whenever that
+// thread checks its messages.  The callback must filter out events for objects other than windows.
+class WinEventHook
+{
+	HWINEVENTHOOK mHook[5];
+	int mCount = 0;
+public:
+	enum : UINT
+	{
+		EVENTS_FOREGROUND = 0x01,
+		EVENTS_CREATE_DESTROY = 0x02,
+		EVENTS_SHOW_HIDE = 0x04,
+		EVENTS_NAMECHANGE = 0x08,
+		EVENTS_CLOAK = 0x10,
+		EVENTS_ALL = 0x1F
+	};
+	bool Install(WINEVENTPROC aProc, UINT aEvents);
+	void Remove();
+	bool IsInstalled() { return mCount != 0; }
+};
+
+// A cache of the attributes of top-level windows, used only by window searches on the main thread.
+// Scripts which poll with WinExist or WinGetList would otherwise retrieve the class, PID and (for
+// ahk_exe) the process path of every window on every call.  These can't change during the life of
+// a window, so each is retrieved when first needed and kept until a WinEvent hook reports that the
+// window was destroyed.  Titles aren't cached, since some windows answer WM_GETTEXT dynamically
+// without reporting a change.  The order of windows and their visibility change often and are
+// cheap to retrieve, so they aren't cached either.  The hook is removed and the cache discarded
+// after WINDOW_SNAPSHOT_IDLE_TIMEOUT without any searches, so that a script which searches only
+// occasionally doesn't keep receiving events for every window in the system.
+#define WINDOW_SNAPSHOT_IDLE_TIMEOUT 10000
+class WindowSnapshot
+{
+	enum : UCHAR { HAVE_CLASS = 0x01, HAVE_PID = 0x02, HAVE_PATH = 0x04 };
+	struct Item
+	{
+		HWND hwnd; // NULL indicates an empty slot.
+		UCHAR valid; // HAVE_ flags indicating which of the attributes below have been retrieved.
+		DWORD pid;
+		LPTSTR class_name, path;
+	};
+
+	// Open addressing with linear probing.
+	static Item *sItem;
+	static size_t sItemCount, sItemCapacity;
+
+	static WindowSource *sSource;
+	static WinEventHook sEventHook;
+	static DWORD sLastUsed; // Tick count of the most recent search which used the snapshot.
+
+	static Item *Find(HWND aWnd);
+	static Item *Add(HWND aWnd);
+	static bool Expand();
+	static void Remove(Item *aItem);
+	static void Store(Item *aItem, UCHAR aFlag, LPTSTR &aCopy, LPCTSTR aValue);
+	static void Clear();
+	static bool Start();
+	static void Stop();
+	static void CALLBACK WinEventProc(HWINEVENTHOOK aHook, DWORD aEvent, HWND aHwnd, LONG aObjectID
+		, LONG aChildID, DWORD aEventThread, DWORD aEventTime);
+	static VOID CALLBACK IdleTimeout(HWND hWnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime);
+
+public:
+	static WindowSource sLiveSource;
+
+	static bool Available();
+	static BOOL Enum(WindowSearch &aSearch, WNDENUMPROC aCallback);
+	static bool DetectWindow(WindowSearch &aSearch, HWND aWnd);
+	static void GetAttributes(WindowSearch &aSearch);
+	static void SetSource(WindowSource *aSource);
+};
+
 class WindowSearch
 {
 	// One of the reasons for having this class is to avoid fetching PID, Class, and Window Text
@@ -105,7 +197,10 @@ public:
 	WinGroup *mCriterionGroup;                // For "ahk_group".
 	LPCTSTR mCriterionPath;                    // For "ahk_exe".
 
+	WinCriteria *mCompiled;                   // Set if the criteria came from a WinCriteria, for its compiled RegExes.
+
 	bool mCriterionPathIsNameOnly;
+	bool mUseSnapshot;   // Set by SetCriteria(): whether attributes are retrieved via WindowSnapshot.
 	bool mFindLastMatch; // Whether to keep searching even after a match is found, so that last one is found.
 	int mFoundCount;     // Accumulates how many matches have been found (either 0 or 1 unless mFindLastMatch==true).
 	HWND mFoundParent;   // Must be separate from mCandidateParent because some callers don't have access to IsMatch()'s return value.
@@ -138,6 +233,7 @@ public:
 
 	ResultType SetCriteria(ScriptThreadSettings &aSettings, LPCTSTR aTitle, LPCTSTR aText, LPCTSTR aExcludeTitle, LPCTSTR aExcludeText);
 	void SetCriteria(global_struct &aSettings, WinGroup &aGroup);
+	ResultType SetCriteria(ScriptThreadSettings &aSettings, WinCriteria &aCriteria);
 	void UpdateCandidateAttributes();
 	HWND IsMatch(bool aInvert = false);
 
@@ -148,7 +244,7 @@ public:
 		, mCriterionBuf(NULL), mCriterionBufSize(0)
 		, mFoundCount(0), mFoundParent(NULL) // Must be initialized here since none of the member functions is allowed to do it.
 		, mFoundChild(NULL) // ControlExist() relies upon this.
-		, mCandidateParent(NULL)
+		, mCandidateParent(NULL), mUseSnapshot(false), mCompiled(NULL)
 		// The following must be initialized because it's the object user's responsibility to override
 		// them in those relatively rare cases when they need to be.  WinGroup::ActUponAll() and
 		// WinGroup::Deactivate() (and probably other callers) rely on these attributes being retained
@@ -236,10 +332,12 @@ HWND WinClose(HWND aWnd, int aTimeToWaitForClose = DEFAULT_WINCLOSE_WAIT, bool a
 
 HWND WinActive(global_struct &aSettings, LPCTSTR aTitle, LPCTSTR aText, LPCTSTR aExcludeTitle, LPCTSTR aExcludeText
 	, bool aUpdateLastUsed = false);
+HWND WinActive(global_struct &aSettings, WinCriteria &aCriteria, bool aUpdateLastUsed = false);
 
 HWND WinExist(global_struct &aSettings, LPCTSTR aTitle, LPCTSTR aText, LPCTSTR aExcludeTitle, LPCTSTR aExcludeText
 	, bool aFindLastMatch = false, bool aUpdateLastUsed = false
 	, HWND aAlreadyVisited[] = NULL, int aAlreadyVisitedCount = 0);
+HWND WinExist(global_struct &aSettings, WinCriteria &aCriteria, bool aFindLastMatch = false, bool aUpdateLastUsed = false);
 
 HWND GetValidLastUsedWindow(global_struct &aSettings);
 